@@ -0,0 +1,224 @@
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/stat.h>
+
+#include "list.h"
+#include "rio.h"
+#include "accesslog.h"
+
+#define OUTBUF (64 * 1024)      /* bytes the drain thread gathers per write */
+
+_Static_assert(sizeof(struct access_record) == 96, "the binary log format changed");
+
+/*
+ * Single producer, single consumer: the pool thread that owns the ring
+ * moves head, the drain thread moves tail.  They sit on separate cache
+ * lines so the two do not contend for one.
+ */
+struct access_ring {
+    struct list_elem elem;
+    struct access_log *log;
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long dropped;
+    unsigned long tail __attribute__((aligned(64)));
+    struct access_record records[ACCESSLOG_RING];
+};
+
+struct access_log {
+    int fd;
+    int format;
+
+    pthread_mutex_t rings_lock; /* taken when a thread logs for the first time, and per drain */
+    struct list rings;
+    unsigned long nrings;
+
+    unsigned long logged;       /* written by the drain thread only */
+};
+
+// The calling thread's ring, made the first time it logs
+static __thread struct access_ring *my_ring;
+
+static struct access_ring *ring_of(struct access_log *log) {
+    struct access_ring *ring = my_ring;
+
+    if (ring != NULL && ring->log == log) {
+        return ring;
+    }
+    if (posix_memalign((void **)&ring, 64, sizeof(*ring)) != 0) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->log = log;
+    pthread_mutex_lock(&log->rings_lock);
+    list_push_back(&log->rings, &ring->elem);
+    log->nrings++;
+    pthread_mutex_unlock(&log->rings_lock);
+    my_ring = ring;
+    return ring;
+}
+
+void access_log_record(struct access_log *log, const struct sockaddr *peer, const char *target,
+                       int status, uint64_t bytes, uint64_t latency_ns) {
+    struct access_ring *ring = ring_of(log);
+    struct access_record *r;
+    struct timespec now;
+    unsigned long head;
+    size_t n;
+
+    if (ring == NULL) {
+        return;
+    }
+    head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ACCESSLOG_RING) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    r = &ring->records[head & (ACCESSLOG_RING - 1)];
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    r->time_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    r->bytes = bytes;
+    r->latency_us = latency_ns / 1000 > UINT32_MAX ? UINT32_MAX : latency_ns / 1000;
+    r->status = status;
+    r->family = 0;
+    r->port = 0;
+    memset(r->addr, 0, sizeof(r->addr));
+    if (peer != NULL && peer->sa_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)peer;
+        r->family = AF_INET;
+        r->port = ntohs(in->sin_port);
+        memcpy(r->addr, &in->sin_addr, 4);
+    } else if (peer != NULL && peer->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)peer;
+        r->port = ntohs(in6->sin6_port);
+        // IPv4 clients of the dual stack listener are logged as such
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+            r->family = AF_INET;
+            memcpy(r->addr, &in6->sin6_addr.s6_addr[12], 4);
+        } else {
+            r->family = AF_INET6;
+            memcpy(r->addr, &in6->sin6_addr, 16);
+        }
+    }
+    n = strcspn(target, "?");
+    r->route_len = n < ACCESSLOG_ROUTE ? n : ACCESSLOG_ROUTE;
+    memcpy(r->route, target, r->route_len);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int access_log_format(const struct access_record *r, char *buf, size_t len) {
+    char addr[INET6_ADDRSTRLEN] = "-", when[32];
+    time_t sec = r->time_ns / 1000000000ULL;
+    struct tm tm;
+
+    if (r->family == AF_INET || r->family == AF_INET6) {
+        inet_ntop(r->family == AF_INET ? AF_INET : AF_INET6, r->addr, addr, sizeof(addr));
+    }
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", gmtime_r(&sec, &tm));
+    return snprintf(buf, len, "%s %u [%s.%06luZ] \"%.*s\" %u %llu %uus\n",
+                    addr, r->port, when, (unsigned long)(r->time_ns % 1000000000ULL / 1000),
+                    r->route_len, r->route, r->status, (unsigned long long)r->bytes, r->latency_us);
+}
+
+// Move what each ring holds into out, writing it whenever it fills up
+static void drain(struct access_log *log, char *out) {
+    size_t used = 0;
+    struct list_elem *e;
+
+    pthread_mutex_lock(&log->rings_lock);
+    for (e = list_begin(&log->rings); e != list_end(&log->rings); e = list_next(e)) {
+        struct access_ring *ring = list_entry(e, struct access_ring, elem);
+        unsigned long tail = ring->tail;
+        unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        for (; tail != head; tail++) {
+            const struct access_record *r = &ring->records[tail & (ACCESSLOG_RING - 1)];
+
+            if (OUTBUF - used < 512) {
+                rio_writen(log->fd, out, used);
+                used = 0;
+            }
+            if (log->format == ACCESSLOG_BINARY) {
+                memcpy(out + used, r, sizeof(*r));
+                used += sizeof(*r);
+            } else {
+                used += access_log_format(r, out + used, OUTBUF - used);
+            }
+            log->logged++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&log->rings_lock);
+
+    if (used > 0) {
+        rio_writen(log->fd, out, used);
+    }
+}
+
+static void *drain_thread(void *data) {
+    struct access_log *log = data;
+    struct timespec pause = { 0, ACCESSLOG_FLUSH_MS * 1000000L };
+    char *out = malloc(OUTBUF);
+
+    if (out == NULL) {
+        unix_error("access log malloc error");
+    }
+    while (1) {
+        nanosleep(&pause, NULL);
+        drain(log, out);
+    }
+    return NULL;
+}
+
+struct access_log *access_log_open(const char *path, int format) {
+    struct access_log *log;
+    struct stat sb;
+    pthread_t tid;
+    int fd;
+
+    if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+        return NULL;
+    }
+    // A binary log starts with its header; appending to one just adds records
+    if (format == ACCESSLOG_BINARY && fstat(fd, &sb) == 0 && sb.st_size == 0) {
+        struct access_log_header h = { .record_size = sizeof(struct access_record) };
+        memcpy(h.magic, ACCESSLOG_MAGIC, sizeof(h.magic));
+        rio_writen(fd, &h, sizeof(h));
+    }
+
+    if ((log = calloc(1, sizeof(*log))) == NULL) {
+        unix_error("access_log_open calloc error");
+    }
+    log->fd = fd;
+    log->format = format;
+    pthread_mutex_init(&log->rings_lock, NULL);
+    list_init(&log->rings);
+    if (pthread_create(&tid, NULL, drain_thread, log) != 0) {
+        unix_error("pthread_create error");
+    }
+    return log;
+}
+
+void access_log_get_stats(struct access_log *log, struct access_log_stats *st) {
+    struct list_elem *e;
+
+    st->format = log->format;
+    st->dropped = 0;
+    pthread_mutex_lock(&log->rings_lock);
+    st->logged = log->logged;
+    st->rings = log->nrings;
+    for (e = list_begin(&log->rings); e != list_end(&log->rings); e = list_next(e)) {
+        st->dropped += __atomic_load_n(&list_entry(e, struct access_ring, elem)->dropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&log->rings_lock);
+}
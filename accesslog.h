@@ -0,0 +1,73 @@
+#ifndef __ACCESSLOG_H__
+#define __ACCESSLOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/*
+ * accesslog.h
+ *
+ * An access log kept off the request path.  Each pool thread appends a
+ * fixed size record per request to a ring of its own, without locks or
+ * system calls, and a background thread drains the rings to the log file
+ * every ACCESSLOG_FLUSH_MS, either as lines or as the records themselves.
+ * When a ring is full the record is dropped and counted rather than
+ * making the request wait.
+ *
+ * A binary log is an access_log_header followed by access_records in host
+ * byte order; logdump turns it into lines.
+ */
+
+#define ACCESSLOG_RING 1024         /* records per pool thread, a power of two */
+#define ACCESSLOG_FLUSH_MS 100
+#define ACCESSLOG_ROUTE 54          /* bytes of the path kept */
+
+#define ACCESSLOG_LINE 0
+#define ACCESSLOG_BINARY 1
+
+#define ACCESSLOG_MAGIC "SSDALOG1"
+
+struct access_log_header {
+    char magic[8];                  /* ACCESSLOG_MAGIC */
+    uint32_t record_size;           /* sizeof(struct access_record) */
+    uint32_t reserved;
+};
+
+struct access_record {
+    uint64_t time_ns;               /* CLOCK_REALTIME when the response was queued */
+    uint64_t bytes;                 /* response bytes queued, head and body */
+    uint32_t latency_us;            /* request head complete to response queued */
+    uint16_t status;                /* 0 if no status line was queued */
+    uint16_t port;                  /* client port */
+    uint8_t family;                 /* AF_INET, AF_INET6, or 0 if unknown */
+    uint8_t route_len;
+    uint8_t addr[16];               /* client address, IPv4 in the first 4 bytes */
+    char route[ACCESSLOG_ROUTE];    /* request path without the query, not NUL-terminated */
+};
+
+struct access_log;
+
+struct access_log_stats {
+    int format;                     /* ACCESSLOG_LINE or ACCESSLOG_BINARY */
+    unsigned long logged;           /* records written to the file */
+    unsigned long dropped;          /* records lost to a full ring */
+    unsigned long rings;            /* threads that have logged */
+};
+
+/* Append to the file at path, creating it; NULL with errno set on failure */
+struct access_log *access_log_open(const char *path, int format);
+
+/*
+ * Log one request from the calling thread.  peer may be NULL; target is
+ * the request target as sent, of which only the path is kept.
+ */
+void access_log_record(struct access_log *log, const struct sockaddr *peer, const char *target,
+                       int status, uint64_t bytes, uint64_t latency_ns);
+
+void access_log_get_stats(struct access_log *log, struct access_log_stats *st);
+
+/* Format r as one log line, newline included; returns its length like snprintf */
+int access_log_format(const struct access_record *r, char *buf, size_t len);
+
+#endif /* __ACCESSLOG_H__ */
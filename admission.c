@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include "rio.h"
+#include "admission.h"
+#include "timewheel.h"
+
+struct admission {
+    unsigned long max_depth;
+    uint64_t target_ns;
+    bool reset;
+
+    // Shared by every event loop and pool thread, only touched atomically
+    unsigned long queued;
+    uint64_t first_above;       /* when the sojourn time may count as standing, 0 if below target */
+    bool dropping;
+
+    unsigned long admitted;
+    unsigned long shed_depth;
+    unsigned long shed_sojourn;
+};
+
+struct admission *admission_new(unsigned long max_depth, long target_ms, bool reset) {
+    struct admission *a = calloc(1, sizeof(*a));
+
+    if (a == NULL) {
+        unix_error("admission_new calloc error");
+    }
+    a->max_depth = max_depth;
+    a->target_ns = (uint64_t)target_ms * 1000000ULL;
+    a->reset = reset;
+    return a;
+}
+
+bool admission_enqueue(struct admission *a) {
+    unsigned long queued = __atomic_load_n(&a->queued, __ATOMIC_RELAXED);
+
+    if (a->max_depth != 0 && queued >= a->max_depth) {
+        __atomic_fetch_add(&a->shed_depth, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    if (__atomic_load_n(&a->dropping, __ATOMIC_RELAXED)) {
+        // Once the queue has drained there is nothing standing any more
+        if (queued != 0) {
+            __atomic_fetch_add(&a->shed_sojourn, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+        __atomic_store_n(&a->dropping, false, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&a->queued, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&a->admitted, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/*
+ * CoDel: a single slow dequeue is a burst, but if every request picked up
+ * during a whole interval waited longer than target, the queue is standing
+ * and only shedding load will drain it.  While dropping, anything that
+ * already waited longer than target is answered cheaply instead of served.
+ */
+bool admission_dequeue(struct admission *a, uint64_t queued_at_ns) {
+    uint64_t now, sojourn;
+
+    __atomic_fetch_sub(&a->queued, 1, __ATOMIC_RELAXED);
+    if (a->target_ns == 0) {
+        return true;
+    }
+
+    now = now_ns();
+    sojourn = now - queued_at_ns;
+    if (sojourn < a->target_ns) {
+        __atomic_store_n(&a->first_above, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&a->dropping, false, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    uint64_t first_above = __atomic_load_n(&a->first_above, __ATOMIC_RELAXED);
+    if (first_above == 0) {
+        __atomic_store_n(&a->first_above, now + ADMISSION_INTERVAL_NS, __ATOMIC_RELAXED);
+    } else if (now >= first_above) {
+        __atomic_store_n(&a->dropping, true, __ATOMIC_RELAXED);
+    }
+
+    if (__atomic_load_n(&a->dropping, __ATOMIC_RELAXED)) {
+        __atomic_fetch_sub(&a->admitted, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&a->shed_sojourn, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+bool admission_resets(struct admission *a) {
+    return a->reset;
+}
+
+void admission_get_stats(struct admission *a, struct admission_stats *st) {
+    st->max_depth = a->max_depth;
+    st->target_ms = a->target_ns / 1000000ULL;
+    st->reset = a->reset;
+    st->overloaded = __atomic_load_n(&a->dropping, __ATOMIC_RELAXED);
+    st->queued = __atomic_load_n(&a->queued, __ATOMIC_RELAXED);
+    st->admitted = __atomic_load_n(&a->admitted, __ATOMIC_RELAXED);
+    st->shed_depth = __atomic_load_n(&a->shed_depth, __ATOMIC_RELAXED);
+    st->shed_sojourn = __atomic_load_n(&a->shed_sojourn, __ATOMIC_RELAXED);
+}
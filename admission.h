@@ -0,0 +1,47 @@
+#ifndef __ADMISSION_H__
+#define __ADMISSION_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * admission.h
+ *
+ * Overload control between the event loops and the thread pool.  A request
+ * is turned away when the pool queue is deeper than a fixed bound, or when
+ * requests have been sitting in the queue longer than a target for a whole
+ * interval (the CoDel signal for a standing queue).  Turned away requests
+ * get a canned 503 with Retry-After, or a reset.
+ */
+
+/* CoDel interval: how long the sojourn time has to stay above target */
+#define ADMISSION_INTERVAL_NS 100000000L
+
+struct admission;
+
+struct admission_stats {
+    unsigned long max_depth;    /* 0 if unbounded */
+    long target_ms;             /* 0 if sojourn shedding is off */
+    bool reset;                 /* shedding resets instead of answering 503 */
+    bool overloaded;            /* currently in the CoDel dropping state */
+    unsigned long queued;       /* requests waiting for a pool thread */
+    unsigned long admitted;
+    unsigned long shed_depth;   /* turned away because the queue was full */
+    unsigned long shed_sojourn; /* turned away because of a standing queue */
+};
+
+/* max_depth 0 disables the depth bound, target_ms 0 the sojourn target */
+struct admission *admission_new(unsigned long max_depth, long target_ms, bool reset);
+
+/* Called by an event loop before queueing a request; false means shed it */
+bool admission_enqueue(struct admission *a);
+
+/* Called by a pool thread when it picks the request up; false means shed it */
+bool admission_dequeue(struct admission *a, uint64_t queued_at_ns);
+
+/* Should shed connections be reset rather than answered? */
+bool admission_resets(struct admission *a);
+
+void admission_get_stats(struct admission *a, struct admission_stats *st);
+
+#endif /* __ADMISSION_H__ */
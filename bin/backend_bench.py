@@ -0,0 +1,165 @@
+#!/usr/bin/python
+
+#
+# Compare the epoll and io_uring event loop backends of sysstatd.
+#
+# Starts the server once per backend, drives it with keep-alive clients
+# and reads the server's own counters from /shards to report requests
+# per second and event loop system calls per request.
+#
+
+import getopt, sys, os, subprocess, signal, json, time, socket, threading, atexit, re
+
+server_exe = "./sysstatd"
+wrk_exe = None
+path = "/loadavg"
+nconnections = 100
+nthreads = 8
+duration = 5
+depth = 1
+
+backends = [
+    ("epoll", []),
+    ("io_uring", ["-u"]),
+]
+
+def usage():
+    print """
+Usage: %s [-h] [-s server] [-w wrk] [-c connections] [-t threads] [-d seconds] [-P path] [-p depth]
+
+   -h               display this help
+   -s server        path to server executable, default %s
+   -w wrk           use this wrk binary to generate load instead of the built-in client
+   -c connections   number of keep-alive connections, default %d
+   -t threads       number of client threads, default %d
+   -d seconds       duration of each run, default %d
+   -P path          path to request, default %s
+   -p depth         pipeline this many requests per connection (built-in client only), default %d
+    """ % (sys.argv[0], server_exe, nconnections, nthreads, duration, path, depth)
+
+try:
+    opts, args = getopt.getopt(sys.argv[1:], "hs:w:c:t:d:P:p:", ["help"])
+except getopt.GetoptError, err:
+    print str(err)
+    usage()
+    sys.exit(2)
+
+for opt, arg in opts:
+    if opt == "-h":
+        usage()
+        sys.exit(0)
+    elif opt == "-s":
+        server_exe = arg
+    elif opt == "-w":
+        wrk_exe = arg
+    elif opt == "-c":
+        nconnections = int(arg)
+    elif opt == "-t":
+        nthreads = int(arg)
+    elif opt == "-d":
+        duration = int(arg)
+    elif opt == "-P":
+        path = arg
+    elif opt == "-p":
+        depth = int(arg)
+    else:
+        assert False, "unhandled option"
+
+def get_shards(port):
+    sock = socket.create_connection(("localhost", port))
+    sock.sendall("GET /shards HTTP/1.0\r\n\r\n")
+    data = ""
+    while True:
+        chunk = sock.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+    sock.close()
+    return json.loads(data.split("\r\n\r\n", 1)[1])
+
+def totals(port):
+    shards = get_shards(port)
+    return (sum(s["requests"] for s in shards), sum(s["syscalls"] for s in shards), shards[0]["backend"])
+
+def read_response(sock, pending):
+    """Read one response off a keep-alive connection, return leftover bytes"""
+    data = pending
+    while "\r\n\r\n" not in data:
+        chunk = sock.recv(65536)
+        if not chunk:
+            raise IOError("connection closed")
+        data += chunk
+    head, rest = data.split("\r\n\r\n", 1)
+    m = re.search(r"content-length:\s*(\d+)", head, re.I)
+    length = int(m.group(1)) if m else 0
+    while len(rest) < length:
+        chunk = sock.recv(65536)
+        if not chunk:
+            raise IOError("connection closed")
+        rest += chunk
+    return rest[length:]
+
+def client(port, nconn, deadline, counts, idx):
+    request = ("GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n" % path) * depth
+    socks = [socket.create_connection(("localhost", port)) for i in range(nconn)]
+    pending = [""] * nconn
+    done = 0
+    while time.time() < deadline:
+        # depth requests in flight on every connection, so the server sees them together
+        for s in socks:
+            s.sendall(request)
+        for i, s in enumerate(socks):
+            for j in range(depth):
+                pending[i] = read_response(s, pending[i])
+            done += depth
+    for s in socks:
+        s.close()
+    counts[idx] = done
+
+def run_builtin(port):
+    deadline = time.time() + duration
+    counts = [0] * nthreads
+    threads = []
+    for t in range(nthreads):
+        nconn = nconnections / nthreads + (1 if t < nconnections % nthreads else 0)
+        th = threading.Thread(target=client, args=(port, nconn, deadline, counts, t))
+        th.start()
+        threads.append(th)
+    for th in threads:
+        th.join()
+
+def run_wrk(port):
+    cmd = [wrk_exe, "-c", str(nconnections), "-t", str(nthreads), "-d", "%ds" % duration,
+           "http://localhost:%d%s" % (port, path)]
+    subprocess.call(cmd, stdout=open(os.devnull, "w"))
+
+def bench(name, flags):
+    port = (os.getpid() % 10000) + 20000 + len(flags)
+    server = subprocess.Popen([server_exe, "-p", str(port)] + flags,
+                              stdout=open(os.devnull, "w"), stderr=sys.stderr)
+    atexit.register(lambda: server.poll() is None and os.kill(server.pid, signal.SIGKILL))
+    time.sleep(1)
+
+    req0, sys0, backend = totals(port)
+    start = time.time()
+    if wrk_exe:
+        run_wrk(port)
+    else:
+        run_builtin(port)
+    elapsed = time.time() - start
+    req1, sys1, backend = totals(port)
+
+    os.kill(server.pid, signal.SIGKILL)
+    server.wait()
+
+    # the /shards request itself is one request, take it out
+    nreq = req1 - req0 - 1
+    return dict(name=name, backend=backend, requests=nreq,
+                rps=nreq / elapsed, syscalls_per_request=float(sys1 - sys0) / max(nreq, 1))
+
+results = [bench(name, flags) for name, flags in backends]
+
+print "%-10s %-10s %12s %12s %16s" % ("requested", "backend", "requests", "req/s", "syscalls/req")
+for r in results:
+    print "%-10s %-10s %12d %12.0f %16.2f" % (r["name"], r["backend"], r["requests"],
+                                              r["rps"], r["syscalls_per_request"])
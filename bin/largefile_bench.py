@@ -0,0 +1,143 @@
+#!/usr/bin/python
+
+#
+# Measure what serving a large static file costs sysstatd.
+#
+# Starts the server once per backend with a scratch root holding one file,
+# has keep-alive clients fetch it over and over, and reports throughput and
+# the CPU time the server process used per GB of file served, taken from
+# /proc/<pid>/stat.
+#
+
+import getopt, sys, os, subprocess, signal, time, socket, threading, atexit, re, shutil, tempfile
+
+server_exe = "./sysstatd"
+wrk_exe = None
+size = 2250 * 1024
+nconnections = 8
+duration = 5
+
+backends = [
+    ("epoll", []),
+    ("io_uring", ["-u"]),
+]
+
+def usage():
+    print """
+Usage: %s [-h] [-s server] [-w wrk] [-S bytes] [-c connections] [-d seconds]
+
+   -h               display this help
+   -s server        path to server executable, default %s
+   -w wrk           use this wrk binary to generate load instead of the built-in client
+   -S bytes         size of the file served, default %d (the doom100 object)
+   -c connections   number of keep-alive connections, default %d
+   -d seconds       duration of each run, default %d
+    """ % (sys.argv[0], server_exe, size, nconnections, duration)
+
+try:
+    opts, args = getopt.getopt(sys.argv[1:], "hs:w:S:c:d:", ["help"])
+except getopt.GetoptError, err:
+    print str(err)
+    usage()
+    sys.exit(2)
+
+for opt, arg in opts:
+    if opt == "-h":
+        usage()
+        sys.exit(0)
+    elif opt == "-s":
+        server_exe = arg
+    elif opt == "-w":
+        wrk_exe = arg
+    elif opt == "-S":
+        size = int(arg)
+    elif opt == "-c":
+        nconnections = int(arg)
+    elif opt == "-d":
+        duration = int(arg)
+    else:
+        assert False, "unhandled option"
+
+clock_ticks = os.sysconf(os.sysconf_names["SC_CLK_TCK"])
+
+def cpu_seconds(pid):
+    # utime and stime are fields 14 and 15; the command name may contain spaces
+    fields = open("/proc/%d/stat" % pid).read().rsplit(")", 1)[1].split()
+    return float(int(fields[11]) + int(fields[12])) / clock_ticks
+
+def fetch(sock, request, length):
+    sock.sendall(request)
+    data = ""
+    while "\r\n\r\n" not in data:
+        chunk = sock.recv(65536)
+        if not chunk:
+            raise IOError("connection closed")
+        data += chunk
+    head, rest = data.split("\r\n\r\n", 1)
+    m = re.search(r"content-length:\s*(\d+)", head, re.I)
+    if not m or int(m.group(1)) != length:
+        raise IOError("unexpected response: " + head.split("\r\n")[0])
+    left = length - len(rest)
+    while left > 0:
+        n = len(sock.recv(min(left, 1 << 20)))
+        if n == 0:
+            raise IOError("connection closed")
+        left -= n
+
+def client(port, deadline, counts, idx):
+    request = "GET /files/large HTTP/1.1\r\nHost: localhost\r\n\r\n"
+    sock = socket.create_connection(("localhost", port))
+    done = 0
+    while time.time() < deadline:
+        fetch(sock, request, size)
+        done += 1
+    sock.close()
+    counts[idx] = done
+
+def run_builtin(port):
+    deadline = time.time() + duration
+    counts = [0] * nconnections
+    threads = [threading.Thread(target=client, args=(port, deadline, counts, i)) for i in range(nconnections)]
+    for th in threads:
+        th.start()
+    for th in threads:
+        th.join()
+    return sum(counts)
+
+def run_wrk(port):
+    cmd = [wrk_exe, "-c", str(nconnections), "-t", str(min(nconnections, 8)), "-d", "%ds" % duration,
+           "http://localhost:%d/files/large" % port]
+    out = subprocess.Popen(cmd, stdout=subprocess.PIPE).communicate()[0]
+    return int(re.search(r"(\d+) requests in", out).group(1))
+
+def bench(root, name, flags):
+    port = (os.getpid() % 10000) + 21000 + len(flags)
+    server = subprocess.Popen([server_exe, "-p", str(port), "-R", root] + flags,
+                              stdout=open(os.devnull, "w"), stderr=sys.stderr)
+    atexit.register(lambda: server.poll() is None and os.kill(server.pid, signal.SIGKILL))
+    time.sleep(1)
+
+    cpu0 = cpu_seconds(server.pid)
+    start = time.time()
+    nfiles = run_wrk(port) if wrk_exe else run_builtin(port)
+    elapsed = time.time() - start
+    cpu1 = cpu_seconds(server.pid)
+
+    os.kill(server.pid, signal.SIGKILL)
+    server.wait()
+
+    gb = float(nfiles) * size / (1 << 30)
+    return dict(name=name, gb=gb, mbps=gb * 1024 / elapsed,
+                cpu_per_gb=(cpu1 - cpu0) / gb if gb > 0 else 0)
+
+root = tempfile.mkdtemp(prefix="largefile_bench")
+atexit.register(lambda: shutil.rmtree(root, True))
+with open(os.path.join(root, "large"), "w") as f:
+    f.write("0123456789ABCDEF" * (size / 16))
+size = size / 16 * 16
+
+results = [bench(root, name, flags) for name, flags in backends]
+
+print "%-10s %12s %12s %16s" % ("backend", "GB served", "MB/s", "CPU s/GB")
+for r in results:
+    print "%-10s %12.2f %12.0f %16.3f" % (r["name"], r["gb"], r["mbps"], r["cpu_per_gb"])
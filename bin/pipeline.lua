@@ -0,0 +1,21 @@
+--
+-- wrk script for the pipelined benchmarks: every request() sends
+-- PIPELINE_DEPTH requests back to back on the connection, and the results
+-- are written out like cs3214bench.lua does.
+--
+
+dofile(os.getenv("BENCH_LUA"))
+
+depth = tonumber(os.getenv("PIPELINE_DEPTH") or "16")
+
+init = function(args)
+   local r = { }
+   for i = 1, depth do
+      r[i] = wrk.format()
+   end
+   pipelined = table.concat(r)
+end
+
+request = function()
+   return pipelined
+end
@@ -15,7 +15,8 @@ runconfig = namedtuple('runconfig', ['name',        # name of configuration
                          'nconnections',# number of conn per thread
                          'description', # description
                          'path',        # target path to be retrieved
-                         'duration'])   # duration (with unit as string, i.e. "1s")
+                         'duration',    # duration (with unit as string, i.e. "1s")
+                         'pipeline'])   # requests sent back to back per connection
 
 VERSION="1.0"
 server_exe = "./sysstatd"
@@ -24,32 +25,38 @@ wrk_exe = "/home/courses/cs3214/bin/wrk"
 
 # tests will be run in this order
 tests = [
-    runconfig(name="loadavg40", nthreads=20, nconnections=40, duration="10s", path="/loadavg",
+    runconfig(name="loadavg40", nthreads=20, nconnections=40, duration="10s", path="/loadavg", pipeline=1,
         description="""
     Can your server handle 40 parallel connections request /loadavg?
     """),
-    runconfig(name="loadavg500", nthreads=20, nconnections=500, duration="10s", path="/loadavg",
+    runconfig(name="loadavg500", nthreads=20, nconnections=500, duration="10s", path="/loadavg", pipeline=1,
         description="""
     Using 500 connections, each of which is repeatedly requesting /loadavg (~80bytes in
     HTTP body).  We believe this should be enough to make the server CPU bound.
     """),
-    runconfig(name="loadavg10k", nthreads=20, nconnections=10000, duration="10s", path="/loadavg",
+    runconfig(name="loadavg10k", nthreads=20, nconnections=10000, duration="10s", path="/loadavg", pipeline=1,
         description="""
     Handling 10k simultaneous connections has been a target of scalability since 1999:
     http://www.kegel.com/c10k.html
     Can your server handle it?
     """),
-    runconfig(name="wwwcsvt100", nthreads=20, nconnections=100, duration="10s", path="/files/www.cs.vt.edu-20160222.html",
+    runconfig(name="wwwcsvt100", nthreads=20, nconnections=100, duration="10s", path="/files/www.cs.vt.edu-20160222.html", pipeline=1,
         description="""
     The home page of the CS Department, as of 4/22/2016, is about 23KB large (not counting embedded objects).
     If 100 clients accessed it simultaneously, how much throughput could they expect?
     """),
-    runconfig(name="doom100", nthreads=20, nconnections=40, duration="10s", path="/files/large",
+    runconfig(name="doom100", nthreads=20, nconnections=40, duration="10s", path="/files/large", pipeline=1,
         description="""
     According to https://mobiforge.com/research-analysis/the-web-is-doom the combined size of all
     objects that make an average web page is 2,250kBytes as of April 2016. If these were transferred
     all in a single objects, how much throughput would you get?
     This should max out the 10Gbps Ethernet links, even with only 40 connections.
+    """),
+    runconfig(name="loadavg500pipe16", nthreads=20, nconnections=500, duration="10s", path="/loadavg",
+        pipeline=16, description="""
+    The loadavg500 load, but every connection pipelines 16 requests at a time, as
+    HTTP/1.1 allows.  A server that serves everything already buffered in one go and
+    writes the responses out together should handle many times the req/s of loadavg500.
     """)
 ]
 testsbyname = dict((c.name, c) for c in tests)
@@ -62,8 +69,9 @@ Test:           %s
 Connections:    %d
 Duration:       %s
 Path:           %s
+Pipeline:       %d
 Description:    %s
-""" % (test.name, test.nconnections, test.duration, test.path, test.description)
+""" % (test.name, test.nconnections, test.duration, test.path, test.pipeline, test.description)
 
 
 script_dir = "/".join(os.path.realpath(__file__).split("/")[:-1])
@@ -223,10 +231,12 @@ Your server's stderr is going to the driver's stderr.
     server.wait()
 
 def start_wrk(url, test):
+    benchlua = script_dir + "/cs3214bench.lua"
+    script = benchlua if test.pipeline == 1 else script_dir + "/pipeline.lua"
     cmd = [wrk_exe,'-c',str(test.nconnections),
                    '-t',str(test.nthreads),
                    '-d',test.duration,
-                   '-s', script_dir + "/cs3214bench.lua", url + test.path]
+                   '-s', script, url + test.path]
 
     if verbose:
         print "I will now run", " ".join(cmd)
@@ -235,7 +245,8 @@ def start_wrk(url, test):
     luajson = "%s/JSON.lua" % (script_dir)
     assert os.access(luajson, os.R_OK)
     server = subprocess.Popen(cmd, stdout=sys.stdout, stderr=sys.stderr,
-        env=dict(os.environ, JSON_OUTPUT_FILE=resfile, JSON_LUA=luajson))
+        env=dict(os.environ, JSON_OUTPUT_FILE=resfile, JSON_LUA=luajson,
+                 BENCH_LUA=benchlua, PIPELINE_DEPTH=str(test.pipeline)))
     server.wait()
     with open(resfile) as jfile:
         r = json.load(jfile)
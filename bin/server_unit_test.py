@@ -13,7 +13,8 @@
 import sys
 
 import unittest, httplib, json, os, socket, getopt, \
-       subprocess, signal, traceback, time, atexit, inspect, math, struct, errno
+       subprocess, signal, traceback, time, atexit, inspect, math, struct, errno, \
+       tempfile, shutil, gzip, StringIO
 from fractions import Fraction as F
 from socket import error as SocketError
 
@@ -204,6 +205,39 @@ class Single_Conn_Protocol_Case ( Doc_Print_Test_Case ):
         self.http_connection.close()
 
 
+    def test_pipelined_requests(self):
+        """  Test Name: test_pipelined_requests\n\
+        Number Connections: 1 \n\
+        Procedure: Sends four requests in one write without waiting for \n\
+                   any response, and checks that four responses come back \n\
+                   on the connection, in order.
+        """
+        #The 404 goes last: the server closes the connection after an error
+        requests = [("/loadavg", httplib.OK), ("/files/index.html", httplib.OK), \
+                    ("/meminfo", httplib.OK), ("/junk", httplib.NOT_FOUND)]
+
+        #Make HTTP connection for the server
+        sock = server_check.get_socket_connection(self.hostname, self.port)
+
+        sock.send("".join(["GET %s HTTP/1.1\r\nHost: %s\r\n\r\n" % (path, self.hostname) \
+                           for path, status in requests]))
+
+        for path, status in requests:
+            server_response = httplib.HTTPResponse(sock, method="GET")
+            server_response.begin()
+            body = server_response.read()
+
+            self.assertEqual(server_response.status, status, \
+                "Wrong status for the pipelined GET %s" % path)
+            if path == "/loadavg":
+                self.assertTrue(server_check.check_loadavg_response(body), "loadavg check failed")
+            elif path == "/meminfo":
+                self.assertTrue(server_check.check_meminfo_response(body), "meminfo check failed")
+            elif path == "/files/index.html":
+                self.assertEqual(body, files_fixture["index.html"], "Wrong file sent")
+
+        sock.close()
+
 
 
 ##############################################################################
@@ -963,11 +997,746 @@ class Single_Conn_Good_Case(Doc_Print_Test_Case):
 
 
 
+##############################################################################
+## Class: Single_Conn_Files_Case
+## Test cases for static files under /files, served from a root the
+## script fills with the files in files_fixture.
+##############################################################################
+
+# Path below the root -> contents.  app.js is big enough to be compressed
+# and has a brotli sidecar, whose contents are only ever compared.
+files_fixture = {
+    "index.html": "<html><body>sysstatd</body></html>\n",
+    "app.js": "var sysstatd = 'sysstatd';\n" * 100,
+    "app.js.br": "not really brotli, but a sidecar\n",
+    "js/widget.js": "var widget = 1;\n",
+    # text/plain, so worth a try, but random bytes gzip does not shrink
+    "noise.txt": os.urandom(4096),
+}
+
+# -C Cache-Control policies the server is started with
+files_cache_control = ["js/=max-age=86400", "=no-cache"]
+
+class Single_Conn_Files_Case(Doc_Print_Test_Case):
+
+    """
+    Test case for a single connection, requesting static files with the
+    headers that select a representation, a range or a conditional
+    answer.  The tests are aptly named for describing their effects.
+    """
+
+    def __init__(self, testname, hostname, port):
+        """
+        Prepare the test case for creating connections.
+        """
+        super(Single_Conn_Files_Case, self).__init__(testname)
+
+        self.hostname = hostname
+        self.port = port
+
+    def setUp(self):
+        """  Test Name: None -- setUp function\n\
+        Number Connections: N/A \n\
+        Procedure: Opens the HTTP connection to the server.  An error here \
+                   means the script was unable to create a connection to the \
+                   server.
+        """
+        #Make HTTP connection for the server
+        self.http_connection = httplib.HTTPConnection(self.hostname, self.port)
+
+        #Connect to the server
+        self.http_connection.connect()
+
+    def tearDown(self):
+        """  Test Name: None -- tearDown function\n\
+        Number Connections: N/A \n\
+        Procedure: Closes the HTTP connection to the server.  An error here \
+                   means the server crashed after servicing the request from \
+                   the previous test.
+        """
+        #Close the HTTP connection
+        self.http_connection.close()
+        if server.poll() is not None:
+            #self.fail("The server has crashed.  Please investigate.")
+            print "The server has crashed.  Please investigate."
+
+    def get_file(self, path, headers):
+        """
+        GET /files/path with the given headers; the response and its body.
+        """
+        self.http_connection.request("GET", "/files/" + path, headers=headers)
+        server_response = self.http_connection.getresponse()
+        return server_response, server_response.read()
+
+    def check_encoding(self, accept_encoding, expected):
+        """
+        Ask for app.js with this Accept-Encoding and check it comes back
+        in the expected content coding, None for as it is.  The server
+        sends the file as it is while it gzips it the first time, so a
+        plain answer is retried for a while when gzip is expected.
+        """
+        for tries in range(0, 20):
+            server_response, body = self.get_file("app.js", {"Accept-Encoding": accept_encoding})
+            if expected != "gzip" or server_response.getheader("Content-Encoding") is not None:
+                break
+            time.sleep(.1)
+
+        self.assertEqual(server_response.status, httplib.OK, "Server failed to respond")
+        self.assertEqual(server_response.getheader("Content-Encoding"), expected, \
+            "Accept-Encoding: %s chose the wrong content coding" % accept_encoding)
+        if expected == "br":
+            self.assertEqual(body, files_fixture["app.js.br"], "The br sidecar was not sent")
+        elif expected == "gzip":
+            self.assertEqual(gzip.GzipFile(fileobj=StringIO.StringIO(body)).read(), \
+                files_fixture["app.js"], "The gzip body does not unpack to the file")
+        else:
+            self.assertEqual(body, files_fixture["app.js"], "The file was not sent as it is")
+
+    def test_accept_encoding_br(self):
+        """  Test Name: test_accept_encoding_br\n\
+        Number Connections: One \n\
+        Procedure: GET with Accept-Encoding: gzip, br, expecting the br sidecar
+        """
+        self.check_encoding("gzip, br", "br")
+
+    def test_accept_encoding_gzip(self):
+        """  Test Name: test_accept_encoding_gzip\n\
+        Number Connections: One \n\
+        Procedure: GET with Accept-Encoding: gzip, expecting it gzipped
+        """
+        self.check_encoding("gzip", "gzip")
+
+    def test_accept_encoding_identity(self):
+        """  Test Name: test_accept_encoding_identity\n\
+        Number Connections: One \n\
+        Procedure: GET with Accept-Encoding: identity, expecting it as it is
+        """
+        self.check_encoding("identity", None)
+
+    def test_accept_encoding_q_zero(self):
+        """  Test Name: test_accept_encoding_q_zero\n\
+        Number Connections: One \n\
+        Procedure: GET with Accept-Encoding: gzip;q=0, br;q=0, expecting it \n\
+                   as it is
+        """
+        self.check_encoding("gzip;q=0, br;q=0", None)
+
+    def test_accept_encoding_star(self):
+        """  Test Name: test_accept_encoding_star\n\
+        Number Connections: One \n\
+        Procedure: GET with Accept-Encoding: *, expecting the br sidecar
+        """
+        self.check_encoding("*", "br")
+
+    def test_accept_encoding_star_after_refusal(self):
+        """  Test Name: test_accept_encoding_star_after_refusal\n\
+        Number Connections: One \n\
+        Procedure: GET with Accept-Encoding: br;q=0, *, expecting gzip: the \n\
+                   * only covers codings not named elsewhere
+        """
+        self.check_encoding("br;q=0, *", "gzip")
+
+    def test_accept_encoding_star_refused(self):
+        """  Test Name: test_accept_encoding_star_refused\n\
+        Number Connections: One \n\
+        Procedure: GET with Accept-Encoding: gzip, *;q=0, expecting gzip: a \n\
+                   refused * does not take back a coding named elsewhere
+        """
+        self.check_encoding("gzip, *;q=0", "gzip")
+
+    def test_accept_encoding_star_first(self):
+        """  Test Name: test_accept_encoding_star_first\n\
+        Number Connections: One \n\
+        Procedure: GET with Accept-Encoding: *, br;q=0, expecting gzip \n\
+                   whatever the order
+        """
+        self.check_encoding("*, br;q=0", "gzip")
+
+    def test_accept_encoding_incompressible(self):
+        """  Test Name: test_accept_encoding_incompressible\n\
+        Number Connections: One \n\
+        Procedure: GET a file gzip does not shrink with Accept-Encoding: gzip \n\
+                   a few times, expecting it as it is every time, and once \n\
+                   the server has tried, no more Vary: gzip is off the table \n\
+                   for that version of the file
+        """
+        vary = True
+        for tries in range(0, 20):
+            server_response, body = self.get_file("noise.txt", {"Accept-Encoding": "gzip"})
+
+            self.assertEqual(server_response.status, httplib.OK, "Server failed to respond")
+            self.assertEqual(server_response.getheader("Content-Encoding"), None, \
+                "A file gzip does not shrink was sent gzipped")
+            self.assertEqual(body, files_fixture["noise.txt"], "The file was not sent as it is")
+            vary = server_response.getheader("Vary") is not None
+            if not vary:
+                break
+            time.sleep(.1)
+
+        self.assertFalse(vary, "The server keeps offering gzip for a file it could not shrink")
+
+
+    def test_range_first_byte(self):
+        """  Test Name: test_range_first_byte\n\
+        Number Connections: One \n\
+        Procedure: GET with Range: bytes=0-0, expecting a 206 with the first \n\
+                   byte of the file alone
+        """
+        size = len(files_fixture["index.html"])
+        server_response, body = self.get_file("index.html", {"Range": "bytes=0-0"})
+
+        self.assertEqual(server_response.status, httplib.PARTIAL_CONTENT, "Server did not answer 206")
+        self.assertEqual(server_response.getheader("Content-Range"), "bytes 0-0/%d" % size, \
+            "Wrong Content-Range")
+        self.assertEqual(body, files_fixture["index.html"][0], "Wrong byte sent")
+
+    def test_range_suffix_zero(self):
+        """  Test Name: test_range_suffix_zero\n\
+        Number Connections: One \n\
+        Procedure: GET with Range: bytes=-0, the last zero bytes, expecting \n\
+                   a 416
+        """
+        size = len(files_fixture["index.html"])
+        server_response, body = self.get_file("index.html", {"Range": "bytes=-0"})
+
+        self.assertEqual(server_response.status, httplib.REQUESTED_RANGE_NOT_SATISFIABLE, \
+            "Server did not answer 416")
+        self.assertEqual(server_response.getheader("Content-Range"), "bytes */%d" % size, \
+            "Wrong Content-Range")
+
+    def test_range_past_end(self):
+        """  Test Name: test_range_past_end\n\
+        Number Connections: One \n\
+        Procedure: GET with a Range starting past the end of the file, \n\
+                   expecting a 416
+        """
+        size = len(files_fixture["index.html"])
+        server_response, body = self.get_file("index.html", {"Range": "bytes=%d-" % size})
+
+        self.assertEqual(server_response.status, httplib.REQUESTED_RANGE_NOT_SATISFIABLE, \
+            "Server did not answer 416")
+
+    def test_range_multipart(self):
+        """  Test Name: test_range_multipart\n\
+        Number Connections: One \n\
+        Procedure: GET with Range: bytes=0-1,5-7, expecting a 206 with a \n\
+                   multipart/byteranges body holding both ranges
+        """
+        contents = files_fixture["index.html"]
+        server_response, body = self.get_file("index.html", {"Range": "bytes=0-1,5-7"})
+
+        self.assertEqual(server_response.status, httplib.PARTIAL_CONTENT, "Server did not answer 206")
+        content_type = server_response.getheader("Content-Type")
+        self.assertTrue(content_type.startswith("multipart/byteranges; boundary="), \
+            "Wrong Content-Type: %s" % content_type)
+        boundary = content_type.split("boundary=")[1]
+
+        parts = body.split("--" + boundary)
+        self.assertEqual(parts[-1].strip(), "--", "The body does not end with the closing boundary")
+        parts = parts[1:-1]
+        self.assertEqual(len(parts), 2, "Expected two parts, got %d" % len(parts))
+        for part, (first, last) in zip(parts, [(0, 1), (5, 7)]):
+            head, data = part.split("\r\n\r\n", 1)
+            self.assertTrue("Content-Range: bytes %d-%d/%d" % (first, last, len(contents)) in head, \
+                "Wrong Content-Range in a part")
+            self.assertEqual(data[:-2], contents[first:last + 1], "Wrong bytes in a part")
+
+    def test_if_range_mismatch(self):
+        """  Test Name: test_if_range_mismatch\n\
+        Number Connections: One \n\
+        Procedure: GET with a Range and an If-Range naming another entity \n\
+                   tag, expecting the whole file with a 200
+        """
+        server_response, body = self.get_file("index.html", \
+            {"Range": "bytes=0-0", "If-Range": '"not-the-etag"'})
+
+        self.assertEqual(server_response.status, httplib.OK, "Server did not answer 200")
+        self.assertEqual(body, files_fixture["index.html"], "The whole file was not sent")
+
+    def test_if_range_match(self):
+        """  Test Name: test_if_range_match\n\
+        Number Connections: One \n\
+        Procedure: GET with a Range and an If-Range naming the file's own \n\
+                   entity tag, expecting the range with a 206
+        """
+        server_response, body = self.get_file("index.html", {})
+        etag = server_response.getheader("ETag")
+
+        server_response, body = self.get_file("index.html", {"Range": "bytes=0-0", "If-Range": etag})
+
+        self.assertEqual(server_response.status, httplib.PARTIAL_CONTENT, "Server did not answer 206")
+        self.assertEqual(body, files_fixture["index.html"][0], "Wrong byte sent")
+
+    def check_not_modified(self, headers, expected):
+        """
+        GET index.html with these conditional headers and check for a 304
+        if expected is httplib.NOT_MODIFIED, or the whole file with a 200.
+        """
+        server_response, body = self.get_file("index.html", headers)
+
+        self.assertEqual(server_response.status, expected, \
+            "Expected %d for %s, got %d" % (expected, headers, server_response.status))
+        if expected == httplib.NOT_MODIFIED:
+            self.assertEqual(body, "", "A 304 must not have a body")
+            self.assertTrue(server_response.getheader("ETag") is not None, "A 304 must carry the ETag")
+        else:
+            self.assertEqual(body, files_fixture["index.html"], "The whole file was not sent")
+
+    def validators(self):
+        """
+        The ETag and Last-Modified of index.html
+        """
+        server_response, body = self.get_file("index.html", {})
+        return server_response.getheader("ETag"), server_response.getheader("Last-Modified")
+
+    def test_if_none_match_exact(self):
+        """  Test Name: test_if_none_match_exact\n\
+        Number Connections: One \n\
+        Procedure: GET with If-None-Match naming the file's ETag, expecting 304
+        """
+        etag, last_modified = self.validators()
+        self.check_not_modified({"If-None-Match": etag}, httplib.NOT_MODIFIED)
+
+    def test_if_none_match_weak(self):
+        """  Test Name: test_if_none_match_weak\n\
+        Number Connections: One \n\
+        Procedure: GET with If-None-Match naming the file's ETag as weak, \n\
+                   W/"...", expecting 304: the comparison is weak
+        """
+        etag, last_modified = self.validators()
+        self.check_not_modified({"If-None-Match": "W/" + etag}, httplib.NOT_MODIFIED)
+
+    def test_if_none_match_list(self):
+        """  Test Name: test_if_none_match_list\n\
+        Number Connections: One \n\
+        Procedure: GET with If-None-Match listing another tag and then the \n\
+                   file's ETag, expecting 304
+        """
+        etag, last_modified = self.validators()
+        self.check_not_modified({"If-None-Match": '"not-the-etag", ' + etag}, httplib.NOT_MODIFIED)
+
+    def test_if_none_match_star(self):
+        """  Test Name: test_if_none_match_star\n\
+        Number Connections: One \n\
+        Procedure: GET with If-None-Match: *, expecting 304 for a file that \n\
+                   exists
+        """
+        self.check_not_modified({"If-None-Match": "*"}, httplib.NOT_MODIFIED)
+
+    def test_if_none_match_mismatch(self):
+        """  Test Name: test_if_none_match_mismatch\n\
+        Number Connections: One \n\
+        Procedure: GET with If-None-Match naming another tag, expecting the \n\
+                   file with a 200
+        """
+        self.check_not_modified({"If-None-Match": '"not-the-etag"'}, httplib.OK)
+
+    def test_if_modified_since_unchanged(self):
+        """  Test Name: test_if_modified_since_unchanged\n\
+        Number Connections: One \n\
+        Procedure: GET with If-Modified-Since set to the file's Last-Modified, \n\
+                   expecting 304
+        """
+        etag, last_modified = self.validators()
+        self.check_not_modified({"If-Modified-Since": last_modified}, httplib.NOT_MODIFIED)
+
+    def test_if_modified_since_changed(self):
+        """  Test Name: test_if_modified_since_changed\n\
+        Number Connections: One \n\
+        Procedure: GET with If-Modified-Since long before the file was \n\
+                   written, expecting the file with a 200
+        """
+        self.check_not_modified({"If-Modified-Since": "Sat, 01 Jan 2000 00:00:00 GMT"}, httplib.OK)
+
+    def test_if_none_match_over_if_modified_since(self):
+        """  Test Name: test_if_none_match_over_if_modified_since\n\
+        Number Connections: One \n\
+        Procedure: GET with an If-None-Match that does not match and an \n\
+                   If-Modified-Since that would, expecting a 200: \n\
+                   If-Modified-Since only counts without If-None-Match
+        """
+        etag, last_modified = self.validators()
+        self.check_not_modified({"If-None-Match": '"not-the-etag"', "If-Modified-Since": last_modified}, \
+            httplib.OK)
+
+    def test_cache_control_prefix(self):
+        """  Test Name: test_cache_control_prefix\n\
+        Number Connections: One \n\
+        Procedure: GET a file below js/, expecting the Cache-Control of the \n\
+                   -C js/=... policy, the longest prefix that matches
+        """
+        server_response, body = self.get_file("js/widget.js", {})
+
+        self.assertEqual(server_response.status, httplib.OK, "Server failed to respond")
+        self.assertEqual(server_response.getheader("Cache-Control"), "max-age=86400", \
+            "Wrong Cache-Control")
+
+    def test_cache_control_default(self):
+        """  Test Name: test_cache_control_default\n\
+        Number Connections: One \n\
+        Procedure: GET a file outside js/, expecting the Cache-Control of the \n\
+                   -C =... policy that covers every path
+        """
+        server_response, body = self.get_file("index.html", {})
+
+        self.assertEqual(server_response.status, httplib.OK, "Server failed to respond")
+        self.assertEqual(server_response.getheader("Cache-Control"), "no-cache", "Wrong Cache-Control")
+
+
+##############################################################################
+## Class: Single_Conn_Metrics_Case
+## Test cases for what the server reports beyond the single metrics:
+## several metrics at once, how long requests take, the history kept in
+## memory and in the -D store, and the server's own counters.
+##############################################################################
+
+class Single_Conn_Metrics_Case(Doc_Print_Test_Case):
+
+    """
+    Test case for a single connection, asking for the metrics that take
+    more than a path to answer.  The tests are aptly named for describing
+    their effects.
+    """
+
+    def __init__(self, testname, hostname, port):
+        """
+        Prepare the test case for creating connections.
+        """
+        super(Single_Conn_Metrics_Case, self).__init__(testname)
+
+        self.hostname = hostname
+        self.port = port
+
+    def setUp(self):
+        """  Test Name: None -- setUp function\n\
+        Number Connections: N/A \n\
+        Procedure: Opens the HTTP connection to the server.  An error here \
+                   means the script was unable to create a connection to the \
+                   server.
+        """
+        #Make HTTP connection for the server
+        self.http_connection = httplib.HTTPConnection(self.hostname, self.port)
+
+        #Connect to the server
+        self.http_connection.connect()
+
+    def tearDown(self):
+        """  Test Name: None -- tearDown function\n\
+        Number Connections: N/A \n\
+        Procedure: Closes the HTTP connection to the server.  An error here \
+                   means the server crashed after servicing the request from \
+                   the previous test.
+        """
+        #Close the HTTP connection
+        self.http_connection.close()
+        if server.poll() is not None:
+            #self.fail("The server has crashed.  Please investigate.")
+            print "The server has crashed.  Please investigate."
+
+    def get(self, path):
+        """
+        GET path; the response and its body.
+        """
+        self.http_connection.request("GET", path)
+        server_response = self.http_connection.getresponse()
+        return server_response, server_response.read()
+
+    def test_metrics_json_fields(self):
+        """  Test Name: test_metrics_json_fields\n\
+        Number Connections: One \n\
+        Procedure: GET /metrics.json with fields from two metrics and one \n\
+                   that leads nowhere, expecting an object with just those \n\
+                   fields and null for the missing one
+        """
+        server_response, body = self.get("/metrics.json?fields=loadavg.total_threads," + \
+            "meminfo.MemFree,meminfo.NoSuchField")
+
+        self.assertEqual(server_response.status, httplib.OK, "Server failed to respond")
+        self.assertEqual(server_response.getheader("Content-Type"), "application/json", \
+            "Wrong Content-Type")
+        fields = json.loads(body)
+        self.assertEqual(sorted(fields.keys()), ["loadavg", "meminfo"], "Wrong metrics")
+        self.assertEqual(fields["loadavg"].keys(), ["total_threads"], "Wrong loadavg fields")
+        self.assertEqual(sorted(fields["meminfo"].keys()), ["MemFree", "NoSuchField"], \
+            "Wrong meminfo fields")
+        self.assertTrue(int(fields["meminfo"]["MemFree"]) > 0, "Wrong MemFree")
+        self.assertEqual(fields["meminfo"]["NoSuchField"], None, "Missing field is not null")
+
+    def test_metrics_json_callback(self):
+        """  Test Name: test_metrics_json_callback\n\
+        Number Connections: One \n\
+        Procedure: GET /metrics.json with a callback, expecting the object \n\
+                   wrapped in a call to it
+        """
+        server_response, body = self.get("/metrics.json?fields=meminfo.MemFree&callback=callbackmethod")
+
+        self.assertEqual(server_response.status, httplib.OK, "Server failed to respond")
+        self.assertEqual(server_response.getheader("Content-Type"), "application/javascript", \
+            "Wrong Content-Type")
+        self.assertTrue(body.startswith("callbackmethod(") and body.endswith(")"), \
+            "callback incorrect, was: " + body)
+        self.assertEqual(json.loads(body[len("callbackmethod("):-1]).keys(), ["meminfo"], \
+            "Wrong metrics")
+
+    def test_metrics_json_bad_callback(self):
+        """  Test Name: test_metrics_json_bad_callback\n\
+        Number Connections: One \n\
+        Procedure: GET /metrics.json with a callback that is not a name, \n\
+                   expecting plain JSON that echoes none of it
+        """
+        server_response, body = self.get("/metrics.json?fields=meminfo.MemFree&callback=alert(1);x")
+
+        self.assertEqual(server_response.status, httplib.OK, "Server failed to respond")
+        self.assertEqual(server_response.getheader("Content-Type"), "application/json", \
+            "Wrong Content-Type")
+        self.assertTrue("alert" not in body, "Callback echoed: " + body)
+        self.assertEqual(json.loads(body).keys(), ["meminfo"], "Wrong metrics")
+
+    def test_metrics_json_bad_field(self):
+        """  Test Name: test_metrics_json_bad_field\n\
+        Number Connections: One \n\
+        Procedure: GET /metrics.json with a field name that would not be \n\
+                   safe to echo, expecting a 400
+        """
+        server_response, body = self.get("/metrics.json?fields=meminfo.%22MemFree")
+
+        self.assertEqual(server_response.status, httplib.BAD_REQUEST, "Server did not reject the field")
+
+    def test_metrics_json_unknown_metric(self):
+        """  Test Name: test_metrics_json_unknown_metric\n\
+        Number Connections: One \n\
+        Procedure: GET /metrics.json with a field of a metric the server \n\
+                   does not have, expecting a 404
+        """
+        server_response, body = self.get("/metrics.json?fields=meminfo.MemFree,nosuchmetric.x")
+
+        self.assertEqual(server_response.status, httplib.NOT_FOUND, "Server did not reject the metric")
+
+    def latency(self, query=""):
+        """
+        GET /latency with query; its routes, and the time its window starts.
+        """
+        server_response, body = self.get("/latency" + query)
+
+        self.assertEqual(server_response.status, httplib.OK, "Server failed to respond")
+        latency = json.loads(body)
+        return latency["routes"], latency["since"]
+
+    def test_latency_counts(self):
+        """  Test Name: test_latency_counts\n\
+        Number Connections: One \n\
+        Procedure: Read /latency, GET /loadavg three times and read it \n\
+                   again, expecting three more requests in every phase of \n\
+                   /loadavg with ordered percentiles
+        """
+        before, since = self.latency()
+        for i in range(0, 3):
+            self.get("/loadavg")
+        after, since = self.latency()
+
+        for phase in ["accept_to_dispatch", "dispatch_to_first_byte", "total"]:
+            stats = after["/loadavg"][phase]
+            self.assertEqual(stats["count"], before["/loadavg"][phase]["count"] + 3, \
+                "Wrong count for " + phase)
+            self.assertTrue(stats["min"] <= stats["p50"] <= stats["p90"] <= stats["p99"] <= \
+                stats["p99.9"] <= stats["max"], "Percentiles out of order for " + phase)
+            self.assertTrue("buckets" not in stats, "Buckets not asked for")
+
+    def test_latency_reset(self):
+        """  Test Name: test_latency_reset\n\
+        Number Connections: One \n\
+        Procedure: Read /latency?reset=1 twice, expecting no /loadavg \n\
+                   requests in the window the first one started, then GET \n\
+                   /loadavg and expect just that one in the next window, \n\
+                   while plain /latency still counts since the start
+        """
+        self.get("/loadavg")
+        self.latency("?reset=1")
+        routes, since = self.latency("?reset=1")
+        self.assertEqual(routes["/loadavg"]["total"]["count"], 0, "Count not reset")
+
+        self.get("/loadavg")
+        routes, window = self.latency("?reset=1")
+        self.assertEqual(routes["/loadavg"]["total"]["count"], 1, "Wrong count after reset")
+        self.assertTrue(window >= since, "Window starts before the reset")
+
+        routes, start = self.latency()
+        self.assertTrue(routes["/loadavg"]["total"]["count"] >= 2, "Reset the totals since the start")
+        self.assertTrue(start <= since, "Totals start after the reset")
+
+    def test_latency_buckets(self):
+        """  Test Name: test_latency_buckets\n\
+        Number Connections: One \n\
+        Procedure: GET /loadavg, then /latency?buckets=1, expecting \n\
+                   [lowest value, count] pairs in increasing order that add \n\
+                   up to the count, none of them empty or above the max
+        """
+        self.get("/loadavg")
+        routes, since = self.latency("?buckets=1")
+
+        for phase in ["accept_to_dispatch", "dispatch_to_first_byte", "total"]:
+            stats = routes["/loadavg"][phase]
+            buckets = stats["buckets"]
+            self.assertTrue(len(buckets) > 0, "No buckets for " + phase)
+            for bucket in buckets:
+                self.assertEqual(len(bucket), 2, "Bucket is not a pair")
+                self.assertTrue(bucket[1] > 0, "Empty bucket")
+            lowest = [bucket[0] for bucket in buckets]
+            self.assertEqual(lowest, sorted(set(lowest)), "Buckets out of order for " + phase)
+            self.assertTrue(lowest[0] <= stats["min"] and lowest[-1] <= stats["max"], \
+                "Buckets outside min and max for " + phase)
+            self.assertEqual(sum([bucket[1] for bucket in buckets]), stats["count"], \
+                "Buckets do not add up for " + phase)
+
+    def history(self, query):
+        """
+        GET /history with query; its columns with the delta encoding
+        undone, each array holding the values themselves.
+        """
+        server_response, body = self.get("/history" + query)
+
+        self.assertEqual(server_response.status, httplib.OK, "Server failed to respond")
+        def undelta(column):
+            if isinstance(column, dict):
+                return dict([(k, undelta(v)) for k, v in column.items()])
+            if not isinstance(column, list):
+                return column
+            values = []
+            for d in column:
+                values.append(d if len(values) == 0 else values[-1] + d)
+            return values
+        return undelta(json.loads(body))
+
+    def test_history_since(self):
+        """  Test Name: test_history_since\n\
+        Number Connections: One \n\
+        Procedure: GET /history?metric=loadavg&since=0 until it holds a \n\
+                   few samples, expecting increasing times and a column of \n\
+                   as many values per series, then since= the middle time, \n\
+                   expecting just the samples after it
+        """
+        for tries in range(0, 30):
+            samples = self.history("?metric=loadavg&since=0")
+            if len(samples["time"]) >= 3:
+                break
+            time.sleep(0.1)
+        times = samples["time"]
+        self.assertTrue(len(times) >= 3, "Too few samples kept")
+        self.assertEqual(sorted(samples.keys()), \
+            ["load1", "load15", "load5", "running_threads", "time", "total_threads"], "Wrong series")
+        for series in samples:
+            self.assertEqual(len(samples[series]), len(times), "Wrong length for " + series)
+        for i in range(1, len(times)):
+            self.assertTrue(times[i] > times[i - 1], "Times not increasing")
+
+        middle = times[len(times) / 2]
+        later = self.history("?metric=loadavg&since=%d" % middle)
+        self.assertTrue(len(later["time"]) > 0 and later["time"][0] > middle, "Samples before since")
+        self.assertEqual(later["time"][:len(times) - len(times) / 2 - 1], times[len(times) / 2 + 1:], \
+            "Samples after since missing")
+
+    def test_history_range(self):
+        """  Test Name: test_history_range\n\
+        Number Connections: One \n\
+        Procedure: GET /history?metric=meminfo with from= and to= over the \n\
+                   last minute, expecting 1 second slots within the range \n\
+                   in increasing order, each with min <= avg <= max
+        """
+        now = int(time.time() * 1000)
+        slots = self.history("?metric=meminfo&from=%d&to=%d" % (now - 60000, now + 1000))
+
+        self.assertEqual(slots["resolution"], 1, "Wrong resolution")
+        times = slots["time"]
+        self.assertTrue(len(times) > 0, "No slots in the range")
+        for i in range(0, len(times)):
+            self.assertTrue(now - 61000 <= times[i] <= now + 1000, "Slot outside the range")
+            self.assertEqual(times[i] % 1000, 0, "Slot not on a second")
+            self.assertTrue(i == 0 or times[i] > times[i - 1], "Times not increasing")
+        for series in ["MemTotal", "MemFree", "MemAvailable", "Buffers", "Cached"]:
+            for i in range(0, len(times)):
+                self.assertTrue(slots[series]["min"][i] <= slots[series]["avg"][i] <= \
+                    slots[series]["max"][i], "min, avg and max out of order for " + series)
+
+    def test_history_points(self):
+        """  Test Name: test_history_points\n\
+        Number Connections: One \n\
+        Procedure: GET /history?metric=loadavg over the last minute with \n\
+                   points=10, expecting the coarser 1 minute slots, then \n\
+                   since the epoch with points=1, expecting 1 hour slots and \n\
+                   no more than one of them
+        """
+        now = int(time.time() * 1000)
+        slots = self.history("?metric=loadavg&from=%d&to=%d&points=10" % (now - 60000, now))
+        self.assertEqual(slots["resolution"], 60, "Wrong resolution")
+        self.assertTrue(0 < len(slots["time"]) <= 10, "Too many slots")
+
+        slots = self.history("?metric=loadavg&from=0&to=%d&points=1" % now)
+        self.assertEqual(slots["resolution"], 3600, "Wrong resolution")
+        self.assertEqual(len(slots["time"]), 1, "Not just the newest slot")
+        self.assertEqual(len(slots["load1"]["avg"]), 1, "Not just the newest slot")
+
+    def server_metrics(self):
+        """
+        GET /server-metrics; its samples by name with their labels.
+        """
+        server_response, body = self.get("/server-metrics")
+
+        self.assertEqual(server_response.status, httplib.OK, "Server failed to respond")
+        self.assertTrue(server_response.getheader("Content-Type").startswith("text/plain; version=0.0.4"), \
+            "Wrong Content-Type")
+        samples = {}
+        for line in body.splitlines():
+            if line != "" and not line.startswith("#"):
+                name, value = line.rsplit(" ", 1)
+                samples[name] = float(value)
+        return samples
+
+    def test_server_metrics(self):
+        """  Test Name: test_server_metrics\n\
+        Number Connections: One \n\
+        Procedure: Scrape /server-metrics, GET /loadavg twice and a path no \n\
+                   route takes, and scrape it again, expecting the counts \n\
+                   by route and status to have grown by as much, and the \n\
+                   process_* lines from getrusage
+        """
+        loadavg = 'sysstatd_requests_total{route="/loadavg",code="200"}'
+        none = 'sysstatd_requests_total{route="none",code="404"}'
+
+        before = self.server_metrics()
+        self.get("/loadavg")
+        self.get("/loadavg")
+        server_response, body = self.get("/no/such/route")
+        self.assertEqual(server_response.status, httplib.NOT_FOUND, "Server found no route")
+
+        #The server closes the connection after an error, and counts a
+        #request just after queueing its response, so the scrape on a new
+        #connection may come first
+        self.http_connection.close()
+        self.http_connection.connect()
+        for tries in range(0, 20):
+            after = self.server_metrics()
+            if after.get(none, 0) > before.get(none, 0):
+                break
+            time.sleep(0.1)
+
+        self.assertEqual(after[loadavg], before.get(loadavg, 0) + 2, "Wrong count of /loadavg")
+        self.assertEqual(after[none], before.get(none, 0) + 1, "Wrong count of 404s")
+        self.assertTrue(after["sysstatd_sent_bytes_total"] > before["sysstatd_sent_bytes_total"], \
+            "Sent bytes not counted")
+        for name in ["process_cpu_user_seconds_total", "process_cpu_system_seconds_total", \
+                     "process_max_resident_memory_bytes", 'process_page_faults_total{kind="minor"}', \
+                     'process_context_switches_total{kind="voluntary"}']:
+            self.assertTrue(name in after, "Missing " + name)
+        self.assertTrue(after["process_max_resident_memory_bytes"] > 0, "No resident memory")
+
+
 ###############################################################################
 #Globally define the Server object so it can be checked by all test cases
 ###############################################################################
 server = None
 output_file = None
+files_root = None
+history_dir = None
 ###############################################################################
 #Define an atexit shutdown method that kills the server as needed
 ###############################################################################
@@ -976,6 +1745,21 @@ def clean_up_testing():
         os.kill(server.pid, signal.SIGTERM)
     except:
         pass
+    if files_root is not None:
+        shutil.rmtree(files_root, True)
+    if history_dir is not None:
+        shutil.rmtree(history_dir, True)
+
+def make_files_root():
+    """Write files_fixture into a new directory and return its path"""
+    root = tempfile.mkdtemp(prefix="sysstatd-files-")
+    for path, contents in sorted(files_fixture.items()):
+        if not os.path.isdir(os.path.dirname(os.path.join(root, path))):
+            os.makedirs(os.path.dirname(os.path.join(root, path)))
+        f = open(os.path.join(root, path), "w")
+        f.write(contents)
+        f.close()
+    return root
 
 #Grade distribution constants
 grade_points_available = 90
@@ -988,12 +1772,17 @@ malicious_total = 20
 # 4 tests
 ipv6_total = 8
     
-def print_points(minreq, extra, malicious, ipv6):
-    """All arguments are fractions (out of 1)"""
+def print_points(minreq, extra, malicious, ipv6, files=None, metrics=None):
+    """All arguments are fractions (out of 1); files and metrics, tests
+    passed of tests run, are left out until those tests have run"""
     print "Minimum Requirements:         \t%2d/%2d" % (int(minreq * minreq_total), minreq_total)
     print "IPv6 Functionality:           \t%2d/%2d" % (int(ipv6 * ipv6_total), ipv6_total)
     print "Extra Tests:                  \t%2d/%2d" % (int(extra * extra_total), extra_total)
     print "Robustness:                   \t%2d/%2d" % (int(malicious * malicious_total), malicious_total)
+    if files is not None:
+        print "Files Tests (ungraded):       \t%2d/%2d" % files
+    if metrics is not None:
+        print "Metrics Tests (ungraded):     \t%2d/%2d" % metrics
 
 ###############################################################################
 # Main
@@ -1030,7 +1819,7 @@ if __name__ == '__main__':
         else:
             assert False, "unhandled option"
 
-    alltests = [Single_Conn_Good_Case, Multi_Conn_Sequential_Case, Single_Conn_Bad_Case, Single_Conn_Malicious_Case, Single_Conn_Protocol_Case]
+    alltests = [Single_Conn_Good_Case, Multi_Conn_Sequential_Case, Single_Conn_Bad_Case, Single_Conn_Malicious_Case, Single_Conn_Protocol_Case, Single_Conn_Files_Case, Single_Conn_Metrics_Case]
 
     def findtest(tname):
         for clazz in alltests:
@@ -1069,11 +1858,21 @@ if __name__ == '__main__':
     #Determine the port number to use, based off of the current PID.
     port = (os.getpid() % 10000) + 20000
 
+    #Serve /files from a root holding files_fixture
+    files_root = make_files_root()
+    server_args = [server_path, "-p", str(port), "-R", files_root]
+    for policy in files_cache_control:
+        server_args += ["-C", policy]
+
+    #Keep history on disk too, in a directory of its own
+    history_dir = tempfile.mkdtemp(prefix="sysstatd-history-")
+    server_args += ["-D", history_dir]
+
     if output_file is not None:
         #Open the server on this machine, with port 10305.
-        server = subprocess.Popen([server_path,"-p", str(port)], stdout=output_file, stderr=subprocess.STDOUT)
+        server = subprocess.Popen(server_args, stdout=output_file, stderr=subprocess.STDOUT)
     else:
-        server = subprocess.Popen([server_path,"-p", str(port)])
+        server = subprocess.Popen(server_args)
 
     #Register the atexit function to shutdown the server on Python exit
     atexit.register(clean_up_testing)
@@ -1245,5 +2044,52 @@ process.
         else:
             print "\nYou have NOT passed one or more of the Malicious Tests.  " +\
                   "Please examine the errors listed above.\n"
-            
-        print_points(minreq_score, extra_score, robustness_score, ipv6_score)
+
+
+        #Files Test Suite, not part of the grade
+        files_tests_suite = unittest.TestSuite()
+
+        #Add all of the tests from the class Single_Conn_Files_Case
+        for test_function in dir(Single_Conn_Files_Case):
+            if test_function.startswith("test_"):
+                files_tests_suite.addTest(Single_Conn_Files_Case(test_function, hostname, port))
+
+        #In particular, add the pipelining check from Single_Conn_Protocol_Case
+        files_tests_suite.addTest(Single_Conn_Protocol_Case("test_pipelined_requests", hostname, port))
+
+        print 'Beginning the Files Tests'
+        #Run the files tests
+        test_results = unittest.TextTestRunner().run(files_tests_suite)
+
+        nt = files_tests_suite.countTestCases()
+        files_passed = nt - len(test_results.errors) - len(test_results.failures)
+
+        if test_results.wasSuccessful():
+            print "\nYou have passed the Files Tests!\n"
+        else:
+            print "\nYou have NOT passed one or more of the Files Tests.  " +\
+                  "Please examine the errors listed above.\n"
+
+        #Metrics Test Suite, not part of the grade either
+        metrics_tests_suite = unittest.TestSuite()
+
+        #Add all of the tests from the class Single_Conn_Metrics_Case
+        for test_function in dir(Single_Conn_Metrics_Case):
+            if test_function.startswith("test_"):
+                metrics_tests_suite.addTest(Single_Conn_Metrics_Case(test_function, hostname, port))
+
+        print 'Beginning the Metrics Tests'
+        #Run the metrics tests
+        test_results = unittest.TextTestRunner().run(metrics_tests_suite)
+
+        metrics_nt = metrics_tests_suite.countTestCases()
+        metrics_passed = metrics_nt - len(test_results.errors) - len(test_results.failures)
+
+        if test_results.wasSuccessful():
+            print "\nYou have passed the Metrics Tests!\n"
+        else:
+            print "\nYou have NOT passed one or more of the Metrics Tests.  " +\
+                  "Please examine the errors listed above.\n"
+
+        print_points(minreq_score, extra_score, robustness_score, ipv6_score, (files_passed, nt), \
+            (metrics_passed, metrics_nt))
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "list.h"
+#include "rio.h"
+#include "counters.h"
+
+/* One thread's counters; v starts on a cache line of its own */
+struct counter_shard {
+    struct list_elem elem;
+    uint64_t v[] __attribute__((aligned(64)));
+};
+
+struct counters {
+    int id;                     /* index into every thread's my_shards */
+    unsigned n;
+
+    pthread_mutex_t shards_lock; /* taken when a thread bumps for the first time, and per sum */
+    struct list shards;
+};
+
+static int nsets;
+
+// The calling thread's shard of each set, made the first time it bumps one
+static __thread struct counter_shard *my_shards[COUNTERS_MAX];
+
+static struct counter_shard *shard_of(struct counters *cs) {
+    struct counter_shard *s = my_shards[cs->id];
+    size_t size;
+
+    if (s != NULL) {
+        return s;
+    }
+    // Rounded up to whole lines, so the next allocation cannot share the last one
+    size = (sizeof(*s) + cs->n * sizeof(s->v[0]) + 63) & ~(size_t)63;
+    if (posix_memalign((void **)&s, 64, size) != 0) {
+        return NULL;
+    }
+    memset(s, 0, size);
+    pthread_mutex_lock(&cs->shards_lock);
+    list_push_back(&cs->shards, &s->elem);
+    pthread_mutex_unlock(&cs->shards_lock);
+    my_shards[cs->id] = s;
+    return s;
+}
+
+struct counters *counters_new(unsigned n) {
+    struct counters *cs;
+    int id = __atomic_fetch_add(&nsets, 1, __ATOMIC_RELAXED);
+
+    if (id >= COUNTERS_MAX) {
+        fprintf(stderr, "more than %d counter sets\n", COUNTERS_MAX);
+        exit(1);
+    }
+    if ((cs = calloc(1, sizeof(*cs))) == NULL) {
+        unix_error("counters_new calloc error");
+    }
+    cs->id = id;
+    cs->n = n;
+    pthread_mutex_init(&cs->shards_lock, NULL);
+    list_init(&cs->shards);
+    return cs;
+}
+
+void counters_add(struct counters *cs, unsigned i, uint64_t v) {
+    struct counter_shard *s = shard_of(cs);
+
+    // Only this thread writes the shard; the store is atomic just so a sum never sees it torn
+    if (s != NULL) {
+        __atomic_store_n(&s->v[i], s->v[i] + v, __ATOMIC_RELAXED);
+    }
+}
+
+void counters_sum(struct counters *cs, uint64_t *totals) {
+    struct list_elem *e;
+    unsigned i;
+
+    memset(totals, 0, cs->n * sizeof(*totals));
+    pthread_mutex_lock(&cs->shards_lock);
+    for (e = list_begin(&cs->shards); e != list_end(&cs->shards); e = list_next(e)) {
+        struct counter_shard *s = list_entry(e, struct counter_shard, elem);
+
+        for (i = 0; i < cs->n; i++) {
+            totals[i] += __atomic_load_n(&s->v[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&cs->shards_lock);
+}
@@ -0,0 +1,30 @@
+#ifndef __COUNTERS_H__
+#define __COUNTERS_H__
+
+#include <stdint.h>
+
+/*
+ * counters.h
+ *
+ * A set of counters bumped from many threads on the request path.  Each
+ * thread bumps a shard of its own, allocated on its first bump and padded
+ * to whole cache lines, so a bump is a plain add to memory no other core
+ * writes.  Nothing is shared until somebody asks for the totals, which sums
+ * every shard then; a shard outlives its thread, so nothing counted is lost.
+ */
+
+/* Counter sets in the whole server */
+#define COUNTERS_MAX 8
+
+struct counters;
+
+/* A set of n counters, all 0; there can be at most COUNTERS_MAX */
+struct counters *counters_new(unsigned n);
+
+/* Add v to counter i of cs, from the calling thread's shard */
+void counters_add(struct counters *cs, unsigned i, uint64_t v);
+
+/* Sum every shard of cs into totals, n values; safe to call from any thread */
+void counters_sum(struct counters *cs, uint64_t *totals);
+
+#endif /* __COUNTERS_H__ */
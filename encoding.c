@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "encoding.h"
+
+static const struct {
+    const char *token;
+    unsigned bit;
+} tokens[] = {
+    { "gzip", ENCODING_GZIP },
+    { "x-gzip", ENCODING_GZIP },
+    { "br", ENCODING_BR },
+};
+
+// "*" stands for every coding not named elsewhere in the value, whatever
+// the order (RFC 9110, 12.5.3): "br;q=0, *" still refuses br and
+// "gzip, *;q=0" still takes gzip
+unsigned encoding_accepted(const char *value) {
+    unsigned accepted = 0, named = 0;
+    bool star = false;
+
+    while (*value) {
+        const char *name, *end;
+        size_t len;
+        double q = 1;
+        int i;
+
+        value += strspn(value, " \t\r\n,");
+        name = value;
+        len = strcspn(value, " \t\r\n,;");
+        value += len;
+
+        // Only q matters among the parameters; "gzip;q=0" turns gzip off
+        end = value + strcspn(value, ",");
+        while (value < end) {
+            if (*value == ';') {
+                const char *p = value + 1 + strspn(value + 1, " \t");
+                if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+                    q = strtod(p + 2, NULL);
+                }
+            }
+            value++;
+        }
+
+        if (len == 1 && *name == '*') {
+            star = q > 0;
+        }
+        for (i = 0; i < sizeof(tokens) / sizeof(tokens[0]); i++) {
+            if (len == strlen(tokens[i].token) && strncasecmp(name, tokens[i].token, len) == 0) {
+                named |= tokens[i].bit;
+                if (q > 0) {
+                    accepted |= tokens[i].bit;
+                }
+            }
+        }
+    }
+    if (star) {
+        accepted |= (ENCODING_GZIP | ENCODING_BR) & ~named;
+    }
+    return accepted;
+}
+
+bool encoding_compressible(const char *mime) {
+    return strncmp(mime, "text/", 5) == 0 ||
+           strcmp(mime, "application/javascript") == 0 ||
+           strcmp(mime, "application/json") == 0 ||
+           strcmp(mime, "image/svg+xml") == 0;
+}
+
+const char *encoding_name(unsigned encoding) {
+    return encoding == ENCODING_BR ? "br" : "gzip";
+}
+
+const char *encoding_suffix(unsigned encoding) {
+    return encoding == ENCODING_BR ? ".br" : ".gz";
+}
+
+char *encoding_gzip(int fd, size_t len, size_t *out_len) {
+    char *in = malloc(len);
+    char *out = NULL;
+    size_t got = 0;
+    z_stream z;
+
+    if (in == NULL) {
+        return NULL;
+    }
+    while (got < len) {
+        ssize_t n = pread(fd, in + got, len - got, got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            goto out;
+        }
+        got += n;
+    }
+
+    // Each file is compressed once, so spend the time on the best ratio;
+    // windowBits 15 + 16 writes a gzip header and trailer
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        goto out;
+    }
+    z.next_in = (Bytef *)in;
+    z.avail_in = len;
+    z.avail_out = deflateBound(&z, len);
+    if ((out = malloc(z.avail_out)) != NULL) {
+        z.next_out = (Bytef *)out;
+        if (deflate(&z, Z_FINISH) != Z_STREAM_END || z.total_out >= len) {
+            free(out);
+            out = NULL;
+        } else {
+            *out_len = z.total_out;
+        }
+    }
+    deflateEnd(&z);
+out:
+    free(in);
+    return out;
+}
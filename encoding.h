@@ -0,0 +1,38 @@
+#ifndef __ENCODING_H__
+#define __ENCODING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * encoding.h
+ *
+ * Content codings for static files.  A text file can come with
+ * precompressed sidecars next to it ("app.js.gz", "app.js.br") that are
+ * sent to clients that accept them; files without a gzip sidecar are
+ * compressed once with zlib and the result kept in the response cache.
+ */
+
+#define ENCODING_GZIP 1
+#define ENCODING_BR 2
+
+/* Files smaller than this are sent as they are */
+#define ENCODING_MIN_SIZE 1024
+
+/* The ENCODING_* bits an Accept-Encoding value allows (q=0 excluded) */
+unsigned encoding_accepted(const char *value);
+
+/* Is a file of this Content-Type worth compressing? */
+bool encoding_compressible(const char *mime);
+
+/* Content-Encoding token and sidecar suffix of one ENCODING_* bit */
+const char *encoding_name(unsigned encoding);
+const char *encoding_suffix(unsigned encoding);
+
+/*
+ * gzip the first len bytes of fd.  Returns a malloc'd buffer and sets
+ * *out_len, or NULL if the file could not be read or did not shrink.
+ */
+char *encoding_gzip(int fd, size_t len, size_t *out_len);
+
+#endif /* __ENCODING_H__ */
@@ -0,0 +1,518 @@
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "rio.h"
+#include "timewheel.h"
+#include "encoding.h"
+#include "filecache.h"
+
+#define BUCKETS 256             /* hash chains per stripe */
+#define LARGE_FILE (256 * 1024) /* files at least this large get read-ahead hints */
+
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+                    IN_DELETE | IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct stripe {
+    pthread_mutex_t lock;
+    struct list buckets[BUCKETS];
+    struct list ring;           /* CLOCK order, the hand is the front */
+    unsigned long entries;
+};
+
+struct filecache {
+    int rootfd;
+    unsigned long capacity;
+    unsigned long stripe_capacity;
+    struct stripe stripes[FILECACHE_STRIPES];
+
+    // inotify watch descriptor -> directory key, "" for the root
+    int inotifyfd;              /* -1 in TTL mode */
+    pthread_mutex_t watch_lock;
+    char **watches;
+    int nwatches;
+    void (*on_invalidate)(void *arg, const char *key);
+    void *on_invalidate_arg;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+};
+
+static const struct {
+    const char *ext;
+    const char *mime;
+} mime_types[] = {
+    { ".html", "text/html" },
+    { ".htm", "text/html" },
+    { ".css", "text/css" },
+    { ".js", "application/javascript" },
+    { ".json", "application/json" },
+    { ".gif", "image/gif" },
+    { ".jpg", "image/jpeg" },
+    { ".jpeg", "image/jpeg" },
+    { ".png", "image/png" },
+    { ".svg", "image/svg+xml" },
+    { ".ico", "image/x-icon" },
+};
+
+const char *filecache_mime(const char *key) {
+    const char *dot = strrchr(key, '.');
+    int i;
+
+    if (dot != NULL) {
+        for (i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++) {
+            if (strcasecmp(dot, mime_types[i].ext) == 0) {
+                return mime_types[i].mime;
+            }
+        }
+    }
+    return "text/plain";
+}
+
+// FNV-1a
+static uint32_t hash_key(const char *key) {
+    uint32_t h = 2166136261u;
+
+    while (*key) {
+        h = (h ^ (unsigned char)*key++) * 16777619u;
+    }
+    return h;
+}
+
+static struct stripe *stripe_of(struct filecache *fc, uint32_t hash) {
+    return &fc->stripes[hash % FILECACHE_STRIPES];
+}
+
+static struct list *bucket_of(struct stripe *s, uint32_t hash) {
+    return &s->buckets[(hash / FILECACHE_STRIPES) % BUCKETS];
+}
+
+static struct file_entry *stripe_find(struct stripe *s, uint32_t hash, const char *key) {
+    struct list *b = bucket_of(s, hash);
+    struct list_elem *e;
+
+    for (e = list_begin(b); e != list_end(b); e = list_next(e)) {
+        struct file_entry *fe = list_entry(e, struct file_entry, elem);
+        if (fe->hash == hash && strcmp(fe->key, key) == 0) {
+            return fe;
+        }
+    }
+    return NULL;
+}
+
+// Take fe out of its stripe; the caller holds the lock and drops the table's reference
+static void stripe_remove(struct stripe *s, struct file_entry *fe) {
+    list_remove(&fe->elem);
+    list_remove(&fe->ring);
+    s->entries--;
+}
+
+void filecache_put(struct file_entry *e) {
+    if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(e->fd);
+        free(e);
+    }
+}
+
+void filecache_hold(struct file_entry *e) {
+    __atomic_fetch_add(&e->refs, 1, __ATOMIC_RELAXED);
+}
+
+int filecache_normalize(const char *path, char *key, size_t len) {
+    size_t n = 0;
+    bool dir = true;
+
+    while (*path && *path != '?') {
+        const char *seg;
+        size_t seglen;
+
+        while (*path == '/') {
+            path++;
+        }
+        seg = path;
+        while (*path && *path != '/' && *path != '?') {
+            path++;
+        }
+        seglen = path - seg;
+        dir = *path == '/' || seglen == 0;
+
+        if (seglen == 0 || (seglen == 1 && seg[0] == '.')) {
+            continue;
+        }
+        if (seglen == 2 && seg[0] == '.' && seg[1] == '.') {
+            return -1;
+        }
+        if (n + (n > 0) + seglen >= len) {
+            return -1;
+        }
+        if (n > 0) {
+            key[n++] = '/';
+        }
+        memcpy(key + n, seg, seglen);
+        n += seglen;
+    }
+    if (dir) {
+        const char *index = n > 0 ? "/home.html" : "home.html";
+        if (n + strlen(index) >= len) {
+            return -1;
+        }
+        strcpy(key + n, index);
+        n += strlen(index);
+    }
+    key[n] = '\0';
+    return 0;
+}
+
+// Strip a sidecar suffix: "app.js.gz" belongs to "app.js"
+static bool sidecar_of(const char *key, char *base, size_t len) {
+    size_t n = strlen(key);
+
+    if (n < 4 || n >= len ||
+        (strcmp(key + n - 3, encoding_suffix(ENCODING_GZIP)) != 0 &&
+         strcmp(key + n - 3, encoding_suffix(ENCODING_BR)) != 0)) {
+        return false;
+    }
+    memcpy(base, key, n - 3);
+    base[n - 3] = '\0';
+    return true;
+}
+
+// Watch the directory holding key so changes to the file invalidate it.
+// Adding a watch that exists is harmless, and this only runs on a miss.
+static void watch_dir(struct filecache *fc, const char *key) {
+    const char *slash = strrchr(key, '/');
+    size_t dirlen = slash ? slash - key : 0;
+    char dir[PATH_MAX];
+    int wd;
+
+    if (fc->inotifyfd < 0 || dirlen + 1 >= sizeof(dir)) {
+        return;
+    }
+    memcpy(dir, key, dirlen);
+    dir[dirlen] = '\0';
+
+    // inotify takes a path; resolve it against the root by way of /proc
+    char path[PATH_MAX + 64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d/%s", fc->rootfd, dir);
+    if ((wd = inotify_add_watch(fc->inotifyfd, path, WATCH_MASK)) < 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&fc->watch_lock);
+    if (wd >= fc->nwatches) {
+        int n = wd * 2 + 16;
+        char **w = realloc(fc->watches, n * sizeof(*w));
+        if (w != NULL) {
+            memset(w + fc->nwatches, 0, (n - fc->nwatches) * sizeof(*w));
+            fc->watches = w;
+            fc->nwatches = n;
+        }
+    }
+    if (wd < fc->nwatches && fc->watches[wd] == NULL) {
+        fc->watches[wd] = strdup(dir);
+    }
+    pthread_mutex_unlock(&fc->watch_lock);
+}
+
+static void invalidate_key(struct filecache *fc, const char *key) {
+    uint32_t hash = hash_key(key);
+    struct stripe *s = stripe_of(fc, hash);
+    struct file_entry *fe;
+
+    pthread_mutex_lock(&s->lock);
+    fe = stripe_find(s, hash, key);
+    if (fe != NULL) {
+        stripe_remove(s, fe);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (fe != NULL) {
+        __atomic_fetch_add(&fc->invalidations, 1, __ATOMIC_RELAXED);
+        filecache_put(fe);
+    }
+}
+
+static void invalidate_all(struct filecache *fc) {
+    int i;
+
+    for (i = 0; i < FILECACHE_STRIPES; i++) {
+        struct stripe *s = &fc->stripes[i];
+
+        pthread_mutex_lock(&s->lock);
+        while (!list_empty(&s->ring)) {
+            struct file_entry *fe = list_entry(list_front(&s->ring), struct file_entry, ring);
+            stripe_remove(s, fe);
+            __atomic_fetch_add(&fc->invalidations, 1, __ATOMIC_RELAXED);
+            filecache_put(fe);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+// Drain inotify; a change to a file drops its entry, anything that can
+// move many files at once (a directory going away, a lost event) drops all
+static void *inotify_thread(void *data) {
+    struct filecache *fc = data;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        ssize_t n = read(fc->inotifyfd, buf, sizeof(buf));
+        char *p;
+
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "inotify read failed, file cache entries may go stale\n");
+            return NULL;
+        }
+        for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            char key[PATH_MAX];
+
+            if (ev->mask & IN_IGNORED) {
+                // The directory is gone, and with it the watch
+                pthread_mutex_lock(&fc->watch_lock);
+                if (ev->wd < fc->nwatches) {
+                    free(fc->watches[ev->wd]);
+                    fc->watches[ev->wd] = NULL;
+                }
+                pthread_mutex_unlock(&fc->watch_lock);
+            }
+            if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED) ||
+                (ev->mask & IN_ISDIR && ev->mask & (IN_MOVED_FROM | IN_DELETE))) {
+                invalidate_all(fc);
+                if (fc->on_invalidate) {
+                    fc->on_invalidate(fc->on_invalidate_arg, NULL);
+                }
+                continue;
+            }
+            if (ev->len == 0) {
+                continue;
+            }
+
+            pthread_mutex_lock(&fc->watch_lock);
+            const char *dir = ev->wd < fc->nwatches ? fc->watches[ev->wd] : NULL;
+            if (dir != NULL) {
+                snprintf(key, sizeof(key), "%s%s%s", dir, *dir ? "/" : "", ev->name);
+            }
+            pthread_mutex_unlock(&fc->watch_lock);
+
+            if (dir != NULL) {
+                char base[PATH_MAX];
+
+                invalidate_key(fc, key);
+                if (fc->on_invalidate) {
+                    fc->on_invalidate(fc->on_invalidate_arg, key);
+                }
+                // A sidecar came or went: the file's entry lists the wrong ones
+                if (sidecar_of(key, base, sizeof(base))) {
+                    invalidate_key(fc, base);
+                    if (fc->on_invalidate) {
+                        fc->on_invalidate(fc->on_invalidate_arg, base);
+                    }
+                }
+            }
+        }
+    }
+}
+
+struct filecache *filecache_new(const char *root, unsigned long capacity) {
+    struct filecache *fc = calloc(1, sizeof(*fc));
+    pthread_t tid;
+    int i, j;
+
+    if (fc == NULL) {
+        unix_error("filecache_new calloc error");
+    }
+    if ((fc->rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "cannot open document root %s: %s\n", root, strerror(errno));
+    }
+    fc->capacity = capacity;
+    fc->stripe_capacity = (capacity + FILECACHE_STRIPES - 1) / FILECACHE_STRIPES;
+    for (i = 0; i < FILECACHE_STRIPES; i++) {
+        pthread_mutex_init(&fc->stripes[i].lock, NULL);
+        for (j = 0; j < BUCKETS; j++) {
+            list_init(&fc->stripes[i].buckets[j]);
+        }
+        list_init(&fc->stripes[i].ring);
+    }
+    pthread_mutex_init(&fc->watch_lock, NULL);
+
+    fc->inotifyfd = -1;
+    if (capacity > 0) {
+        if ((fc->inotifyfd = inotify_init1(IN_CLOEXEC)) < 0) {
+            fprintf(stderr, "inotify unavailable (%s), cached files expire after %llums\n",
+                    strerror(errno), FILECACHE_TTL_NS / 1000000ULL);
+        } else if (pthread_create(&tid, NULL, inotify_thread, fc) != 0) {
+            unix_error("pthread_create error");
+        }
+    }
+    return fc;
+}
+
+// Which precompressed copies of key are there?  One older than the file
+// itself was left behind by an edit and does not count.
+static unsigned find_sidecars(struct filecache *fc, const char *key, const char *mime, struct stat *sb) {
+    static const unsigned encodings[] = { ENCODING_GZIP, ENCODING_BR };
+    char path[PATH_MAX];
+    unsigned found = 0;
+    int i;
+
+    if (!S_ISREG(sb->st_mode) || !encoding_compressible(mime) || sidecar_of(key, path, sizeof(path))) {
+        return 0;
+    }
+    for (i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++) {
+        struct stat side;
+
+        snprintf(path, sizeof(path), "%s%s", key, encoding_suffix(encodings[i]));
+        if (fstatat(fc->rootfd, path, &side, 0) == 0 && S_ISREG(side.st_mode) &&
+            (side.st_mtim.tv_sec > sb->st_mtim.tv_sec ||
+             (side.st_mtim.tv_sec == sb->st_mtim.tv_sec && side.st_mtim.tv_nsec >= sb->st_mtim.tv_nsec))) {
+            found |= encodings[i];
+        }
+    }
+    return found;
+}
+
+// Open key below the root; the result is not in the table yet
+static struct file_entry *entry_open(struct filecache *fc, const char *key, uint32_t hash) {
+    size_t keylen = strlen(key);
+    struct file_entry *fe = malloc(sizeof(*fe) + keylen + 1);
+    struct stat sb;
+
+    if (fe == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if ((fe->fd = openat(fc->rootfd, key, O_RDONLY | O_CLOEXEC)) < 0) {
+        free(fe);
+        return NULL;
+    }
+    if (fstat(fe->fd, &sb) < 0) {
+        close(fe->fd);
+        free(fe);
+        return NULL;
+    }
+    if (S_ISREG(sb.st_mode) && sb.st_size >= LARGE_FILE) {
+        // It will be read front to back: start the read-ahead now
+        posix_fadvise(fe->fd, 0, sb.st_size, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(fe->fd, 0, sb.st_size, POSIX_FADV_WILLNEED);
+    }
+    fe->size = sb.st_size;
+    fe->ino = sb.st_ino;
+    fe->mode = sb.st_mode;
+    fe->mtime = sb.st_mtim;
+    fe->mime = filecache_mime(key);
+    fe->sidecars = find_sidecars(fc, key, fe->mime, &sb);
+    fe->gzip_failed = false;
+    fe->refs = 1;
+    fe->referenced = false;
+    fe->expires = fc->inotifyfd < 0 ? now_ns() + FILECACHE_TTL_NS : 0;
+    fe->hash = hash;
+    memcpy(fe->key, key, keylen + 1);
+    return fe;
+}
+
+// CLOCK: go round the ring, giving referenced entries a second chance
+static void stripe_evict(struct filecache *fc, struct stripe *s) {
+    while (s->entries > fc->stripe_capacity) {
+        struct file_entry *fe = list_entry(list_front(&s->ring), struct file_entry, ring);
+
+        if (fe->referenced) {
+            fe->referenced = false;
+            list_remove(&fe->ring);
+            list_push_back(&s->ring, &fe->ring);
+            continue;
+        }
+        stripe_remove(s, fe);
+        __atomic_fetch_add(&fc->evictions, 1, __ATOMIC_RELAXED);
+        filecache_put(fe);
+    }
+}
+
+struct file_entry *filecache_get(struct filecache *fc, const char *key) {
+    uint32_t hash = hash_key(key);
+    struct stripe *s = stripe_of(fc, hash);
+    struct file_entry *fe, *old;
+
+    if (fc->capacity > 0) {
+        pthread_mutex_lock(&s->lock);
+        fe = stripe_find(s, hash, key);
+        if (fe != NULL && fe->expires != 0 && now_ns() >= fe->expires) {
+            stripe_remove(s, fe);
+            __atomic_fetch_add(&fc->invalidations, 1, __ATOMIC_RELAXED);
+            filecache_put(fe);
+            fe = NULL;
+        }
+        if (fe != NULL) {
+            fe->referenced = true;
+            __atomic_fetch_add(&fe->refs, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&s->lock);
+            __atomic_fetch_add(&fc->hits, 1, __ATOMIC_RELAXED);
+            return fe;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    __atomic_fetch_add(&fc->misses, 1, __ATOMIC_RELAXED);
+    // Watch first, so a change between the open and the insert is not missed
+    if (fc->capacity > 0) {
+        watch_dir(fc, key);
+    }
+    if ((fe = entry_open(fc, key, hash)) == NULL) {
+        return NULL;
+    }
+    // Only regular files are worth keeping open
+    if (fc->capacity == 0 || !S_ISREG(fe->mode)) {
+        return fe;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    if ((old = stripe_find(s, hash, key)) != NULL) {
+        // Another thread got here first; keep the newer one
+        stripe_remove(s, old);
+        filecache_put(old);
+    }
+    fe->refs++;                 /* the table's reference */
+    list_push_back(bucket_of(s, hash), &fe->elem);
+    list_push_back(&s->ring, &fe->ring);
+    s->entries++;
+    stripe_evict(fc, s);
+    pthread_mutex_unlock(&s->lock);
+    return fe;
+}
+
+void filecache_on_invalidate(struct filecache *fc, void (*cb)(void *arg, const char *key), void *arg) {
+    fc->on_invalidate_arg = arg;
+    fc->on_invalidate = cb;
+}
+
+bool filecache_watching(struct filecache *fc) {
+    return fc->inotifyfd >= 0;
+}
+
+void filecache_get_stats(struct filecache *fc, struct filecache_stats *st) {
+    int i;
+
+    st->capacity = fc->capacity;
+    st->entries = 0;
+    for (i = 0; i < FILECACHE_STRIPES; i++) {
+        st->entries += __atomic_load_n(&fc->stripes[i].entries, __ATOMIC_RELAXED);
+    }
+    st->inotify = fc->inotifyfd >= 0;
+    st->hits = __atomic_load_n(&fc->hits, __ATOMIC_RELAXED);
+    st->misses = __atomic_load_n(&fc->misses, __ATOMIC_RELAXED);
+    st->evictions = __atomic_load_n(&fc->evictions, __ATOMIC_RELAXED);
+    st->invalidations = __atomic_load_n(&fc->invalidations, __ATOMIC_RELAXED);
+}
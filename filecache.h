@@ -0,0 +1,96 @@
+#ifndef __FILECACHE_H__
+#define __FILECACHE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "list.h"
+
+/*
+ * filecache.h
+ *
+ * Open descriptors and metadata of the files under the document root, so
+ * a hot file is served without a path lookup, open or stat.  Entries are
+ * keyed by the normalized path relative to the root and spread over lock
+ * stripes, each with its own CLOCK ring for eviction.  inotify on the
+ * directories that hold cached files drops entries as soon as the file
+ * changes; without inotify, entries expire after FILECACHE_TTL_NS.  An
+ * entry also records which precompressed sidecars its file has, and a
+ * change to a sidecar drops the entry of the file it belongs to.
+ */
+
+#define FILECACHE_STRIPES 16
+#define FILECACHE_TTL_NS 1000000000ULL  /* revalidate after 1s without inotify */
+
+struct filecache;
+
+/* A looked up file; hold it until done with fd, then filecache_put() it */
+struct file_entry {
+    int fd;
+    off_t size;
+    ino_t ino;
+    mode_t mode;
+    struct timespec mtime;
+    const char *mime;           /* Content-Type */
+    unsigned sidecars;          /* ENCODING_* bits with an up to date "<key>.gz"/"<key>.br" */
+    bool gzip_failed;           /* gzip did not make this version smaller; set atomically */
+
+    // Owned by the cache
+    unsigned long refs;         /* the table's reference plus one per user */
+    bool referenced;            /* CLOCK bit, set on every hit */
+    uint64_t expires;           /* TTL mode only */
+    uint32_t hash;
+    struct list_elem elem;      /* hash chain */
+    struct list_elem ring;      /* CLOCK ring */
+    char key[];                 /* normalized path relative to the root */
+};
+
+struct filecache_stats {
+    unsigned long capacity;     /* most files kept open, 0 if caching is off */
+    unsigned long entries;
+    bool inotify;               /* false if falling back to the TTL */
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;    /* pushed out by the capacity bound */
+    unsigned long invalidations; /* dropped because the file changed or expired */
+};
+
+/* Cache up to capacity open files under root; 0 still looks files up, uncached */
+struct filecache *filecache_new(const char *root, unsigned long capacity);
+
+/*
+ * Turn the part of a URI below the root ("/js/app.js?v=2") into a key
+ * ("js/app.js"): empty and "." segments go away, the query is dropped and
+ * a directory gets home.html.  Returns -1 for a ".." segment or a key
+ * longer than len.
+ */
+int filecache_normalize(const char *path, char *key, size_t len);
+
+/* Content-Type for a key, from its extension */
+const char *filecache_mime(const char *key);
+
+/* Look up a normalized key; NULL with errno set if it cannot be opened */
+struct file_entry *filecache_get(struct filecache *fc, const char *key);
+
+/* Drop a reference from filecache_get */
+void filecache_put(struct file_entry *e);
+
+/* Take another reference, e.g. for each range of e queued separately */
+void filecache_hold(struct file_entry *e);
+
+/*
+ * Also tell cb about every file inotify reports changed (key NULL: all of
+ * them), whether or not it is cached here, and about the file a changed
+ * sidecar belongs to; called on the inotify thread.
+ * Call before the server starts.
+ */
+void filecache_on_invalidate(struct filecache *fc, void (*cb)(void *arg, const char *key), void *arg);
+
+/* Are changes pushed by inotify?  If not, anything derived has to expire */
+bool filecache_watching(struct filecache *fc);
+
+void filecache_get_stats(struct filecache *fc, struct filecache_stats *st);
+
+#endif /* __FILECACHE_H__ */
@@ -0,0 +1,145 @@
+/*
+ * fj_bench.c
+ *
+ * Fork-join scaling of the thread pool: time the same two computations
+ * with 1, 2, ... N threads and print the speedup over one thread.
+ *
+ *  fib       naive recursive Fibonacci forking both calls down to a small
+ *            cutoff, so nearly all the time goes to many tiny tasks:
+ *            how cheap push, pop and steal are
+ *  sum       a divide and conquer sum of an array, fewer and bigger tasks
+ *            with memory traffic: how well the work spreads
+ *
+ * make fj_bench && ./fj_bench [max threads, default the cores online]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+#define FIB_N 36
+#define FIB_CUTOFF 15           /* fib below this is computed in place */
+#define SUM_LEN (32 * 1024 * 1024)
+#define SUM_CUTOFF (16 * 1024)  /* elements summed in place */
+#define RUNS 3                  /* the best of them counts */
+
+static long fib_seq(int n) {
+    return n < 2 ? n : fib_seq(n - 1) + fib_seq(n - 2);
+}
+
+static void *fib_task(struct thread_pool *pool, void *data) {
+    intptr_t n = (intptr_t)data;
+    struct future *f;
+    long left, right;
+
+    if (n < FIB_CUTOFF) {
+        return (void *)(intptr_t)fib_seq(n);
+    }
+    f = thread_pool_submit(pool, fib_task, (void *)(n - 1));
+    right = (intptr_t)fib_task(pool, (void *)(n - 2));
+    left = (intptr_t)future_get(f);
+    future_free(f);
+    return (void *)(intptr_t)(left + right);
+}
+
+struct range {
+    const int32_t *v;
+    size_t len;
+    int64_t sum;
+};
+
+static void *sum_task(struct thread_pool *pool, void *data) {
+    struct range *r = data;
+    struct range left = { r->v, r->len / 2 }, right = { r->v + r->len / 2, r->len - r->len / 2 };
+    struct future *f;
+    size_t i;
+
+    if (r->len <= SUM_CUTOFF) {
+        r->sum = 0;
+        for (i = 0; i < r->len; i++) {
+            r->sum += r->v[i];
+        }
+        return NULL;
+    }
+    f = thread_pool_submit(pool, sum_task, &left);
+    sum_task(pool, &right);
+    future_get(f);
+    future_free(f);
+    r->sum = left.sum + right.sum;
+    return NULL;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Best time of RUNS runs of task(data) on pool, the result in *result
+static double run(struct thread_pool *pool, fork_join_task_t task, void *data, void **result) {
+    double best = 0;
+    int i;
+
+    for (i = 0; i < RUNS; i++) {
+        double start = now_s(), t;
+        struct future *f = thread_pool_submit(pool, task, data);
+
+        *result = future_get(f);
+        future_free(f);
+        t = now_s() - start;
+        if (i == 0 || t < best) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    int max = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    double fib_base = 0, sum_base = 0;
+    int32_t *v = malloc(SUM_LEN * sizeof(*v));
+    int64_t expected = 0;
+    size_t i;
+    int n;
+
+    if (v == NULL || max < 1) {
+        fprintf(stderr, "usage: %s [max threads]\n", argv[0]);
+        return 1;
+    }
+    for (i = 0; i < SUM_LEN; i++) {
+        v[i] = i % 1000;
+        expected += v[i];
+    }
+
+    printf("threads  fib(%d) s  speedup   sum(%dM) s  speedup\n", FIB_N, SUM_LEN >> 20);
+    for (n = 1; n <= max; n++) {
+        struct thread_pool *pool = thread_pool_new(n);
+        struct range all = { v, SUM_LEN };
+        double fib_t, sum_t;
+        void *result;
+
+        fib_t = run(pool, fib_task, (void *)(intptr_t)FIB_N, &result);
+        if ((intptr_t)result != fib_seq(FIB_N)) {
+            fprintf(stderr, "fib(%d) came out %ld\n", FIB_N, (long)(intptr_t)result);
+            return 1;
+        }
+        sum_t = run(pool, sum_task, &all, &result);
+        if (all.sum != expected) {
+            fprintf(stderr, "the sum came out %lld\n", (long long)all.sum);
+            return 1;
+        }
+        thread_pool_shutdown_and_destroy(pool);
+
+        if (n == 1) {
+            fib_base = fib_t;
+            sum_base = sum_t;
+        }
+        printf("%7d  %9.3f  %6.2fx   %10.3f  %6.2fx\n", n, fib_t, fib_base / fib_t, sum_t, sum_base / sum_t);
+    }
+    free(v);
+    return 0;
+}
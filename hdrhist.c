@@ -0,0 +1,91 @@
+#include "hdrhist.h"
+
+// Bucket (shift << HDR_SUB_BITS) + m holds the values whose top
+// HDR_SUB_BITS + 1 bits are m once shifted right by shift; the first
+// 2^HDR_SUB_BITS buckets are values themselves
+unsigned hdr_index(uint64_t v) {
+    unsigned shift;
+
+    if (v >> HDR_MAX_BITS) {
+        return HDR_BUCKETS - 1;
+    }
+    if (v < (1u << HDR_SUB_BITS)) {
+        return v;
+    }
+    shift = 63 - __builtin_clzll(v) - HDR_SUB_BITS;
+    return (shift << HDR_SUB_BITS) + (v >> shift);
+}
+
+uint64_t hdr_lowest(unsigned i) {
+    unsigned shift;
+
+    if (i < (1u << HDR_SUB_BITS)) {
+        return i;
+    }
+    shift = (i >> HDR_SUB_BITS) - 1;
+    return (uint64_t)(i - (shift << HDR_SUB_BITS)) << shift;
+}
+
+uint64_t hdr_highest(unsigned i) {
+    if (i < (1u << HDR_SUB_BITS)) {
+        return i;
+    }
+    return hdr_lowest(i) + (1ULL << ((i >> HDR_SUB_BITS) - 1)) - 1;
+}
+
+uint64_t hdr_quantile(const uint64_t *counts, double q) {
+    uint64_t total = 0, rank, seen = 0;
+    unsigned i;
+
+    for (i = 0; i < HDR_BUCKETS; i++) {
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    rank = q * total;
+    if (rank < q * total || rank == 0) {
+        rank++;
+    }
+    for (i = 0; i < HDR_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+    return hdr_highest(i < HDR_BUCKETS ? i : HDR_BUCKETS - 1);
+}
+
+void hdr_print_json(FILE *out, const uint64_t *counts, bool buckets) {
+    uint64_t total = 0;
+    unsigned i, min = HDR_BUCKETS, max = 0;
+    bool first = true;
+
+    for (i = 0; i < HDR_BUCKETS; i++) {
+        if (counts[i] != 0) {
+            total += counts[i];
+            if (min == HDR_BUCKETS) {
+                min = i;
+            }
+            max = i;
+        }
+    }
+    fprintf(out, "{\"count\": %llu, \"min\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p99.9\": %llu, "
+                 "\"max\": %llu",
+            (unsigned long long)total, (unsigned long long)(total ? hdr_lowest(min) : 0),
+            (unsigned long long)hdr_quantile(counts, 0.5), (unsigned long long)hdr_quantile(counts, 0.9),
+            (unsigned long long)hdr_quantile(counts, 0.99), (unsigned long long)hdr_quantile(counts, 0.999),
+            (unsigned long long)(total ? hdr_highest(max) : 0));
+    if (buckets) {
+        fprintf(out, ", \"buckets\": [");
+        for (i = 0; i < HDR_BUCKETS; i++) {
+            if (counts[i] != 0) {
+                fprintf(out, "%s[%llu, %llu]", first ? "" : ", ", (unsigned long long)hdr_lowest(i),
+                        (unsigned long long)counts[i]);
+                first = false;
+            }
+        }
+        fprintf(out, "]");
+    }
+    fprintf(out, "}");
+}
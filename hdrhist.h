@@ -0,0 +1,42 @@
+#ifndef __HDRHIST_H__
+#define __HDRHIST_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * hdrhist.h
+ *
+ * Log-bucketed histograms in the manner of HdrHistogram.  Values below
+ * 2^HDR_SUB_BITS have a bucket each; above that every power of two is
+ * split into 2^HDR_SUB_BITS buckets, so a value is known to within 1/64
+ * of itself, about 1.6%, however large it is.  Values of HDR_MAX_BITS bits
+ * and more share the last bucket.
+ *
+ * A histogram is just HDR_BUCKETS counts, so histograms with the same
+ * layout merge by adding their counts, whichever process kept them.
+ */
+
+#define HDR_SUB_BITS 6
+#define HDR_MAX_BITS 32
+#define HDR_BUCKETS ((HDR_MAX_BITS - HDR_SUB_BITS + 1) << HDR_SUB_BITS)
+
+/* The bucket v falls in */
+unsigned hdr_index(uint64_t v);
+
+/* The smallest and largest values bucket i holds */
+uint64_t hdr_lowest(unsigned i);
+uint64_t hdr_highest(unsigned i);
+
+/* The largest value of the bucket holding the qth quantile, 0 <= q <= 1; 0 if counts is empty */
+uint64_t hdr_quantile(const uint64_t *counts, double q);
+
+/*
+ * Print counts as a JSON object: the count, min, p50, p90, p99, p99.9 and
+ * max, and, if buckets is set, the buckets that are not empty as
+ * [lowest value, count] pairs.
+ */
+void hdr_print_json(FILE *out, const uint64_t *counts, bool buckets);
+
+#endif /* __HDRHIST_H__ */
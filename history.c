@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "rio.h"
+#include "history.h"
+
+struct history {
+    unsigned capacity;
+    int nseries;
+    const char *const *names;
+
+    // Sample i is in slot i % capacity of every column
+    uint64_t *times;
+    int64_t *columns;           /* nseries columns of capacity values */
+
+    uint64_t claimed;           /* samples the writer has started on */
+    uint64_t count;             /* samples written in full */
+};
+
+struct history *history_new(const char *const *names, int nseries, unsigned capacity) {
+    struct history *h = malloc(sizeof(*h));
+
+    if (h == NULL) {
+        unix_error("history_new malloc error");
+    }
+    h->capacity = capacity;
+    h->nseries = nseries;
+    h->names = names;
+    h->times = calloc(capacity, sizeof(*h->times));
+    h->columns = calloc((size_t)capacity * nseries, sizeof(*h->columns));
+    if (h->times == NULL || h->columns == NULL) {
+        unix_error("history_new calloc error");
+    }
+    h->claimed = 0;
+    h->count = 0;
+    return h;
+}
+
+void history_append(struct history *h, uint64_t time_ms, const int64_t *values) {
+    size_t slot = h->count % h->capacity;
+    int s;
+
+    // Readers that see the claim know the oldest sample is going
+    __atomic_store_n(&h->claimed, h->count + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&h->times[slot], time_ms, __ATOMIC_RELAXED);
+    for (s = 0; s < h->nseries; s++) {
+        __atomic_store_n(&h->columns[(size_t)s * h->capacity + slot], values[s], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELEASE);
+}
+
+size_t history_footprint(const struct history *h) {
+    return sizeof(*h) + (size_t)h->capacity * (h->nseries + 1) * sizeof(int64_t);
+}
+
+size_t history_column(char *out, const char *name, const int64_t *v, size_t n) {
+    size_t len = sprintf(out, "\"%s\": [", name);
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        len += sprintf(out + len, "%s%lld", i ? ", " : "", (long long)(i ? v[i] - v[i - 1] : v[i]));
+    }
+    out[len++] = ']';
+    return len;
+}
+
+char *history_json(struct history *h, uint64_t since_ms, size_t *len) {
+    uint64_t end = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+    uint64_t first = end > h->capacity ? end - h->capacity : 0;
+    uint64_t i, claimed, valid;
+    size_t n = end - first, skip, size, off;
+    int64_t *copy;
+    char *json;
+    int s;
+
+    // Copy the columns out, times first
+    if ((copy = malloc(n * (h->nseries + 1) * sizeof(*copy) + 1)) == NULL) {
+        return NULL;
+    }
+    for (i = first; i < end; i++) {
+        copy[i - first] = __atomic_load_n(&h->times[i % h->capacity], __ATOMIC_RELAXED);
+    }
+    for (s = 0; s < h->nseries; s++) {
+        for (i = first; i < end; i++) {
+            copy[(s + 1) * n + i - first] = __atomic_load_n(&h->columns[(size_t)s * h->capacity + i % h->capacity],
+                                                            __ATOMIC_RELAXED);
+        }
+    }
+
+    // Samples the writer has claimed the slots of since may be torn
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    claimed = __atomic_load_n(&h->claimed, __ATOMIC_RELAXED);
+    valid = claimed > h->capacity ? claimed - h->capacity : 0;
+    skip = valid > first ? valid - first : 0;
+    if (skip > n) {
+        skip = n;
+    }
+    while (skip < n && (uint64_t)copy[skip] <= since_ms) {
+        skip++;
+    }
+
+    // Every value is at most 20 digits and a sign, plus ", "
+    size = (h->nseries + 1) * ((n - skip) * 23 + 32) + 64;
+    for (s = 0; s < h->nseries; s++) {
+        size += strlen(h->names[s]);
+    }
+    if ((json = malloc(size)) == NULL) {
+        free(copy);
+        return NULL;
+    }
+    off = sprintf(json, "{");
+    off += history_column(json + off, "time", copy + skip, n - skip);
+    for (s = 0; s < h->nseries; s++) {
+        off += sprintf(json + off, ", ");
+        off += history_column(json + off, h->names[s], copy + (s + 1) * n + skip, n - skip);
+    }
+    json[off++] = '}';
+    free(copy);
+    *len = off;
+    return json;
+}
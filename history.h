@@ -0,0 +1,47 @@
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * history.h
+ *
+ * The recent past of a few series, in a ring of a fixed number of samples
+ * kept in columns: one array of sample times and one array per series, all
+ * allocated when the history is made, capacity * 8 * (nseries + 1) bytes.
+ *
+ * One thread appends; any number read without locking, like a seqlock: a
+ * reader copies the samples it wants, then drops those the writer may have
+ * overwritten meanwhile.
+ */
+
+/* Samples kept: an hour at the default -I of one second */
+#define HISTORY_LEN 3600
+
+struct history;
+
+/* A history of the series called names, holding the last capacity samples */
+struct history *history_new(const char *const *names, int nseries, unsigned capacity);
+
+/* Append a sample of every series taken at time_ms; one thread only */
+void history_append(struct history *h, uint64_t time_ms, const int64_t *values);
+
+/* Bytes the history takes, fixed when it is made */
+size_t history_footprint(const struct history *h);
+
+/*
+ * The samples taken after since_ms as a JSON object, in a buffer the
+ * caller frees; NULL if out of memory.  The times and each series are
+ * arrays of their first value followed by the difference from the one
+ * before, e.g. {"time": [1700000000000, 1000, 1000], "load1": [38, 2, -1]}.
+ */
+char *history_json(struct history *h, uint64_t since_ms, size_t *len);
+
+/*
+ * Write "name": [first, delta, ...] for n values into out, which needs
+ * room for the name, 8 bytes and 23 a value; returns the length
+ */
+size_t history_column(char *out, const char *name, const int64_t *v, size_t n);
+
+#endif /* __HISTORY_H__ */
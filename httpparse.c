@@ -0,0 +1,182 @@
+#include <string.h>
+
+#include "httpparse.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef char *(*scan_fn)(char *p, char *end, char a, char b);
+
+// First byte of [p, end) that is a or b, NULL if there is none
+static char *scan_scalar(char *p, char *end, char a, char b) {
+    for (; p < end; p++) {
+        if (*p == a || *p == b) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+#ifdef HAVE_X86_SIMD
+// Compare 16 bytes against both at once; the tail goes through the scalar loop
+static char *scan_sse2(char *p, char *end, char a, char b) {
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return scan_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static char *scan_avx2(char *p, char *end, char a, char b) {
+    __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    // The compiler leaves the upper halves dirty on a tail call, and SSE
+    // code running after that stalls on every instruction
+    _mm256_zeroupper();
+    return scan_sse2(p, end, a, b);
+}
+#endif
+
+static scan_fn scan;
+
+// Pick the widest scanner the CPU supports, once
+static scan_fn scanner(void) {
+    scan_fn fn = __atomic_load_n(&scan, __ATOMIC_RELAXED);
+
+    if (fn == NULL) {
+#ifdef HAVE_X86_SIMD
+        fn = __builtin_cpu_supports("avx2") ? scan_avx2 : scan_sse2;
+#else
+        fn = scan_scalar;
+#endif
+        __atomic_store_n(&scan, fn, __ATOMIC_RELAXED);
+    }
+    return fn;
+}
+
+int http_parse_use(const char *impl) {
+    scan_fn fn = NULL;
+
+    if (strcmp(impl, "scalar") == 0) {
+        fn = scan_scalar;
+    }
+#ifdef HAVE_X86_SIMD
+    else if (strcmp(impl, "sse2") == 0) {
+        fn = scan_sse2;
+    } else if (strcmp(impl, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        fn = scan_avx2;
+    }
+#endif
+    if (fn == NULL) {
+        return -1;
+    }
+    __atomic_store_n(&scan, fn, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void http_parser_init(struct http_parser *p) {
+    p->line = 0;
+    p->scanned = 0;
+    p->in_headers = false;
+    p->done = false;
+    p->req.method.len = 0;
+    p->req.target.len = 0;
+    p->req.version.len = 0;
+    p->req.nheaders = 0;
+    p->req.head_len = 0;
+}
+
+// Cut the next blank separated token out of [*p, end) and NUL-terminate it
+static struct http_view next_token(scan_fn fn, char *buf, char **p, char *end) {
+    struct http_view v = { 0, 0 };
+    char *s = *p, *e;
+
+    while (s < end && (*s == ' ' || *s == '\t')) {
+        s++;
+    }
+    if (s == end) {
+        *p = end;
+        return v;
+    }
+    if ((e = fn(s, end, ' ', '\t')) == NULL) {
+        e = end;
+    }
+    v.off = s - buf;
+    v.len = e - s;
+    *p = e < end ? e + 1 : end;
+    *e = '\0';              /* a blank, or the line end, which has been seen */
+    return v;
+}
+
+// "Name: value" with blanks around the value dropped
+static void parse_header(scan_fn fn, struct http_request *req, char *buf, char *s, char *end) {
+    struct http_header *h;
+    char *colon;
+
+    if (req->nheaders == HTTP_MAX_HEADERS || (colon = fn(s, end, ':', ':')) == NULL) {
+        return;
+    }
+    h = &req->headers[req->nheaders++];
+    h->name.off = s - buf;
+    h->name.len = colon - s;
+    *colon = '\0';
+
+    s = colon + 1;
+    while (s < end && (*s == ' ' || *s == '\t')) {
+        s++;
+    }
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    h->value.off = s - buf;
+    h->value.len = end - s;
+    *end = '\0';
+}
+
+bool http_parse(struct http_parser *p, char *buf, size_t len) {
+    scan_fn fn = scanner();
+
+    while (!p->done) {
+        size_t from = p->scanned > p->line ? p->scanned : p->line;
+        char *nl = fn(buf + from, buf + len, '\n', '\n');
+        char *start = buf + p->line, *end;
+
+        if (nl == NULL) {
+            p->scanned = len;
+            return false;
+        }
+        end = nl > start && nl[-1] == '\r' ? nl - 1 : nl;
+        p->line = nl + 1 - buf;
+
+        if (!p->in_headers) {
+            // The request line, even an empty one, as the line reader took it
+            p->req.method = next_token(fn, buf, &start, end);
+            p->req.target = next_token(fn, buf, &start, end);
+            p->req.version = next_token(fn, buf, &start, end);
+            p->in_headers = true;
+        } else if (start == end) {
+            p->req.head_len = p->line;
+            p->done = true;
+        } else {
+            parse_header(fn, &p->req, buf, start, end);
+        }
+    }
+    return true;
+}
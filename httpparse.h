@@ -0,0 +1,75 @@
+#ifndef __HTTPPARSE_H__
+#define __HTTPPARSE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * httpparse.h
+ *
+ * An incremental parser for request heads that works in place on the
+ * connection buffer.  It is fed the bytes of one request as they arrive
+ * and picks up where it stopped, so no byte is looked at twice however
+ * the head is split across reads.  Line ends, blanks and colons are
+ * found 16 or 32 bytes at a time with SSE2 or AVX2 where the CPU has
+ * them.  Each token is NUL-terminated where it lies, and the results are
+ * offsets from the start of the request, so they stay valid when the
+ * buffer is compacted.
+ *
+ * Like the line reader it replaces it is lenient: a bare LF ends a line,
+ * missing request line tokens are empty, and header lines without a
+ * colon or beyond HTTP_MAX_HEADERS are skipped.
+ */
+
+#define HTTP_MAX_HEADERS 32
+
+/* A token at off bytes from the start of the request; len 0 if absent */
+struct http_view {
+    uint32_t off;
+    uint32_t len;
+};
+
+struct http_header {
+    struct http_view name;
+    struct http_view value;
+};
+
+struct http_request {
+    struct http_view method;
+    struct http_view target;
+    struct http_view version;
+    unsigned nheaders;
+    struct http_header headers[HTTP_MAX_HEADERS];
+    size_t head_len;            /* bytes up to and including the empty line */
+};
+
+struct http_parser {
+    size_t line;                /* start of the line being parsed */
+    size_t scanned;             /* bytes already searched for its end */
+    bool in_headers;            /* past the request line */
+    bool done;
+    struct http_request req;
+};
+
+/* Get ready for a new request */
+void http_parser_init(struct http_parser *p);
+
+/*
+ * Parse the first len bytes of a request starting at buf; they include
+ * whatever was passed before.  Returns true once the head is complete.
+ */
+bool http_parse(struct http_parser *p, char *buf, size_t len);
+
+/* The NUL-terminated token v of the request at buf */
+static inline char *http_str(char *buf, struct http_view v) {
+    return v.len ? buf + v.off : "";
+}
+
+/*
+ * Use the "scalar", "sse2" or "avx2" scanner instead of the best one the
+ * CPU has, for benchmarks; -1 if it is not available here.
+ */
+int http_parse_use(const char *impl);
+
+#endif /* __HTTPPARSE_H__ */
@@ -0,0 +1,55 @@
+/*
+ * logdump.c
+ *
+ * Print a binary access log (sysstatd -L file -l binary) as the lines the
+ * line format would have written.
+ *
+ * logdump [file ...]      reads standard input without a file
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "accesslog.h"
+
+static int dump(FILE *in, const char *name) {
+    struct access_log_header h;
+    struct access_record r;
+    char line[256];
+
+    if (fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, ACCESSLOG_MAGIC, sizeof(h.magic)) != 0) {
+        fprintf(stderr, "%s: not a binary access log\n", name);
+        return -1;
+    }
+    if (h.record_size != sizeof(r)) {
+        fprintf(stderr, "%s: records of %u bytes, this logdump reads %zu\n", name, h.record_size, sizeof(r));
+        return -1;
+    }
+    while (fread(&r, sizeof(r), 1, in) == 1) {
+        access_log_format(&r, line, sizeof(line));
+        fputs(line, stdout);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int status = 0;
+    int i;
+
+    if (argc == 1) {
+        return dump(stdin, "stdin") < 0;
+    }
+    for (i = 1; i < argc; i++) {
+        FILE *in = fopen(argv[i], "rb");
+
+        if (in == NULL) {
+            perror(argv[i]);
+            status = 1;
+            continue;
+        }
+        if (dump(in, argv[i]) < 0) {
+            status = 1;
+        }
+        fclose(in);
+    }
+    return status;
+}
@@ -0,0 +1,136 @@
+/*
+ * parse_bench.c
+ *
+ * Time the request head parser against the line reader it replaced: find
+ * the end of the head, read the request line with sscanf, then read the
+ * header lines one byte at a time.  Each request is copied into a
+ * connection sized buffer first, as a read would, in both cases.
+ *
+ * make parse_bench && ./parse_bench [iterations]
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "httpparse.h"
+
+#define BUFSIZE 8192
+
+static const char *requests[] = {
+    "GET /loadavg HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "\r\n",
+
+    "GET /files/index.html HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+
+    "GET /files/js/app.js?v=20261018 HTTP/1.1\r\n"
+    "Host: sysstatd.example.org\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/128.0.0.0 Safari/537.36\r\n"
+    "Accept: */*\r\n"
+    "Referer: http://sysstatd.example.org/files/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "If-None-Match: \"1835123-171037-1760745600000000000\"\r\n"
+    "If-Modified-Since: Sat, 18 Oct 2026 00:00:00 GMT\r\n"
+    "\r\n",
+};
+
+static char buf[BUFSIZE];
+static volatile size_t sink;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// What the reactor and doit used to do with a buffered request
+static void old_parse(size_t len) {
+    char line[BUFSIZE], method[BUFSIZE], uri[BUFSIZE], version[BUFSIZE];
+    const char *p = buf, *end = buf + len, *nl;
+    size_t pos = 0, n;
+
+    // Is the head complete?
+    while ((nl = memchr(p, '\n', end - p)) != NULL) {
+        p = nl + 1;
+        if (p < end && (*p == '\n' || (p + 1 < end && p[0] == '\r' && p[1] == '\n'))) {
+            break;
+        }
+    }
+
+    do {
+        n = 0;
+        while (n + 1 < sizeof(line) && pos < len) {
+            char ch = buf[pos++];
+            line[n++] = ch;
+            if (ch == '\n') {
+                break;
+            }
+        }
+        line[n] = '\0';
+        if (pos == n) {
+            strcpy(method, "");
+            strcpy(uri, "");
+            strcpy(version, "HTTP/1.0");
+            sscanf(line, "%s %s %s", method, uri, version);
+            sink += strlen(uri);
+        } else if (strncasecmp(line, "Accept-Encoding:", 16) == 0) {
+            sink += n;
+        }
+    } while (n > 0 && strcmp(line, "\r\n") && strcmp(line, "\n"));
+}
+
+static void new_parse(size_t len) {
+    struct http_parser p;
+
+    http_parser_init(&p);
+    http_parse(&p, buf, len);
+    sink += p.req.target.len;
+    for (unsigned i = 0; i < p.req.nheaders; i++) {
+        if (strcasecmp(http_str(buf, p.req.headers[i].name), "Accept-Encoding") == 0) {
+            sink += p.req.headers[i].value.len;
+        }
+    }
+}
+
+static double run(bool old, const char *req, long iterations) {
+    size_t len = strlen(req);
+    double start = now();
+
+    for (long i = 0; i < iterations; i++) {
+        memcpy(buf, req, len);
+        if (old) {
+            old_parse(len);
+        } else {
+            new_parse(len);
+        }
+    }
+    return (now() - start) / iterations;
+}
+
+int main(int argc, char **argv) {
+    const char *impls[] = { "scalar", "sse2", "avx2" };
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+
+    for (int r = 0; r < sizeof(requests) / sizeof(requests[0]); r++) {
+        printf("request of %zu bytes\n", strlen(requests[r]));
+        printf("  %-14s %7.1f ns\n", "readline+sscanf", run(true, requests[r], iterations));
+        for (int i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            if (http_parse_use(impls[i]) < 0) {
+                printf("  %-14s %7s\n", impls[i], "n/a");
+                continue;
+            }
+            printf("  %-14s %7.1f ns\n", impls[i], run(false, requests[r], iterations));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+#define _GNU_SOURCE 1
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "procfs.h"
+
+enum { LOADAVG, MEMINFO, STAT, NETDEV, DISKSTATS, NFILES };
+
+static const char *const paths[NFILES] = {
+    [LOADAVG] = "/proc/loadavg",
+    [MEMINFO] = "/proc/meminfo",
+    [STAT] = "/proc/stat",
+    [NETDEV] = "/proc/net/dev",
+    [DISKSTATS] = "/proc/diskstats",
+};
+
+// Opened on first use and kept open
+static int fds[NFILES] = { -1, -1, -1, -1, -1 };
+
+// Read file, or as much of it as fits, into buf as a string.  A seq_file
+// read fills the buffer up to the end of the file, so one pread will do.
+static int proc_read(int file, char *buf) {
+    int fd = __atomic_load_n(&fds[file], __ATOMIC_ACQUIRE);
+    ssize_t n;
+
+    if (fd < 0) {
+        int expected = -1;
+
+        if ((fd = open(paths[file], O_RDONLY | O_CLOEXEC)) < 0) {
+            return -1;
+        }
+        // Two threads may get here at once; the first one's fd stays
+        if (!__atomic_compare_exchange_n(&fds[file], &expected, fd, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            close(fd);
+            fd = expected;
+        }
+    }
+    if ((n = pread(fd, buf, PROC_BUFSIZE - 1, 0)) <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+static const char *skip_blanks(const char *p) {
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    return p;
+}
+
+// The unsigned number at *p, after any blanks; 0 if there is none
+static uint64_t scan_u64(const char **p) {
+    const char *s = skip_blanks(*p);
+    uint64_t v = 0;
+
+    while (*s >= '0' && *s <= '9') {
+        v = v * 10 + (*s++ - '0');
+    }
+    *p = s;
+    return v;
+}
+
+// A decimal like 0.38 in hundredths
+static unsigned scan_hundredths(const char **p) {
+    unsigned v = scan_u64(p) * 100;
+    const char *s = *p;
+
+    if (*s == '.') {
+        s++;
+        if (*s >= '0' && *s <= '9') {
+            v += (*s++ - '0') * 10;
+            if (*s >= '0' && *s <= '9') {
+                v += *s++ - '0';
+            }
+        }
+        while (*s >= '0' && *s <= '9') {
+            s++;
+        }
+    }
+    *p = s;
+    return v;
+}
+
+// The word at *p, after any blanks, up to a blank or stop; cut to PROC_NAME
+static void scan_name(const char **p, char *out, char stop) {
+    const char *s = skip_blanks(*p);
+    size_t n = 0;
+
+    while (*s && *s != ' ' && *s != '\t' && *s != '\n' && *s != stop) {
+        if (n < PROC_NAME - 1) {
+            out[n++] = *s;
+        }
+        s++;
+    }
+    out[n] = '\0';
+    if (*s == stop) {
+        s++;
+    }
+    *p = s;
+}
+
+int proc_loadavg(struct proc_loadavg *la) {
+    char buf[PROC_BUFSIZE];
+    const char *p = buf;
+
+    if (proc_read(LOADAVG, buf) < 0) {
+        return -1;
+    }
+    // "0.02 0.20 0.38 2/72 20134"
+    la->load[0] = scan_hundredths(&p);
+    la->load[1] = scan_hundredths(&p);
+    la->load[2] = scan_hundredths(&p);
+    la->running = scan_u64(&p);
+    if (*p == '/') {
+        p++;
+    }
+    la->total = scan_u64(&p);
+    return 1;
+}
+
+int proc_meminfo(struct proc_meminfo *entries, int max) {
+    char buf[PROC_BUFSIZE];
+    const char *p, *eol;
+    int n = 0;
+
+    if (proc_read(MEMINFO, buf) < 0) {
+        return -1;
+    }
+    // "MemTotal:        6158152 kB"
+    for (p = buf; n < max && (eol = strchr(p, '\n')) != NULL; p = eol + 1) {
+        scan_name(&p, entries[n].name, ':');
+        entries[n].value = scan_u64(&p);
+        n++;
+    }
+    return n;
+}
+
+int proc_cpustat(struct proc_cpu *cpus, int max) {
+    char buf[PROC_BUFSIZE];
+    const char *p, *eol;
+    int n = 0;
+
+    if (proc_read(STAT, buf) < 0) {
+        return -1;
+    }
+    // "cpu  18919 0 7967 308712 16915 0 668 2269 0 0", then one "cpuN" line
+    // per cpu; they come first, ahead of the long intr line
+    for (p = buf; n < max && strncmp(p, "cpu", 3) == 0 && (eol = strchr(p, '\n')) != NULL; p = eol + 1) {
+        struct proc_cpu *c = &cpus[n++];
+
+        p += 3;
+        c->cpu = *p >= '0' && *p <= '9' ? (int)scan_u64(&p) : -1;
+        c->user = scan_u64(&p);
+        c->nice = scan_u64(&p);
+        c->system = scan_u64(&p);
+        c->idle = scan_u64(&p);
+        c->iowait = scan_u64(&p);
+        c->irq = scan_u64(&p);
+        c->softirq = scan_u64(&p);
+        c->steal = scan_u64(&p);
+        c->guest = scan_u64(&p);
+        c->guest_nice = scan_u64(&p);
+    }
+    return n;
+}
+
+int proc_netdev(struct proc_netdev *devs, int max) {
+    char buf[PROC_BUFSIZE];
+    const char *p, *eol;
+    int n = 0, line = 0;
+
+    if (proc_read(NETDEV, buf) < 0) {
+        return -1;
+    }
+    // Two header lines, then "  eth0: rx bytes packets errs drop fifo frame
+    // compressed multicast, tx bytes packets errs drop ..."
+    for (p = buf; n < max && (eol = strchr(p, '\n')) != NULL; p = eol + 1) {
+        struct proc_netdev *d = &devs[n];
+
+        if (line++ < 2) {
+            continue;
+        }
+        scan_name(&p, d->name, ':');
+        d->rx_bytes = scan_u64(&p);
+        d->rx_packets = scan_u64(&p);
+        d->rx_errs = scan_u64(&p);
+        d->rx_drop = scan_u64(&p);
+        scan_u64(&p);           /* fifo */
+        scan_u64(&p);           /* frame */
+        scan_u64(&p);           /* compressed */
+        scan_u64(&p);           /* multicast */
+        d->tx_bytes = scan_u64(&p);
+        d->tx_packets = scan_u64(&p);
+        d->tx_errs = scan_u64(&p);
+        d->tx_drop = scan_u64(&p);
+        n++;
+    }
+    return n;
+}
+
+int proc_diskstats(struct proc_disk *disks, int max) {
+    char buf[PROC_BUFSIZE];
+    const char *p, *eol;
+    int n = 0;
+
+    if (proc_read(DISKSTATS, buf) < 0) {
+        return -1;
+    }
+    // "   8       0 sda 1234 0 5678 ...", eleven counters and, on newer
+    // kernels, discard and flush ones that are not reported
+    for (p = buf; n < max && (eol = strchr(p, '\n')) != NULL; p = eol + 1) {
+        struct proc_disk *d = &disks[n++];
+
+        d->major = scan_u64(&p);
+        d->minor = scan_u64(&p);
+        scan_name(&p, d->name, ' ');
+        d->reads = scan_u64(&p);
+        d->reads_merged = scan_u64(&p);
+        d->sectors_read = scan_u64(&p);
+        d->read_ms = scan_u64(&p);
+        d->writes = scan_u64(&p);
+        d->writes_merged = scan_u64(&p);
+        d->sectors_written = scan_u64(&p);
+        d->write_ms = scan_u64(&p);
+        d->in_flight = scan_u64(&p);
+        d->io_ms = scan_u64(&p);
+        d->weighted_io_ms = scan_u64(&p);
+    }
+    return n;
+}
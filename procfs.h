@@ -0,0 +1,60 @@
+#ifndef __PROCFS_H__
+#define __PROCFS_H__
+
+#include <stdint.h>
+
+/*
+ * procfs.h
+ *
+ * Readers for the /proc files the server reports.  Each file is opened
+ * once and re-read with pread at offset 0, which makes the kernel generate
+ * it afresh, into a buffer on the caller's stack; the numbers are picked
+ * out with plain digit scanners.  Nothing is allocated and no stdio or
+ * sscanf is involved, so the readers are cheap and safe to call from any
+ * thread at any rate.
+ *
+ * Each returns the number of entries filled in, or -1 if the file cannot
+ * be read.  Lines beyond max, or cut off by PROC_BUFSIZE, are left out.
+ */
+
+#define PROC_BUFSIZE (64 * 1024)    /* bytes of a file looked at */
+#define PROC_NAME 32                /* longest name kept, NUL included */
+
+struct proc_loadavg {
+    unsigned load[3];               /* 1, 5 and 15 minute averages, in hundredths */
+    unsigned running;               /* runnable threads */
+    unsigned total;                 /* all threads */
+};
+
+struct proc_meminfo {
+    char name[PROC_NAME];           /* e.g. MemTotal */
+    uint64_t value;                 /* in kB for most, a count for HugePages_* */
+};
+
+/* A cpu line of /proc/stat, in USER_HZ ticks */
+struct proc_cpu {
+    int cpu;                        /* -1 for the "cpu" line that sums them all */
+    uint64_t user, nice, system, idle, iowait, irq, softirq, steal, guest, guest_nice;
+};
+
+struct proc_netdev {
+    char name[PROC_NAME];
+    uint64_t rx_bytes, rx_packets, rx_errs, rx_drop;
+    uint64_t tx_bytes, tx_packets, tx_errs, tx_drop;
+};
+
+struct proc_disk {
+    unsigned major, minor;
+    char name[PROC_NAME];
+    uint64_t reads, reads_merged, sectors_read, read_ms;
+    uint64_t writes, writes_merged, sectors_written, write_ms;
+    uint64_t in_flight, io_ms, weighted_io_ms;
+};
+
+int proc_loadavg(struct proc_loadavg *la);
+int proc_meminfo(struct proc_meminfo *entries, int max);
+int proc_cpustat(struct proc_cpu *cpus, int max);
+int proc_netdev(struct proc_netdev *devs, int max);
+int proc_diskstats(struct proc_disk *disks, int max);
+
+#endif /* __PROCFS_H__ */
@@ -0,0 +1,199 @@
+#include <string.h>
+
+#include "projection.h"
+
+// Where the next occurrence of c in [s, end) is, or end
+static const char *find(const char *s, const char *end, char c) {
+    const char *p = memchr(s, c, end - s);
+
+    return p != NULL ? p : end;
+}
+
+// Can name be copied into the output as it is?  Anything that needs
+// escaping in a JSON string is refused; "-" is in for "dm-0" and "br-..."
+static bool name_ok(const char *name, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        char ch = name[i];
+        if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_' ||
+              ch == '-' || ch == '(' || ch == ')')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The field named name under parent, added if it is not there yet; -1 if full
+static int field_get(struct projection *p, int parent, const char *name, size_t len) {
+    int i;
+
+    for (i = 0; i < p->n; i++) {
+        struct projection_field *f = &p->fields[i];
+        if (f->parent == parent && f->len == len && memcmp(f->name, name, len) == 0) {
+            return i;
+        }
+    }
+    if (p->n == PROJECTION_MAX) {
+        return -1;
+    }
+    p->fields[p->n].name = name;
+    p->fields[p->n].len = len;
+    p->fields[p->n].parent = parent;
+    p->fields[p->n].whole = false;
+    return p->n++;
+}
+
+bool projection_parse(struct projection *p, const char *paths, size_t len) {
+    const char *end = paths + len;
+    const char *s, *comma;
+
+    p->n = 0;
+    for (s = paths; s < end; s = comma + 1) {
+        const char *part, *dot;
+        int parent = -1;
+
+        comma = find(s, end, ',');
+        for (part = s; part < comma; part = dot + 1) {
+            dot = find(part, comma, '.');
+            if (dot > part && (!name_ok(part, dot - part) || (parent = field_get(p, parent, part, dot - part)) < 0)) {
+                return false;
+            }
+        }
+        // Children come after their parents, so writing needs one pass
+        if (parent >= 0) {
+            p->fields[parent].whole = true;
+        }
+    }
+    return true;
+}
+
+static const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    return p;
+}
+
+// The end of the JSON value that starts at p
+static const char *value_end(const char *p, const char *end) {
+    bool in_string = false;
+    int depth = 0;
+
+    for (; p < end; p++) {
+        if (in_string) {
+            if (*p == '\\') {
+                p++;
+            } else if (*p == '"') {
+                in_string = false;
+                if (depth == 0) {
+                    return p + 1;
+                }
+            }
+            continue;
+        }
+        switch (*p) {
+        case '"':
+            in_string = true;
+            break;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (depth == 0) {
+                return p;       /* a number or literal closing its container */
+            }
+            if (--depth == 0) {
+                return p + 1;
+            }
+            break;
+        case ',':
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+            if (depth == 0) {
+                return p;
+            }
+            break;
+        }
+    }
+    return end;
+}
+
+// The value of member name of the JSON object in [json, end), NULL if none
+static const char *member(const char *json, const char *end, const char *name, size_t len, const char **value_stop) {
+    const char *p = skip_blanks(json, end);
+
+    if (p == end || *p != '{') {
+        return NULL;
+    }
+    p++;
+    while (1) {
+        const char *key, *key_end, *v, *v_end;
+
+        p = skip_blanks(p, end);
+        if (p == end || *p != '"') {
+            return NULL;
+        }
+        key = p + 1;
+        key_end = value_end(p, end) - 1;
+        p = skip_blanks(key_end + 1, end);
+        if (p == end || *p != ':') {
+            return NULL;
+        }
+        v = skip_blanks(p + 1, end);
+        v_end = value_end(v, end);
+        if (key_end - key == len && memcmp(key, name, len) == 0) {
+            *value_stop = v_end;
+            return v;
+        }
+        p = skip_blanks(v_end, end);
+        if (p == end || *p != ',') {
+            return NULL;
+        }
+        p++;
+    }
+}
+
+// Append len bytes of s at *n, as far as they fit
+static void put(char *out, size_t size, size_t *n, const char *s, size_t len) {
+    if (*n < size) {
+        memcpy(out + *n, s, len < size - *n ? len : size - *n);
+    }
+    *n += len;
+}
+
+size_t projection_write(const struct projection *p, int i, const char *json, size_t len, char *out, size_t size) {
+    size_t n = 0;
+    bool first = true;
+    int j;
+
+    if (i >= 0 && p->fields[i].whole) {
+        put(out, size, &n, json, len);
+        return n;
+    }
+    put(out, size, &n, "{", 1);
+    for (j = i + 1; j < p->n; j++) {
+        const struct projection_field *f = &p->fields[j];
+        const char *v, *v_end;
+
+        if (f->parent != i) {
+            continue;
+        }
+        put(out, size, &n, first ? "\"" : ", \"", first ? 1 : 3);
+        put(out, size, &n, f->name, f->len);
+        put(out, size, &n, "\": ", 3);
+        first = false;
+
+        if ((v = member(json, json + len, f->name, f->len, &v_end)) == NULL) {
+            put(out, size, &n, "null", 4);
+            continue;
+        }
+        n += projection_write(p, j, v, v_end - v, out + (n < size ? n : size), n < size ? size - n : 0);
+    }
+    put(out, size, &n, "}", 1);
+    return n;
+}
@@ -0,0 +1,48 @@
+#ifndef __PROJECTION_H__
+#define __PROJECTION_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * projection.h
+ *
+ * Some of the fields of JSON objects, picked by dotted paths such as
+ * "loadavg,meminfo.MemFree,meminfo.Cached".  The paths are parsed into a
+ * small tree once per request; writing a projection walks the object's
+ * text and copies only the values asked for, so nothing is decoded.
+ * A path that leads nowhere is written as null.
+ */
+
+/* Names in one projection, counting each part of a path once */
+#define PROJECTION_MAX 32
+
+struct projection_field {
+    const char *name;           /* into the paths string */
+    size_t len;
+    int parent;                 /* the field it is in, -1 at the top */
+    bool whole;                 /* asked for itself, not just some of its fields */
+};
+
+struct projection {
+    int n;
+    struct projection_field fields[PROJECTION_MAX];
+};
+
+/*
+ * Parse len bytes of comma separated paths; false if there are too many
+ * names or one has a character other than letters, digits, _, -, ( and ),
+ * since names are written out unescaped
+ */
+bool projection_parse(struct projection *p, const char *paths, size_t len);
+
+/*
+ * Write what field i (-1 for the top) asks for of the JSON value json, len
+ * bytes, into out: the value itself if i is wanted whole, else an object
+ * of its fields that are asked for.  Returns the length, which is at most
+ * len plus what the names and nulls of the fields below i take; nothing
+ * past size is written.
+ */
+size_t projection_write(const struct projection *p, int i, const char *json, size_t len, char *out, size_t size);
+
+#endif /* __PROJECTION_H__ */
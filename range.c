@@ -0,0 +1,89 @@
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#include "range.h"
+
+// Digits only: strtoll would also take signs and leading blanks
+static bool parse_offset(const char **p, off_t *out) {
+    const char *s = *p;
+    off_t v = 0;
+
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+    while (*s >= '0' && *s <= '9') {
+        if (v > (((off_t)1 << 62) - 1) / 10) {
+            return false;
+        }
+        v = v * 10 + (*s++ - '0');
+    }
+    *p = s;
+    *out = v;
+    return true;
+}
+
+int range_parse(const char *value, off_t size, struct byte_range *ranges, int max) {
+    int n = 0, specs = 0;
+
+    value += strspn(value, " \t");
+    if (strncasecmp(value, "bytes=", 6) != 0) {
+        return -1;
+    }
+    value += 6;
+
+    while (1) {
+        off_t first, last;
+        bool satisfiable;
+
+        value += strspn(value, " \t");
+        if (*value == ',') {
+            value++;            /* empty list elements are allowed */
+            continue;
+        }
+        if (*value == '\0' || *value == '\r' || *value == '\n') {
+            break;
+        }
+        if (++specs > max) {
+            return -1;
+        }
+
+        if (*value == '-') {
+            // "-500": the last 500 bytes
+            value++;
+            if (!parse_offset(&value, &last)) {
+                return -1;
+            }
+            satisfiable = last > 0 && size > 0;
+            first = last < size ? size - last : 0;
+            last = size - 1;
+        } else {
+            // "100-199" or "100-": from 100 to 199 or to the end
+            if (!parse_offset(&value, &first) || *value++ != '-') {
+                return -1;
+            }
+            if (parse_offset(&value, &last)) {
+                if (last < first) {
+                    return -1;
+                }
+                if (last >= size) {
+                    last = size - 1;
+                }
+            } else {
+                last = size - 1;
+            }
+            satisfiable = first < size;
+        }
+
+        value += strspn(value, " \t");
+        if (*value != ',' && *value != '\0' && *value != '\r' && *value != '\n') {
+            return -1;
+        }
+        if (satisfiable) {
+            ranges[n].first = first;
+            ranges[n].last = last;
+            n++;
+        }
+    }
+    return specs > 0 ? n : -1;
+}
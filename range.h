@@ -0,0 +1,31 @@
+#ifndef __RANGE_H__
+#define __RANGE_H__
+
+#include <sys/types.h>
+
+/*
+ * range.h
+ *
+ * Byte ranges of a static file (RFC 9110 section 14).  A Range header is
+ * resolved against the file size into absolute [first, last] pairs that
+ * the server sends straight from the file, one range as a plain 206 and
+ * several as multipart/byteranges.
+ */
+
+/* More ranges than this in one request are ignored and the file sent whole */
+#define RANGE_MAX 16
+
+struct byte_range {
+    off_t first;
+    off_t last;                 /* inclusive */
+};
+
+/*
+ * Resolve a Range value ("bytes=0-99,-500") against a file of size bytes.
+ * Returns how many satisfiable ranges were stored in ranges, 0 if none is
+ * (answer 416), or -1 if the header is malformed or asks for more than max
+ * ranges (ignore it and answer 200).
+ */
+int range_parse(const char *value, off_t size, struct byte_range *ranges, int max);
+
+#endif /* __RANGE_H__ */
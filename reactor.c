@@ -0,0 +1,1400 @@
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "list.h"
+#include "rio.h"
+#include "threadpool.h"
+#include "uring.h"
+#include "admission.h"
+#include "timewheel.h"
+#include "accesslog.h"
+#include "reactor.h"
+
+#define MAXEVENTS 256
+#define CHUNK_MIN 4096
+#define OUT_IOV 64              /* chunks gathered into one sendmsg */
+
+/* io_uring backend sizing */
+#define URING_ENTRIES 1024
+#define URING_NBUFS 1024        /* provided receive buffers, power of two */
+#define URING_BUFSZ 4096
+#define URING_BGID 0
+#define URING_PIPESZ (512 * 1024) /* pipe a file is spliced through to the socket */
+#define URING_SPLICE (256 * 1024) /* most file bytes moved into the pipe at once */
+
+/* io_uring user_data: a connection pointer tagged in its low bits, or a constant */
+#define UD_SEND 1ULL
+#define UD_ACCEPT 2ULL
+#define UD_SPLICE 4ULL
+#define UD_WAKE 6ULL
+#define UD_TICK 10ULL
+
+/* What a request turned away by admission control gets */
+#define SHED_RESPONSE "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n" \
+                      "Content-Length: 0\r\nConnection: close\r\n\r\n"
+
+#define count_syscall(r) __atomic_fetch_add(&(r)->syscalls, 1, __ATOMIC_RELAXED)
+
+/* One piece of a queued response: bytes in memory, or a range of a file */
+struct out_chunk {
+    char *data;
+    size_t len;             /* bytes of data, or of the file range, to send */
+    size_t cap;             /* bytes allocated, 0 if data is not ours to append to */
+    size_t off;             /* bytes already written to the socket */
+    int fd;                 /* file sent with sendfile or splice, -1 for data */
+    off_t pos;              /* file offset of the range */
+    void (*release)(void *); /* called with arg when sent, instead of closing fd or freeing data */
+    void *arg;
+    struct list_elem elem;
+};
+
+struct connection {
+    int fd;
+    struct reactor *reactor;
+
+    char *buf;              /* request bytes, allocated on first read */
+    size_t buf_len;         /* bytes in buf */
+    size_t buf_pos;         /* bytes of buf taken by requests already served */
+    struct http_parser parser; /* state of the request that starts at buf_pos */
+
+    struct list out;        /* queued out_chunks */
+    struct uring_send *send; /* sendmsg in flight on the io_uring backend */
+    int pipe[2];            /* io_uring: file bytes go through here, -1 until needed */
+    size_t piped;           /* bytes spliced into the pipe, not yet out of it */
+    uint32_t want;          /* EPOLLIN or EPOLLOUT, whichever is armed */
+    bool close_after;       /* close once out has drained */
+    bool peer_closed;       /* read() returned 0 */
+    bool error;             /* the socket failed, close as soon as we own it */
+    bool reset;             /* shed by admission control, reset when we own it */
+    uint64_t arrived_at;    /* accepted, for the first request, else its first byte */
+    uint64_t queued_at;     /* when the request was handed to the pool */
+
+    // What the access log needs about the request being served
+    uint64_t out_bytes;     /* bytes queued for it */
+    int status;             /* set with its head by conn_set_status, 0 until then */
+    uint64_t first_byte_at; /* when that was, 0 until then */
+    struct sockaddr_storage peer; /* looked up when first logged */
+    socklen_t peer_len;
+
+    bool served;            /* a response has gone out, so waiting for input is keep-alive */
+    uint64_t idle_since;    /* accepted, or the last response went out */
+    uint64_t request_since; /* first byte of the request that is being buffered */
+    struct timer timer;     /* armed while the loop waits on the connection */
+
+    struct stream *stream;  /* the channels it is subscribed to, NULL if none */
+    struct list_elem elem;  /* link in reactor's done_list */
+};
+
+struct channel {
+    int id;                     /* its bit in a stream's channels */
+    unsigned long subscribers;  /* connections subscribed to it */
+};
+
+/* What a connection turned into an event stream is subscribed to */
+struct stream {
+    uint32_t channels;              /* bits of the channels subscribed to */
+    unsigned every[CHANNEL_MAX];    /* send every nth event of each */
+    unsigned seen[CHANNEL_MAX];     /* events published to each since subscribing */
+    bool listed;                    /* in the reactor's streams */
+    struct connection *c;
+    struct list_elem elem;
+};
+
+/* A published event, queued by reference on every subscriber it goes to */
+struct event {
+    struct channel *ch;
+    const void *data;
+    size_t len;
+    void (*release)(void *);
+    void *arg;
+    unsigned long refs;
+};
+
+/* An event on its way to one event loop */
+struct event_post {
+    struct event *ev;
+    struct list_elem elem;
+};
+
+/* The message an io_uring sendmsg reads from must outlive the submission */
+struct uring_send {
+    struct msghdr msg;
+    struct iovec iov[OUT_IOV];
+};
+
+struct uring_backend {
+    struct uring ring;
+    struct uring_bufring bufs;
+    uint64_t wake_count;        /* target of the pending eventfd read */
+    struct __kernel_timespec tick; /* target of the pending timeout */
+    bool tick_pending;
+};
+
+struct reactor {
+    struct uring_backend *uring; /* NULL when running on epoll */
+    int epfd;
+    int listenfd;
+    int wakefd;                 /* eventfd poked by workers handing connections back */
+
+    struct thread_pool *pool;
+    request_handler_t handler;
+    struct admission *admission; /* NULL if every request is admitted */
+    struct access_log *log;     /* NULL if requests are not logged */
+
+    pthread_mutex_t done_mutex;
+    struct list done_list;      /* connections workers have finished with */
+    struct list event_list;     /* event_posts published since the last drain */
+
+    struct list streams;        /* connections subscribed to channels */
+    unsigned long nstreams;     /* written by the loop, read by publishers */
+    struct reactor *next;       /* in the list of all reactors */
+
+    struct timewheel wheel;     /* deadlines of the connections the loop waits on */
+    struct reactor_timeouts timeouts;
+
+    pthread_t tid;
+    int cpu;
+
+    // Written only by the loop thread, except requests which workers bump
+    unsigned long accepted;
+    unsigned long accept_errors;
+    unsigned long closed;
+    unsigned long requests;
+    unsigned long syscalls;
+    unsigned long expired;
+};
+
+// Every reactor, for channel_publish; pushed onto in reactor_new
+static struct reactor *reactors;
+static pthread_mutex_t reactors_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct channel channels[CHANNEL_MAX];
+static int nchannels;
+
+static void conn_dispatch(struct connection *c);
+static void uring_recv(struct connection *c);
+static void uring_send(struct connection *c);
+
+/*********************
+ * Connection helpers
+ *********************/
+
+static struct connection *conn_new(struct reactor *r, int fd) {
+    struct connection *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->fd = fd;
+    c->reactor = r;
+    c->idle_since = now_ns();
+    c->pipe[0] = c->pipe[1] = -1;
+    list_init(&c->out);
+    http_parser_init(&c->parser);
+    return c;
+}
+
+static void chunk_free(struct out_chunk *ch) {
+    if (ch->release != NULL) {
+        ch->release(ch->arg);
+    } else if (ch->fd >= 0) {
+        close(ch->fd);
+    } else {
+        free(ch->data);
+    }
+    free(ch);
+}
+
+static void event_put(void *event) {
+    struct event *ev = event;
+
+    if (__atomic_sub_fetch(&ev->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        ev->release(ev->arg);
+        free(ev);
+    }
+}
+
+static void conn_unsubscribe(struct connection *c) {
+    struct stream *s = c->stream;
+    int i;
+
+    for (i = 0; i < CHANNEL_MAX; i++) {
+        if (s->channels & (1U << i)) {
+            __atomic_fetch_sub(&channels[i].subscribers, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (s->listed) {
+        list_remove(&s->elem);
+        __atomic_store_n(&c->reactor->nstreams, c->reactor->nstreams - 1, __ATOMIC_RELAXED);
+    }
+    free(s);
+    c->stream = NULL;
+}
+
+static void conn_close(struct connection *c) {
+    __atomic_store_n(&c->reactor->closed, c->reactor->closed + 1, __ATOMIC_RELAXED);
+    timewheel_del(&c->reactor->wheel, &c->timer);
+    count_syscall(c->reactor);
+    close(c->fd);
+    while (!list_empty(&c->out)) {
+        chunk_free(list_entry(list_pop_front(&c->out), struct out_chunk, elem));
+    }
+    if (c->pipe[0] >= 0) {
+        close(c->pipe[0]);
+        close(c->pipe[1]);
+    }
+    if (c->stream != NULL) {
+        conn_unsubscribe(c);
+    }
+    free(c->send);
+    free(c->buf);
+    free(c);
+}
+
+// Put the deadline for what the connection is about to wait on in the wheel
+static void conn_set_timer(struct connection *c, uint32_t want) {
+    struct reactor *r = c->reactor;
+    uint64_t now = now_ns();
+    uint64_t since = now;
+    unsigned limit_ms;
+
+    if (want == EPOLLOUT) {
+        limit_ms = r->timeouts.write_ms;
+    } else if (c->buf_pos < c->buf_len) {
+        limit_ms = r->timeouts.header_ms;
+        since = c->request_since;
+    } else {
+        limit_ms = c->served ? r->timeouts.idle_ms : r->timeouts.first_byte_ms;
+        since = c->idle_since;
+    }
+
+    if (limit_ms == 0) {
+        timewheel_del(&r->wheel, &c->timer);
+        return;
+    }
+    uint64_t deadline = since + (uint64_t)limit_ms * 1000000ULL;
+    timewheel_add(&r->wheel, &c->timer, now, deadline > now ? deadline - now : 0);
+}
+
+// (Re)arm the one event this connection is waiting for.
+// EPOLLONESHOT guarantees that only one thread ever owns a connection.
+// On io_uring, arming means queueing the recv or sendmsg itself.
+static void conn_arm(struct connection *c, uint32_t want) {
+    struct epoll_event ev;
+    int op = c->want == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+    c->want = want;
+    conn_set_timer(c, want);
+    if (c->reactor->uring) {
+        if (want == EPOLLIN) {
+            uring_recv(c);
+        } else {
+            uring_send(c);
+        }
+        return;
+    }
+    count_syscall(c->reactor);
+    ev.events = want | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(c->reactor->epfd, op, c->fd, &ev) < 0) {
+        conn_close(c);
+    }
+}
+
+// Does the unconsumed part of buf hold a complete request head?  The
+// parser resumes where the last call stopped, so a head arriving in many
+// pieces is still scanned only once.
+static bool conn_has_request(struct connection *c) {
+    if (c->buf == NULL) {
+        return false;
+    }
+    return http_parse(&c->parser, c->buf + c->buf_pos, c->buf_len - c->buf_pos);
+}
+
+// The handler is done with the parsed request; move on to the next one
+static void conn_next_request(struct connection *c) {
+    c->buf_pos += c->parser.req.head_len;
+    http_parser_init(&c->parser);
+}
+
+// Drop consumed request bytes. An idle connection gives its buffer back.
+static void conn_compact(struct connection *c) {
+    if (c->buf_pos == 0) {
+        return;
+    }
+    c->buf_len -= c->buf_pos;
+    if (c->buf_len == 0) {
+        free(c->buf);
+        c->buf = NULL;
+    } else {
+        memmove(c->buf, c->buf + c->buf_pos, c->buf_len);
+    }
+    c->buf_pos = 0;
+}
+
+// Drop n bytes that have been sent from the front of the queue.
+static void conn_consume(struct connection *c, size_t n) {
+    while (n > 0 && !list_empty(&c->out)) {
+        struct out_chunk *ch = list_entry(list_front(&c->out), struct out_chunk, elem);
+        size_t left = ch->len - ch->off;
+
+        if (n < left) {
+            ch->off += n;
+            return;
+        }
+        n -= left;
+        list_remove(&ch->elem);
+        chunk_free(ch);
+    }
+}
+
+// Point iov at the unsent part of up to max queued chunks in memory; returns
+// how many.  Stops at a file chunk, and sets more if one follows the gathered
+// chunks so that their bytes can go out in one segment with the file's.
+static int conn_fill_iov(struct connection *c, struct iovec *iov, int max, size_t *total, bool *more) {
+    struct list_elem *e;
+    int n = 0;
+
+    *total = 0;
+    *more = false;
+    for (e = list_begin(&c->out); e != list_end(&c->out) && n < max; e = list_next(e)) {
+        struct out_chunk *ch = list_entry(e, struct out_chunk, elem);
+        if (ch->fd >= 0) {
+            *more = true;
+            break;
+        }
+        iov[n].iov_base = ch->data + ch->off;
+        iov[n].iov_len = ch->len - ch->off;
+        *total += iov[n].iov_len;
+        n++;
+    }
+    return n;
+}
+
+// Send the front file chunk straight from the page cache.
+// Returns 1 once it is sent, 0 if the socket is full, -1 on error.
+static int conn_sendfile(struct connection *c, struct out_chunk *ch) {
+    while (ch->off < ch->len) {
+        off_t pos = ch->pos + ch->off;
+
+        count_syscall(c->reactor);
+        ssize_t n = sendfile(c->fd, ch->fd, &pos, ch->len - ch->off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            return -1;          /* the file shrank under us */
+        }
+        ch->off += n;
+    }
+    list_remove(&ch->elem);
+    chunk_free(ch);
+    return 1;
+}
+
+// Write as much of the queued response as the socket takes, gathering the
+// queued chunks (often several pipelined responses) into one sendmsg and
+// sending file bodies with sendfile.
+// Returns 1 once drained, 0 if the socket is full, -1 on error.
+static int conn_flush(struct connection *c) {
+    struct iovec iov[OUT_IOV];
+    struct msghdr msg = { .msg_iov = iov };
+    size_t total;
+    bool more;
+
+    while (!list_empty(&c->out)) {
+        struct out_chunk *ch = list_entry(list_front(&c->out), struct out_chunk, elem);
+
+        if (ch->fd >= 0) {
+            int rc = conn_sendfile(c, ch);
+            if (rc <= 0) {
+                return rc;
+            }
+            continue;
+        }
+
+        // MSG_MORE holds the headers back to go out with the file body
+        msg.msg_iovlen = conn_fill_iov(c, iov, OUT_IOV, &total, &more);
+        count_syscall(c->reactor);
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        conn_consume(c, n);
+        // A short write on a non-blocking socket means its buffer is full
+        if (n < total) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Queue a canned response from the event loop thread and close afterwards.
+static void conn_reject(struct connection *c, int status, const char *response) {
+    conn_set_status(c, status);
+    conn_write(c, response, strlen(response));
+    conn_set_close(c);
+    conn_arm(c, EPOLLOUT);
+}
+
+// Close with an RST instead of a FIN so the peer learns right away
+static void conn_reset(struct connection *c) {
+    struct linger lin = { 1, 0 };
+
+    setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    conn_close(c);
+}
+
+// Turn a request away from the event loop thread
+static void conn_shed(struct connection *c) {
+    if (admission_resets(c->reactor->admission)) {
+        conn_reset(c);
+    } else {
+        conn_reject(c, 503, SHED_RESPONSE);
+    }
+}
+
+// Decide what a connection waits for next after a response went out.
+static void conn_resume(struct connection *c) {
+    if (c->error) {
+        conn_close(c);
+        return;
+    }
+    if (c->reset) {
+        conn_reset(c);
+        return;
+    }
+    if (c->stream != NULL && !c->stream->listed) {
+        // Just subscribed: from now on it only gets events
+        list_push_back(&c->reactor->streams, &c->stream->elem);
+        c->stream->listed = true;
+        __atomic_store_n(&c->reactor->nstreams, c->reactor->nstreams + 1, __ATOMIC_RELAXED);
+        free(c->buf);
+        c->buf = NULL;
+        c->buf_len = c->buf_pos = 0;
+    }
+    if (!list_empty(&c->out)) {
+        conn_arm(c, EPOLLOUT);
+        return;
+    }
+    if (c->stream != NULL) {
+        // Nothing is read from a stream, so it waits on nothing until the
+        // next event; a peer that went away shows when sending it fails
+        timewheel_del(&c->reactor->wheel, &c->timer);
+        return;
+    }
+    if (c->close_after) {
+        conn_close(c);
+        return;
+    }
+    c->served = true;
+    c->idle_since = now_ns();
+    conn_compact(c);
+    if (c->buf_len > 0) {
+        // Part of the next request came in with the last one
+        c->request_since = c->idle_since;
+    }
+    if (conn_has_request(c)) {
+        conn_dispatch(c);
+        return;
+    }
+    if (c->peer_closed) {
+        conn_close(c);
+        return;
+    }
+    conn_arm(c, EPOLLIN);
+}
+
+/******************************************
+ * Pool side: run the handler, hand it back
+ ******************************************/
+
+// Queue elem on list for the loop to drain, waking it if need be
+static void reactor_post(struct reactor *r, struct list *list, struct list_elem *elem) {
+    bool was_empty;
+
+    pthread_mutex_lock(&r->done_mutex);
+    was_empty = list_empty(&r->done_list) && list_empty(&r->event_list);
+    list_push_back(list, elem);
+    pthread_mutex_unlock(&r->done_mutex);
+
+    // Only the first post after a drain needs to wake the loop
+    if (was_empty) {
+        uint64_t one = 1;
+        count_syscall(r);
+        if (write(r->wakefd, &one, sizeof(one)) < 0) {
+            fprintf(stderr, "reactor wakeup failed: %s\n", strerror(errno));
+        }
+    }
+}
+
+static void reactor_handback(struct reactor *r, struct connection *c) {
+    reactor_post(r, &r->done_list, &c->elem);
+}
+
+// Log the request just served, which started at start; returns when it ended
+static uint64_t conn_log(struct connection *c, uint64_t start) {
+    uint64_t end = now_ns();
+
+    if (c->peer_len == 0) {
+        c->peer_len = sizeof(c->peer);
+        if (getpeername(c->fd, (struct sockaddr *)&c->peer, &c->peer_len) < 0) {
+            c->peer.ss_family = AF_UNSPEC;
+        }
+    }
+    access_log_record(c->reactor->log, (struct sockaddr *)&c->peer, http_str(c->buf + c->buf_pos, c->parser.req.target),
+                      c->status, c->out_bytes, end - start);
+    return end;
+}
+
+static void *conn_serve(struct thread_pool *pool, void *data) {
+    struct connection *c = data;
+    struct admission *adm = c->reactor->admission;
+
+    if (adm != NULL && !admission_dequeue(adm, c->queued_at)) {
+        // Waited too long in a standing queue: answer cheaply, skip the handler
+        if (admission_resets(adm)) {
+            c->reset = true;
+        } else {
+            conn_set_status(c, 503);
+            conn_write(c, SHED_RESPONSE, strlen(SHED_RESPONSE));
+            conn_set_close(c);
+        }
+    } else {
+        // Serve every complete request that is already buffered, in order, so
+        // pipelined requests share one dispatch and their responses one flush
+        uint64_t start = c->queued_at;
+        do {
+            c->out_bytes = 0;
+            c->status = 0;
+            c->first_byte_at = 0;
+            c->reactor->handler(c);
+            if (c->reactor->log != NULL) {
+                start = conn_log(c, start);
+            }
+            conn_next_request(c);
+            __atomic_fetch_add(&c->reactor->requests, 1, __ATOMIC_RELAXED);
+        } while (!c->close_after && !c->error && c->stream == NULL && conn_has_request(c));
+    }
+
+    // Most responses fit in the socket buffer; try to send them right away.
+    // The io_uring loop batches the send with everything else instead.
+    if (c->reactor->uring == NULL && !c->error && conn_flush(c) < 0) {
+        c->error = true;
+    }
+    reactor_handback(c->reactor, c);
+    return NULL;
+}
+
+static void conn_dispatch(struct connection *c) {
+    struct admission *adm = c->reactor->admission;
+
+    if (adm != NULL && !admission_enqueue(adm)) {
+        conn_shed(c);
+        return;
+    }
+    c->arrived_at = c->served ? c->request_since : c->idle_since;
+    c->queued_at = now_ns();
+    thread_pool_execute(c->reactor->pool, conn_serve, c);
+}
+
+/**************************
+ * Event loop side
+ **************************/
+
+// Decide what to do with a connection after new request bytes arrived.
+static void conn_on_input(struct connection *c) {
+    if (conn_has_request(c)) {
+        conn_dispatch(c);
+    } else if (c->peer_closed) {
+        conn_close(c);
+    } else if (c->buf_len == CONN_BUFSIZE) {
+        if (memchr(c->buf, '\n', c->buf_len)) {
+            conn_reject(c, 400, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        } else {
+            conn_reject(c, 414, "HTTP/1.1 414 Request-URI Too Long\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        }
+    } else {
+        conn_arm(c, EPOLLIN);
+    }
+}
+
+static bool conn_alloc_buf(struct connection *c) {
+    if (c->buf == NULL) {
+        c->buf = malloc(CONN_BUFSIZE);
+    }
+    return c->buf != NULL;
+}
+
+static void conn_on_readable(struct connection *c) {
+    if (!conn_alloc_buf(c)) {
+        conn_close(c);
+        return;
+    }
+
+    if (c->buf_len == 0) {
+        c->request_since = now_ns();
+    }
+
+    // Edge-triggered: read until the kernel has nothing more for us
+    while (c->buf_len < CONN_BUFSIZE) {
+        count_syscall(c->reactor);
+        ssize_t n = read(c->fd, c->buf + c->buf_len, CONN_BUFSIZE - c->buf_len);
+        if (n > 0) {
+            c->buf_len += n;
+        } else if (n == 0) {
+            c->peer_closed = true;
+            break;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            conn_close(c);
+            return;
+        }
+    }
+    conn_on_input(c);
+}
+
+static void conn_on_writable(struct connection *c) {
+    int rc = conn_flush(c);
+
+    if (rc < 0) {
+        conn_close(c);
+    } else if (rc == 0) {
+        conn_arm(c, EPOLLOUT);
+    } else {
+        conn_resume(c);
+    }
+}
+
+static void reactor_accept(struct reactor *r) {
+    while (1) {
+        count_syscall(r);
+        int fd = accept4(r->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "Error accepting connection: %s\n", strerror(errno));
+                __atomic_store_n(&r->accept_errors, r->accept_errors + 1, __ATOMIC_RELAXED);
+            }
+            return;
+        }
+
+        struct connection *c = conn_new(r, fd);
+        if (c == NULL) {
+            close(fd);
+            __atomic_store_n(&r->accept_errors, r->accept_errors + 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        __atomic_store_n(&r->accepted, r->accepted + 1, __ATOMIC_RELAXED);
+        conn_arm(c, EPOLLIN);
+    }
+}
+
+// Queue ev on every stream subscribed to its channel that is due for it
+static void reactor_deliver(struct reactor *r, struct event *ev) {
+    int id = ev->ch->id;
+    struct list_elem *e, *next;
+
+    for (e = list_begin(&r->streams); e != list_end(&r->streams); e = next) {
+        struct stream *s = list_entry(e, struct stream, elem);
+        struct connection *c = s->c;
+
+        next = list_next(e);    /* c may be closed below */
+        if (!(s->channels & (1U << id)) || s->seen[id]++ % s->every[id] != 0) {
+            continue;
+        }
+        // A subscriber still sending an earlier event skips this one, so a
+        // slow reader holds at most one event and gets the latest next
+        if (!list_empty(&c->out)) {
+            continue;
+        }
+        __atomic_fetch_add(&ev->refs, 1, __ATOMIC_RELAXED);
+        conn_write_ref(c, ev->data, ev->len, event_put, ev);
+        if (c->error) {
+            conn_close(c);
+            continue;
+        }
+        if (r->uring) {
+            conn_arm(c, EPOLLOUT);
+            continue;
+        }
+        int rc = conn_flush(c);
+        if (rc < 0) {
+            conn_close(c);
+        } else if (rc == 0) {
+            conn_arm(c, EPOLLOUT);
+        }
+    }
+}
+
+static void reactor_drain_done(struct reactor *r) {
+    struct list done, events;
+
+    list_init(&done);
+    list_init(&events);
+    pthread_mutex_lock(&r->done_mutex);
+    if (!list_empty(&r->done_list)) {
+        list_splice(list_end(&done), list_front(&r->done_list), list_end(&r->done_list));
+    }
+    if (!list_empty(&r->event_list)) {
+        list_splice(list_end(&events), list_front(&r->event_list), list_end(&r->event_list));
+    }
+    pthread_mutex_unlock(&r->done_mutex);
+
+    while (!list_empty(&done)) {
+        conn_resume(list_entry(list_pop_front(&done), struct connection, elem));
+    }
+    while (!list_empty(&events)) {
+        struct event_post *p = list_entry(list_pop_front(&events), struct event_post, elem);
+
+        reactor_deliver(r, p->ev);
+        event_put(p->ev);
+        free(p);
+    }
+}
+
+// Close every connection whose deadline has passed.  One clock read and a
+// walk of the due slots per loop iteration, whatever the number of connections.
+static void reactor_expire(struct reactor *r) {
+    struct list expired;
+
+    if (r->wheel.count == 0) {
+        return;
+    }
+    list_init(&expired);
+    timewheel_advance(&r->wheel, now_ns(), &expired);
+
+    while (!list_empty(&expired)) {
+        struct connection *c = list_entry(list_pop_front(&expired), struct connection, timer.elem);
+
+        __atomic_store_n(&r->expired, r->expired + 1, __ATOMIC_RELAXED);
+        if (c->want == EPOLLOUT) {
+            // Nobody is reading the rest of the response; reset rather than
+            // leave the kernel trickling out what is still in the send buffer
+            struct linger lin = { 1, 0 };
+            count_syscall(r);
+            setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+        }
+        if (r->uring) {
+            // The recv or sendmsg in flight still points at c; shutting the
+            // socket down completes it, and its completion closes c
+            count_syscall(r);
+            shutdown(c->fd, SHUT_RDWR);
+        } else {
+            conn_close(c);
+        }
+    }
+}
+
+/**************************
+ * io_uring backend
+ **************************/
+
+static void uring_recv(struct connection *c) {
+    struct uring_backend *ub = c->reactor->uring;
+    struct io_uring_sqe *sqe;
+
+    if (!conn_alloc_buf(c)) {
+        conn_close(c);
+        return;
+    }
+    // Never receive more than still fits, so nothing is lost
+    sqe = uring_get_sqe(&ub->ring);
+    uring_prep_recv_select(sqe, c->fd, URING_BGID, CONN_BUFSIZE - c->buf_len);
+    sqe->user_data = (uintptr_t)c;
+}
+
+// A file chunk goes file -> pipe -> socket with two splices, so its bytes
+// never pass through user space; the pipe stays with the connection.
+static void uring_splice(struct connection *c, struct out_chunk *ch) {
+    struct uring_backend *ub = c->reactor->uring;
+    struct io_uring_sqe *sqe;
+
+    if (c->pipe[0] < 0) {
+        count_syscall(c->reactor);
+        if (pipe2(c->pipe, O_CLOEXEC) < 0) {
+            conn_close(c);
+            return;
+        }
+        // A bigger pipe means fewer round trips; the default works too
+        count_syscall(c->reactor);
+        fcntl(c->pipe[1], F_SETPIPE_SZ, URING_PIPESZ);
+    }
+
+    sqe = uring_get_sqe(&ub->ring);
+    if (c->piped == 0) {
+        size_t n = ch->len - ch->off;
+        uring_prep_splice(sqe, ch->fd, ch->pos + ch->off, c->pipe[1], -1,
+                          n < URING_SPLICE ? n : URING_SPLICE);
+        sqe->user_data = (uintptr_t)c | UD_SPLICE;
+    } else {
+        uring_prep_splice(sqe, c->pipe[0], -1, c->fd, -1, c->piped);
+        sqe->user_data = (uintptr_t)c | UD_SEND;
+    }
+}
+
+// One sendmsg gathers up to OUT_IOV queued chunks
+static void uring_send(struct connection *c) {
+    struct uring_backend *ub = c->reactor->uring;
+    struct out_chunk *ch = list_entry(list_front(&c->out), struct out_chunk, elem);
+    struct io_uring_sqe *sqe;
+    size_t total;
+    bool more;
+
+    if (ch->fd >= 0) {
+        uring_splice(c, ch);
+        return;
+    }
+    if (c->send == NULL && (c->send = calloc(1, sizeof(*c->send))) == NULL) {
+        conn_close(c);
+        return;
+    }
+    c->send->msg.msg_iov = c->send->iov;
+    c->send->msg.msg_iovlen = conn_fill_iov(c, c->send->iov, OUT_IOV, &total, &more);
+
+    sqe = uring_get_sqe(&ub->ring);
+    uring_prep_sendmsg(sqe, c->fd, &c->send->msg, more ? MSG_MORE : 0);
+    sqe->user_data = (uintptr_t)c | UD_SEND;
+}
+
+static void uring_on_recv(struct connection *c, int res, unsigned flags) {
+    struct uring_backend *ub = c->reactor->uring;
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0) {
+            if (c->buf_len == 0) {
+                c->request_since = now_ns();
+            }
+            memcpy(c->buf + c->buf_len, uring_buf(&ub->bufs, bid), res);
+            c->buf_len += res;
+        }
+        uring_buf_recycle(&ub->bufs, bid);
+    }
+
+    if (res == 0) {
+        c->peer_closed = true;
+    } else if (res == -ENOBUFS || res == -EINTR || res == -EAGAIN) {
+        conn_arm(c, EPOLLIN);
+        return;
+    } else if (res < 0) {
+        conn_close(c);
+        return;
+    }
+    conn_on_input(c);
+}
+
+static void uring_on_send(struct connection *c, int res) {
+    if (res == -EINTR || res == -EAGAIN) {
+        conn_arm(c, EPOLLOUT);
+        return;
+    }
+    if (res < 0) {
+        conn_close(c);
+        return;
+    }
+    if (list_entry(list_front(&c->out), struct out_chunk, elem)->fd >= 0) {
+        c->piped -= res;        /* that was the splice out of the pipe */
+    }
+    conn_consume(c, res);
+    if (!list_empty(&c->out)) {
+        conn_arm(c, EPOLLOUT);
+        return;
+    }
+    free(c->send);
+    c->send = NULL;
+    conn_resume(c);
+}
+
+static void uring_on_splice(struct connection *c, int res) {
+    if (res == -EINTR || res == -EAGAIN) {
+        conn_arm(c, EPOLLOUT);
+        return;
+    }
+    if (res <= 0) {
+        conn_close(c);          /* an error, or the file shrank under us */
+        return;
+    }
+    c->piped = res;
+    conn_arm(c, EPOLLOUT);
+}
+
+static void uring_submit_accept(struct reactor *r) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&r->uring->ring);
+
+    uring_prep_accept_multishot(sqe, r->listenfd, SOCK_CLOEXEC);
+    sqe->user_data = UD_ACCEPT;
+}
+
+static void uring_submit_wake(struct reactor *r) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&r->uring->ring);
+
+    uring_prep_read(sqe, r->wakefd, &r->uring->wake_count, sizeof(r->uring->wake_count));
+    sqe->user_data = UD_WAKE;
+}
+
+static void uring_on_accept(struct reactor *r, int res, unsigned flags) {
+    // A multishot accept keeps going until the kernel drops IORING_CQE_F_MORE
+    if (!(flags & IORING_CQE_F_MORE)) {
+        uring_submit_accept(r);
+    }
+    if (res < 0) {
+        if (res != -EINTR && res != -ECONNABORTED) {
+            fprintf(stderr, "Error accepting connection: %s\n", strerror(-res));
+            __atomic_store_n(&r->accept_errors, r->accept_errors + 1, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+
+    struct connection *c = conn_new(r, res);
+    if (c == NULL) {
+        close(res);
+        __atomic_store_n(&r->accept_errors, r->accept_errors + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_store_n(&r->accepted, r->accepted + 1, __ATOMIC_RELAXED);
+    conn_arm(c, EPOLLIN);
+}
+
+static void reactor_run_uring(struct reactor *r) {
+    struct uring *u = &r->uring->ring;
+    struct io_uring_cqe *cqe;
+
+    uring_submit_accept(r);
+    uring_submit_wake(r);
+
+    while (1) {
+        // A timeout request wakes the loop for the next tick of the wheel
+        int timeout_ms = timewheel_timeout_ms(&r->wheel, now_ns());
+        if (timeout_ms >= 0 && !r->uring->tick_pending) {
+            struct io_uring_sqe *sqe = uring_get_sqe(u);
+            r->uring->tick.tv_sec = timeout_ms / 1000;
+            r->uring->tick.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            uring_prep_timeout(sqe, &r->uring->tick);
+            sqe->user_data = UD_TICK;
+            r->uring->tick_pending = true;
+        }
+
+        // Everything queued since the last round goes in with this one call
+        count_syscall(r);
+        int rc = uring_submit_and_wait(u, 1);
+        if (rc < 0 && rc != -EINTR && rc != -EBUSY) {
+            errno = -rc;
+            unix_error("io_uring_enter error");
+        }
+
+        while ((cqe = uring_peek_cqe(u)) != NULL) {
+            uint64_t ud = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+
+            uring_cqe_seen(u);
+            if (ud == UD_ACCEPT) {
+                uring_on_accept(r, res, flags);
+            } else if (ud == UD_WAKE) {
+                reactor_drain_done(r);
+                uring_submit_wake(r);
+            } else if (ud == UD_TICK) {
+                r->uring->tick_pending = false;
+            } else if (ud & UD_SEND) {
+                struct connection *c = (struct connection *)(uintptr_t)(ud & ~UD_SEND);
+                timewheel_del(&r->wheel, &c->timer);
+                uring_on_send(c, res);
+            } else if (ud & UD_SPLICE) {
+                struct connection *c = (struct connection *)(uintptr_t)(ud & ~UD_SPLICE);
+                timewheel_del(&r->wheel, &c->timer);
+                uring_on_splice(c, res);
+            } else {
+                struct connection *c = (struct connection *)(uintptr_t)ud;
+                timewheel_del(&r->wheel, &c->timer);
+                uring_on_recv(c, res, flags);
+            }
+        }
+        reactor_expire(r);
+    }
+}
+
+static struct uring_backend *uring_backend_new(void) {
+    struct uring_backend *ub;
+    int rc;
+
+    if (!uring_supported()) {
+        fprintf(stderr, "io_uring is not supported by this kernel, using epoll\n");
+        return NULL;
+    }
+    if ((ub = calloc(1, sizeof(*ub))) == NULL) {
+        return NULL;
+    }
+    if ((rc = uring_init(&ub->ring, URING_ENTRIES, 4 * URING_ENTRIES)) < 0) {
+        fprintf(stderr, "io_uring setup failed (%s), using epoll\n", strerror(-rc));
+        free(ub);
+        return NULL;
+    }
+    if ((rc = uring_bufring_init(&ub->ring, &ub->bufs, URING_BGID, URING_NBUFS, URING_BUFSZ)) < 0) {
+        fprintf(stderr, "io_uring setup failed (%s), using epoll\n", strerror(-rc));
+        uring_exit(&ub->ring);
+        free(ub);
+        return NULL;
+    }
+    return ub;
+}
+
+struct reactor *reactor_new(int listenfd, struct thread_pool *pool, request_handler_t handler, int flags) {
+    struct reactor *r = malloc(sizeof(*r));
+    struct epoll_event ev;
+
+    if (r == NULL) {
+        unix_error("reactor_new malloc error");
+    }
+    r->listenfd = listenfd;
+    r->pool = pool;
+    r->handler = handler;
+    r->admission = NULL;
+    r->log = NULL;
+    r->cpu = -1;
+    r->accepted = 0;
+    r->accept_errors = 0;
+    r->closed = 0;
+    r->requests = 0;
+    r->syscalls = 0;
+    r->expired = 0;
+    memset(&r->timeouts, 0, sizeof(r->timeouts));
+    timewheel_init(&r->wheel, now_ns());
+    pthread_mutex_init(&r->done_mutex, NULL);
+    list_init(&r->done_list);
+    list_init(&r->event_list);
+    list_init(&r->streams);
+    r->nstreams = 0;
+
+    pthread_mutex_lock(&reactors_lock);
+    r->next = reactors;
+    __atomic_store_n(&reactors, r, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&reactors_lock);
+
+    if ((r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        unix_error("eventfd error");
+    }
+
+    r->uring = (flags & REACTOR_URING) ? uring_backend_new() : NULL;
+    if (r->uring) {
+        r->epfd = -1;
+        return r;
+    }
+
+    if ((r->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        unix_error("epoll_create1 error");
+    }
+    if (fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK) < 0) {
+        unix_error("fcntl error");
+    }
+
+    // The two internal descriptors are told apart by pointing at their fields
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &r->listenfd;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0) {
+        unix_error("epoll_ctl error");
+    }
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &r->wakefd;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev) < 0) {
+        unix_error("epoll_ctl error");
+    }
+    return r;
+}
+
+void reactor_run(struct reactor *r) {
+    struct epoll_event events[MAXEVENTS];
+
+    if (r->uring) {
+        reactor_run_uring(r);
+        return;
+    }
+
+    while (1) {
+        count_syscall(r);
+        int n = epoll_wait(r->epfd, events, MAXEVENTS, timewheel_timeout_ms(&r->wheel, now_ns()));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            unix_error("epoll_wait error");
+        }
+
+        int i;
+        for (i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == &r->listenfd) {
+                reactor_accept(r);
+            } else if (ptr == &r->wakefd) {
+                uint64_t count;
+                count_syscall(r);
+                if (read(r->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    fprintf(stderr, "reactor wakeup read failed: %s\n", strerror(errno));
+                }
+                reactor_drain_done(r);
+            } else {
+                struct connection *c = ptr;
+                timewheel_del(&r->wheel, &c->timer);
+                if (c->want == EPOLLOUT) {
+                    conn_on_writable(c);
+                } else {
+                    conn_on_readable(c);
+                }
+            }
+        }
+        reactor_expire(r);
+    }
+}
+
+static void *reactor_thread(void *data) {
+    reactor_run(data);
+    return NULL;
+}
+
+void reactor_start(struct reactor *r, int cpu) {
+    cpu_set_t cpus;
+
+    r->cpu = cpu;
+    if (pthread_create(&r->tid, NULL, reactor_thread, r) != 0) {
+        unix_error("pthread_create error");
+    }
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(r->tid, sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "could not pin event loop to cpu %d\n", cpu);
+        r->cpu = -1;
+    }
+}
+
+void reactor_set_admission(struct reactor *r, struct admission *a) {
+    r->admission = a;
+}
+
+void reactor_set_access_log(struct reactor *r, struct access_log *log) {
+    r->log = log;
+}
+
+void reactor_set_timeouts(struct reactor *r, const struct reactor_timeouts *t) {
+    r->timeouts = *t;
+}
+
+void reactor_get_stats(struct reactor *r, struct reactor_stats *st) {
+    st->cpu = r->cpu;
+    st->accepted = __atomic_load_n(&r->accepted, __ATOMIC_RELAXED);
+    st->accept_errors = __atomic_load_n(&r->accept_errors, __ATOMIC_RELAXED);
+    st->closed = __atomic_load_n(&r->closed, __ATOMIC_RELAXED);
+    st->requests = __atomic_load_n(&r->requests, __ATOMIC_RELAXED);
+    st->syscalls = __atomic_load_n(&r->syscalls, __ATOMIC_RELAXED);
+    st->timeouts = __atomic_load_n(&r->expired, __ATOMIC_RELAXED);
+    st->streams = __atomic_load_n(&r->nstreams, __ATOMIC_RELAXED);
+    st->uring = r->uring != NULL;
+}
+
+/**************************
+ * Handler-facing I/O
+ **************************/
+
+const struct http_request *conn_request(struct connection *c, char **buf) {
+    *buf = c->buf + c->buf_pos;
+    return &c->parser.req;
+}
+
+int conn_status(struct connection *c) {
+    return c->status;
+}
+
+void conn_set_status(struct connection *c, int status) {
+    if (c->status == 0) {
+        c->first_byte_at = now_ns();
+    }
+    c->status = status;
+}
+
+uint64_t conn_bytes_queued(struct connection *c) {
+    return c->out_bytes;
+}
+
+void conn_get_times(struct connection *c, struct conn_times *t) {
+    t->arrived = c->arrived_at;
+    t->dispatched = c->queued_at;
+    t->first_byte = c->first_byte_at;
+}
+
+// Out of memory while queueing: a response with a piece missing must not
+// go out, so the connection is closed instead as soon as we own it
+void conn_write(struct connection *c, const void *buf, size_t n) {
+    struct out_chunk *ch = NULL;
+
+    if (n == 0 || c->error) {
+        return;
+    }
+    if (!list_empty(&c->out)) {
+        ch = list_entry(list_back(&c->out), struct out_chunk, elem);
+        if (ch->cap == 0 || ch->cap - ch->len < n) {
+            ch = NULL;
+        }
+    }
+    if (ch == NULL) {
+        size_t cap = n > CHUNK_MIN ? n : CHUNK_MIN;
+
+        if ((ch = malloc(sizeof(*ch))) == NULL || (ch->data = malloc(cap)) == NULL) {
+            free(ch);
+            c->error = true;
+            return;
+        }
+        ch->cap = cap;
+        ch->len = 0;
+        ch->off = 0;
+        ch->fd = -1;
+        ch->release = NULL;
+        list_push_back(&c->out, &ch->elem);
+    }
+    memcpy(ch->data + ch->len, buf, n);
+    ch->len += n;
+    c->out_bytes += n;
+}
+
+void conn_write_ref(struct connection *c, const void *buf, size_t n, void (*release)(void *), void *arg) {
+    struct out_chunk *ch;
+
+    // What the chunk would have owned is let go of as chunk_free would
+    if (c->error || (ch = malloc(sizeof(*ch))) == NULL) {
+        c->error = true;
+        if (release != NULL) {
+            release(arg);
+        } else {
+            free((void *)buf);
+        }
+        return;
+    }
+    c->out_bytes += n;
+    ch->data = (char *)buf;
+    ch->len = n;
+    ch->cap = 0;
+    ch->off = 0;
+    ch->fd = -1;
+    ch->release = release;
+    ch->arg = arg;
+    list_push_back(&c->out, &ch->elem);
+}
+
+void conn_write_file(struct connection *c, int fd, off_t pos, size_t n, void (*release)(void *), void *arg) {
+    struct out_chunk *ch;
+
+    if (c->error || (ch = malloc(sizeof(*ch))) == NULL) {
+        c->error = true;
+        if (release != NULL) {
+            release(arg);
+        } else {
+            close(fd);
+        }
+        return;
+    }
+    c->out_bytes += n;
+    ch->data = NULL;
+    ch->len = n;
+    ch->cap = 0;
+    ch->off = 0;
+    ch->fd = fd;
+    ch->pos = pos;
+    ch->release = release;
+    ch->arg = arg;
+    list_push_back(&c->out, &ch->elem);
+}
+
+void conn_set_close(struct connection *c) {
+    c->close_after = true;
+}
+
+/**************************
+ * Channels
+ **************************/
+
+struct channel *channel_new(void) {
+    int id = __atomic_fetch_add(&nchannels, 1, __ATOMIC_RELAXED);
+
+    if (id >= CHANNEL_MAX) {
+        fprintf(stderr, "more than %d channels\n", CHANNEL_MAX);
+        exit(1);
+    }
+    channels[id].id = id;
+    return &channels[id];
+}
+
+bool channel_has_subscribers(struct channel *ch) {
+    return __atomic_load_n(&ch->subscribers, __ATOMIC_RELAXED) != 0;
+}
+
+void channel_publish(struct channel *ch, const void *data, size_t len, void (*release)(void *), void *arg) {
+    struct event *ev = malloc(sizeof(*ev));
+    struct reactor *r;
+
+    if (ev == NULL) {
+        release(arg);
+        return;
+    }
+    ev->ch = ch;
+    ev->data = data;
+    ev->len = len;
+    ev->release = release;
+    ev->arg = arg;
+    ev->refs = 1;
+
+    // Each loop with streams gets a reference and walks its own subscribers
+    for (r = __atomic_load_n(&reactors, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+        struct event_post *p;
+
+        if (__atomic_load_n(&r->nstreams, __ATOMIC_RELAXED) == 0 || (p = malloc(sizeof(*p))) == NULL) {
+            continue;
+        }
+        p->ev = ev;
+        __atomic_fetch_add(&ev->refs, 1, __ATOMIC_RELAXED);
+        reactor_post(r, &r->event_list, &p->elem);
+    }
+    event_put(ev);
+}
+
+void conn_subscribe(struct connection *c, struct channel *ch, unsigned every) {
+    if (c->stream == NULL) {
+        if ((c->stream = calloc(1, sizeof(*c->stream))) == NULL) {
+            c->error = true;
+            return;
+        }
+        c->stream->c = c;
+    }
+    if (!(c->stream->channels & (1U << ch->id))) {
+        c->stream->channels |= 1U << ch->id;
+        __atomic_fetch_add(&ch->subscribers, 1, __ATOMIC_RELAXED);
+    }
+    c->stream->every[ch->id] = every > 0 ? every : 1;
+}
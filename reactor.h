@@ -0,0 +1,167 @@
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "httpparse.h"
+
+/*
+ * reactor.h
+ *
+ * An edge-triggered epoll event loop that owns every client socket.
+ * Idle connections cost only a small struct; a connection is handed to
+ * the thread pool only once a complete request head has been buffered,
+ * and responses are written without blocking, resuming on EPOLLOUT.
+ */
+
+/* Largest request head (request line plus headers) we buffer per connection */
+#define CONN_BUFSIZE 8192
+
+struct thread_pool;
+struct admission;
+struct access_log;
+struct reactor;
+struct connection;
+
+/*
+ * Called on a pool thread with exclusive ownership of c once a complete
+ * request head is buffered and parsed.  The handler looks at the request
+ * with conn_request() and queues the response with conn_write*().  It is called
+ * again for each further pipelined request already buffered, unless it set
+ * conn_set_close(), and the responses are flushed together afterwards.
+ */
+typedef void (*request_handler_t)(struct connection *c);
+
+/* Per-event-loop counters, used to check that SO_REUSEPORT shards are balanced */
+struct reactor_stats {
+    int cpu;                    /* core the loop is pinned to, -1 if not pinned */
+    unsigned long accepted;     /* connections accepted */
+    unsigned long accept_errors; /* accept() failures, and connections dropped for want of memory */
+    unsigned long closed;       /* connections closed */
+    unsigned long requests;     /* requests served */
+    unsigned long syscalls;     /* socket, epoll and io_uring system calls made */
+    unsigned long timeouts;     /* connections closed by a timeout */
+    unsigned long streams;      /* connections subscribed to channels */
+    bool uring;                 /* running on the io_uring backend */
+};
+
+/*
+ * How long the loop waits on a connection, in milliseconds, 0 for no limit.
+ * The header limit runs from the first byte of a request, so trickling a
+ * byte at a time does not extend it; the write limit restarts whenever
+ * the peer takes some of the response.
+ */
+struct reactor_timeouts {
+    unsigned first_byte_ms;     /* accept to the first request byte */
+    unsigned header_ms;         /* first byte to a complete request head */
+    unsigned idle_ms;           /* keep-alive: response sent to the next request */
+    unsigned write_ms;          /* queued response the peer is not reading */
+};
+
+/* reactor_new flags */
+#define REACTOR_URING 1         /* use io_uring if the kernel supports it, else epoll */
+
+/* Create an event loop accepting on listenfd and serving requests on pool */
+struct reactor *reactor_new(int listenfd, struct thread_pool *pool, request_handler_t handler, int flags);
+
+/* Run the event loop in the calling thread.  Does not return. */
+void reactor_run(struct reactor *r);
+
+/* Run the event loop on a new thread pinned to cpu */
+void reactor_start(struct reactor *r, int cpu);
+
+/* Put admission control in front of the pool; call before the loop runs */
+void reactor_set_admission(struct reactor *r, struct admission *a);
+
+/* Log every request served to log; call before the loop runs */
+void reactor_set_access_log(struct reactor *r, struct access_log *log);
+
+/* Set the connection timeouts; call before the loop runs */
+void reactor_set_timeouts(struct reactor *r, const struct reactor_timeouts *t);
+
+/* Snapshot the counters of r; safe to call from any thread */
+void reactor_get_stats(struct reactor *r, struct reactor_stats *st);
+
+/*
+ * The request being served, parsed in place; *buf is what its views are
+ * relative to (see http_str).  Valid until the handler returns.
+ */
+const struct http_request *conn_request(struct connection *c, char **buf);
+
+/* The status of the response queued for the request being served, 0 until there is one */
+int conn_status(struct connection *c);
+
+/*
+ * Record the status of the response being queued, for the access log and
+ * the counters; the reply builder does it with every head it queues
+ */
+void conn_set_status(struct connection *c, int status);
+
+/* Bytes queued for the request being served so far, head and body */
+uint64_t conn_bytes_queued(struct connection *c);
+
+/*
+ * When the request being served arrived, was handed to the pool and had
+ * its status line queued, in now_ns() time.  A connection's first request
+ * arrives when it is accepted, later ones with their first byte; requests
+ * pipelined together share both times.  first_byte is 0 until then.
+ */
+struct conn_times {
+    uint64_t arrived;
+    uint64_t dispatched;
+    uint64_t first_byte;
+};
+
+void conn_get_times(struct connection *c, struct conn_times *t);
+
+/*
+ * Queue a copy of buf for sending.  If memory runs out, this and the
+ * conn_write_* functions below queue nothing more and the connection is
+ * closed once the handler returns; what they were given is still released.
+ */
+void conn_write(struct connection *c, const void *buf, size_t n);
+
+/* Queue buf for sending without copying it; release(arg) is called once it is sent */
+void conn_write_ref(struct connection *c, const void *buf, size_t n, void (*release)(void *), void *arg);
+
+/*
+ * Queue n bytes of file fd from pos for sending without copying.  Once they
+ * are sent, or the connection is closed, release(arg) is called, or fd is
+ * closed if release is NULL.  fd is never read through its file position.
+ */
+void conn_write_file(struct connection *c, int fd, off_t pos, size_t n, void (*release)(void *), void *arg);
+
+/* Close the connection once everything queued so far has been sent */
+void conn_set_close(struct connection *c);
+
+/*
+ * Channels, for server-sent events.  A handler that calls conn_subscribe()
+ * turns c into a stream: once its response head is out, c reads no more
+ * requests and is sent every event published to the channels it is
+ * subscribed to, until the peer goes away.  An event is queued on every
+ * subscriber by reference, so it is encoded once however many there are.
+ */
+#define CHANNEL_MAX 32          /* channels in the whole server */
+
+struct channel;
+
+/* A new channel; there can be at most CHANNEL_MAX */
+struct channel *channel_new(void);
+
+/* Is any connection subscribed to ch?  Lets a publisher skip encoding */
+bool channel_has_subscribers(struct channel *ch);
+
+/*
+ * Send len bytes at data to the subscribers of ch, from their event loops;
+ * release(arg) is called once all of them are done with it.  A subscriber
+ * still sending an earlier event skips this one.
+ */
+void channel_publish(struct channel *ch, const void *data, size_t len, void (*release)(void *), void *arg);
+
+/* Subscribe c to every nth event published to ch */
+void conn_subscribe(struct connection *c, struct channel *ch, unsigned every);
+
+#endif /* __REACTOR_H__ */
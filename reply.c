@@ -0,0 +1,103 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reply.h"
+
+// The Date line of the current second, per thread so nothing locks
+static __thread time_t date_second;
+static __thread char date_line[64];
+static __thread size_t date_len;
+
+static const char *date_header(size_t *len) {
+    time_t now = time(NULL);
+
+    if (now != date_second || date_len == 0) {
+        char date[40];
+
+        http_date(now, date, sizeof(date));
+        date_len = snprintf(date_line, sizeof(date_line), "Date: %s\r\n", date);
+        date_second = now;
+    }
+    *len = date_len;
+    return date_line;
+}
+
+void http_date(time_t t, char *buf, size_t len) {
+    struct tm tm;
+
+    strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&t, &tm));
+}
+
+void reply_start(struct reply *rp, const char *version, const char *status, bool date) {
+    rp->status = atoi(status);
+    rp->len = 0;
+    reply_header(rp, "%.32s %s", version, status);
+    if (date) {
+        size_t n;
+        const char *line = date_header(&n);
+        memcpy(rp->head + rp->len, line, n);
+        rp->len += n;
+    }
+    reply_header(rp, "Server: Sysstatd Web Server");
+}
+
+void reply_header(struct reply *rp, const char *fmt, ...) {
+    size_t room = sizeof(rp->head) - rp->len - 2;   /* keep room for the empty line */
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(rp->head + rp->len, room, fmt, ap);
+    va_end(ap);
+
+    // A header that does not fit is left out rather than cut
+    if (n < 0 || n + 2 > room) {
+        return;
+    }
+    rp->len += n;
+    memcpy(rp->head + rp->len, "\r\n", 2);
+    rp->len += 2;
+}
+
+void reply_finish(struct reply *rp) {
+    memcpy(rp->head + rp->len, "\r\n", 2);
+    rp->len += 2;
+}
+
+void reply_write_head(struct reply *rp, struct connection *c) {
+    conn_set_status(c, rp->status);
+    conn_write(c, rp->head, rp->len);
+}
+
+void reply_send(struct reply *rp, struct connection *c, const void *body, size_t len) {
+    reply_finish(rp);
+    reply_write_head(rp, c);
+    conn_write(c, body, len);
+}
+
+void reply_send_ref(struct reply *rp, struct connection *c, const void *body, size_t len,
+                    void (*release)(void *), void *arg) {
+    reply_finish(rp);
+    reply_write_head(rp, c);
+    conn_write_ref(c, body, len, release, arg);
+}
+
+void reply_send_stored(struct connection *c, const char *data, size_t len, void (*release)(void *), void *arg) {
+    const char *eol = memchr(data, '\n', len);
+    size_t first = eol ? eol - data + 1 : 0;
+    const char *code = memchr(data, ' ', first);
+    size_t n;
+    const char *date = date_header(&n);
+
+    conn_set_status(c, code != NULL ? atoi(code + 1) : 0);
+    // Status line and Date are copied, the rest goes out from where it is
+    conn_write(c, data, first);
+    conn_write(c, date, n);
+    if (release != NULL) {
+        conn_write_ref(c, data + first, len - first, release, arg);
+    } else {
+        conn_write(c, data + first, len - first);
+    }
+}
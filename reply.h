@@ -0,0 +1,67 @@
+#ifndef __REPLY_H__
+#define __REPLY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "reactor.h"
+
+/*
+ * reply.h
+ *
+ * Response heads built in one buffer: the status line, Date and Server,
+ * then whatever headers the caller adds.  The head and the body are queued
+ * on the connection together, so the event loop sends them with a single
+ * sendmsg, and a body is never copied into a fixed size buffer first.
+ * The Date line is formatted at most once a second per thread.
+ */
+
+#define REPLY_HEAD_MAX 4096
+
+struct reply {
+    int status;                 /* the code in the status line */
+    size_t len;
+    char head[REPLY_HEAD_MAX];
+};
+
+/*
+ * Start a head with "version status", status being the code and reason
+ * phrase.  A head that is stored to be sent again later is built without
+ * Date; reply_send_stored adds it when sent.
+ */
+void reply_start(struct reply *rp, const char *version, const char *status, bool date);
+
+/* Add one header line, printf style, without the line end */
+void reply_header(struct reply *rp, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/* End the head with the empty line */
+void reply_finish(struct reply *rp);
+
+/*
+ * Queue the head as it is, for a body queued after it piece by piece,
+ * and set the connection's status from it.  The reply_send* functions
+ * below do the same.
+ */
+void reply_write_head(struct reply *rp, struct connection *c);
+
+/* Finish the head and queue it with a copy of len bytes of body */
+void reply_send(struct reply *rp, struct connection *c, const void *body, size_t len);
+
+/* Finish the head and queue it with body, uncopied; release(arg) once sent */
+void reply_send_ref(struct reply *rp, struct connection *c, const void *body, size_t len,
+                    void (*release)(void *), void *arg);
+
+/*
+ * Queue a complete response built without Date, putting the current Date
+ * after its status line.  The rest is queued uncopied and release(arg) is
+ * called once it is sent, or it is copied if release is NULL.  The status
+ * is read back from the status line, which reply_start wrote with one of
+ * our own versions.
+ */
+void reply_send_stored(struct connection *c, const char *data, size_t len, void (*release)(void *), void *arg);
+
+/* IMF-fixdate, as in Date, Last-Modified and If-Range */
+void http_date(time_t t, char *buf, size_t len);
+
+#endif /* __REPLY_H__ */
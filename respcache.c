@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "rio.h"
+#include "timewheel.h"
+#include "respcache.h"
+
+#define BUCKETS 64              /* hash chains per stripe */
+
+struct stripe {
+    pthread_mutex_t lock;
+    struct list buckets[BUCKETS];
+    struct list lru;
+    size_t bytes;
+    unsigned long entries;
+};
+
+struct respcache {
+    size_t budget;
+    size_t stripe_budget;
+    uint64_t ttl_ns;
+    struct stripe stripes[RESPCACHE_STRIPES];
+
+    uint64_t generation;        /* bumped by every invalidation */
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+};
+
+// FNV-1a, as in the file cache
+static uint32_t hash_key(const char *key) {
+    uint32_t h = 2166136261u;
+
+    while (*key) {
+        h = (h ^ (unsigned char)*key++) * 16777619u;
+    }
+    return h;
+}
+
+static struct stripe *stripe_of(struct respcache *rc, uint32_t hash) {
+    return &rc->stripes[hash % RESPCACHE_STRIPES];
+}
+
+static struct list *bucket_of(struct stripe *s, uint32_t hash) {
+    return &s->buckets[(hash / RESPCACHE_STRIPES) % BUCKETS];
+}
+
+static struct response *stripe_find(struct stripe *s, uint32_t hash, const char *key) {
+    struct list *b = bucket_of(s, hash);
+    struct list_elem *e;
+
+    for (e = list_begin(b); e != list_end(b); e = list_next(e)) {
+        struct response *r = list_entry(e, struct response, elem);
+        if (r->hash == hash && strcmp(r->key, key) == 0) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+// Take r out of its stripe; the caller holds the lock and drops the table's reference
+static void stripe_remove(struct stripe *s, struct response *r) {
+    list_remove(&r->elem);
+    list_remove(&r->lru);
+    s->bytes -= r->len;
+    s->entries--;
+}
+
+void respcache_put(struct response *r) {
+    if (__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(r);
+    }
+}
+
+struct respcache *respcache_new(size_t budget, uint64_t ttl_ns) {
+    struct respcache *rc = calloc(1, sizeof(*rc));
+    int i, j;
+
+    if (rc == NULL) {
+        unix_error("respcache_new calloc error");
+    }
+    rc->budget = budget;
+    rc->stripe_budget = budget / RESPCACHE_STRIPES;
+    rc->ttl_ns = ttl_ns;
+    for (i = 0; i < RESPCACHE_STRIPES; i++) {
+        pthread_mutex_init(&rc->stripes[i].lock, NULL);
+        for (j = 0; j < BUCKETS; j++) {
+            list_init(&rc->stripes[i].buckets[j]);
+        }
+        list_init(&rc->stripes[i].lru);
+    }
+    return rc;
+}
+
+bool respcache_wants(struct respcache *rc, size_t body_len) {
+    return body_len <= RESPCACHE_MAX_BODY && respcache_fits(rc, body_len);
+}
+
+bool respcache_fits(struct respcache *rc, size_t body_len) {
+    // Anything bigger than half a stripe would empty it
+    return body_len <= rc->stripe_budget / 2;
+}
+
+uint64_t respcache_generation(struct respcache *rc) {
+    return __atomic_load_n(&rc->generation, __ATOMIC_ACQUIRE);
+}
+
+struct response *respcache_get(struct respcache *rc, const char *key) {
+    uint32_t hash = hash_key(key);
+    struct stripe *s = stripe_of(rc, hash);
+    struct response *r;
+
+    if (rc->budget == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&s->lock);
+    r = stripe_find(s, hash, key);
+    if (r != NULL && r->expires != 0 && now_ns() >= r->expires) {
+        stripe_remove(s, r);
+        __atomic_fetch_add(&rc->invalidations, 1, __ATOMIC_RELAXED);
+        respcache_put(r);
+        r = NULL;
+    }
+    if (r != NULL) {
+        list_remove(&r->lru);
+        list_push_front(&s->lru, &r->lru);
+        __atomic_fetch_add(&r->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    __atomic_fetch_add(r != NULL ? &rc->hits : &rc->misses, 1, __ATOMIC_RELAXED);
+    return r;
+}
+
+// A response with room for body_len bytes behind head, not in the table yet
+static struct response *response_new(struct respcache *rc, const char *key, const char *head,
+                                     size_t head_len, size_t body_len) {
+    size_t keylen = strlen(key);
+    struct response *r = malloc(sizeof(*r) + head_len + body_len + keylen + 1);
+
+    if (r == NULL) {
+        return NULL;
+    }
+    r->len = head_len + body_len;
+    r->data = (char *)(r + 1);
+    r->encodings = 0;
+    r->refs = 1;
+    r->expires = rc->ttl_ns ? now_ns() + rc->ttl_ns : 0;
+    r->hash = hash_key(key);
+    r->key = r->data + r->len;
+    memcpy(r->data, head, head_len);
+    memcpy(r->key, key, keylen + 1);
+    return r;
+}
+
+// Add r to the table, unless an invalidation got in since generation was read
+static struct response *response_insert(struct respcache *rc, struct response *r, uint64_t generation) {
+    struct stripe *s = stripe_of(rc, r->hash);
+    struct response *old;
+
+    pthread_mutex_lock(&s->lock);
+    if (respcache_generation(rc) != generation) {
+        // The file may have changed after it was opened; serve it, don't keep it
+        pthread_mutex_unlock(&s->lock);
+        return r;
+    }
+    if ((old = stripe_find(s, r->hash, r->key)) != NULL) {
+        stripe_remove(s, old);
+        respcache_put(old);
+    }
+    r->refs++;                  /* the table's reference */
+    list_push_back(bucket_of(s, r->hash), &r->elem);
+    list_push_front(&s->lru, &r->lru);
+    s->bytes += r->len;
+    s->entries++;
+    while (s->bytes > rc->stripe_budget) {
+        struct response *victim = list_entry(list_back(&s->lru), struct response, lru);
+        stripe_remove(s, victim);
+        __atomic_fetch_add(&rc->evictions, 1, __ATOMIC_RELAXED);
+        respcache_put(victim);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return r;
+}
+
+struct response *respcache_fill(struct respcache *rc, const char *key, uint64_t generation,
+                                const char *head, size_t head_len, int fd, size_t body_len,
+                                unsigned encodings) {
+    struct response *r = response_new(rc, key, head, head_len, body_len);
+    size_t got = 0;
+
+    if (r == NULL) {
+        return NULL;
+    }
+    while (got < body_len) {
+        ssize_t n = pread(fd, r->data + head_len + got, body_len - got, got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            free(r);            /* the file shrank under us */
+            return NULL;
+        }
+        got += n;
+    }
+    r->encodings = encodings;
+    return response_insert(rc, r, generation);
+}
+
+struct response *respcache_store(struct respcache *rc, const char *key, uint64_t generation,
+                                 const char *head, size_t head_len, const char *body, size_t body_len) {
+    struct response *r = response_new(rc, key, head, head_len, body_len);
+
+    if (r == NULL) {
+        return NULL;
+    }
+    memcpy(r->data + head_len, body, body_len);
+    return response_insert(rc, r, generation);
+}
+
+void respcache_invalidate(struct respcache *rc, const char *key) {
+    int i;
+
+    // Bump first: a fill that started before this must not cache what it read
+    __atomic_fetch_add(&rc->generation, 1, __ATOMIC_ACQ_REL);
+
+    for (i = 0; i < RESPCACHE_STRIPES; i++) {
+        struct stripe *s = &rc->stripes[i];
+        struct response *r;
+
+        if (key != NULL) {
+            uint32_t hash = hash_key(key);
+            s = stripe_of(rc, hash);
+            pthread_mutex_lock(&s->lock);
+            if ((r = stripe_find(s, hash, key)) != NULL) {
+                stripe_remove(s, r);
+                __atomic_fetch_add(&rc->invalidations, 1, __ATOMIC_RELAXED);
+                respcache_put(r);
+            }
+            pthread_mutex_unlock(&s->lock);
+            return;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        while (!list_empty(&s->lru)) {
+            r = list_entry(list_front(&s->lru), struct response, lru);
+            stripe_remove(s, r);
+            __atomic_fetch_add(&rc->invalidations, 1, __ATOMIC_RELAXED);
+            respcache_put(r);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+void respcache_get_stats(struct respcache *rc, struct respcache_stats *st) {
+    int i;
+
+    st->budget = rc->budget;
+    st->bytes = 0;
+    st->entries = 0;
+    for (i = 0; i < RESPCACHE_STRIPES; i++) {
+        st->bytes += __atomic_load_n(&rc->stripes[i].bytes, __ATOMIC_RELAXED);
+        st->entries += __atomic_load_n(&rc->stripes[i].entries, __ATOMIC_RELAXED);
+    }
+    st->hits = __atomic_load_n(&rc->hits, __ATOMIC_RELAXED);
+    st->misses = __atomic_load_n(&rc->misses, __ATOMIC_RELAXED);
+    st->evictions = __atomic_load_n(&rc->evictions, __ATOMIC_RELAXED);
+    st->invalidations = __atomic_load_n(&rc->invalidations, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,86 @@
+#ifndef __RESPCACHE_H__
+#define __RESPCACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+
+/*
+ * respcache.h
+ *
+ * Complete responses, headers and body in one buffer, for small static
+ * files, so a hit is queued as a single send without touching the file
+ * system.  Entries are kept in LRU order under a byte budget, spread over
+ * lock stripes like the file cache, and dropped when the file cache
+ * reports that their file changed.
+ */
+
+#define RESPCACHE_STRIPES 16
+#define RESPCACHE_MAX_BODY (64 * 1024)  /* larger files are sent with sendfile */
+
+struct respcache;
+
+/* A cached response; hold it until it has been sent, then respcache_put() it */
+struct response {
+    size_t len;
+    char *data;                 /* headers and body */
+    unsigned encodings;         /* ENCODING_* bits that would get the client another response */
+
+    // Owned by the cache
+    unsigned long refs;
+    uint64_t expires;           /* 0 while invalidation comes from inotify */
+    uint32_t hash;
+    struct list_elem elem;      /* hash chain */
+    struct list_elem lru;       /* most recently used at the front */
+    char *key;
+};
+
+struct respcache_stats {
+    size_t budget;              /* bytes, 0 if the cache is off */
+    size_t bytes;
+    unsigned long entries;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+};
+
+/* Keep up to budget bytes of responses; ttl_ns 0 means invalidation is pushed */
+struct respcache *respcache_new(size_t budget, uint64_t ttl_ns);
+
+/* Is a file of this size worth caching? */
+bool respcache_wants(struct respcache *rc, size_t body_len);
+
+/* Is there room for a body of this size at all? */
+bool respcache_fits(struct respcache *rc, size_t body_len);
+
+/* Look up the response for a file cache key; NULL on a miss */
+struct response *respcache_get(struct respcache *rc, const char *key);
+
+/*
+ * Read body_len bytes of fd behind head and cache the result under key,
+ * unless an invalidation came in since generation was read (the file may
+ * already have changed).  Returns the response, cached or not, or NULL.
+ */
+struct response *respcache_fill(struct respcache *rc, const char *key, uint64_t generation,
+                                const char *head, size_t head_len, int fd, size_t body_len,
+                                unsigned encodings);
+
+/* Like respcache_fill, with a body that is already in memory */
+struct response *respcache_store(struct respcache *rc, const char *key, uint64_t generation,
+                                 const char *head, size_t head_len, const char *body, size_t body_len);
+
+/* Read before looking the file up for respcache_fill */
+uint64_t respcache_generation(struct respcache *rc);
+
+/* Drop the response for key, or every response if key is NULL */
+void respcache_invalidate(struct respcache *rc, const char *key);
+
+/* Drop a reference from respcache_get or respcache_fill */
+void respcache_put(struct response *r);
+
+void respcache_get_stats(struct respcache *rc, struct respcache_stats *st);
+
+#endif /* __RESPCACHE_H__ */
@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "rio.h"
+#include "router.h"
+
+/*
+ * One byte of a route path.  Children hang off first_child as a sibling
+ * list; with a handful of routes sharing a leading '/' the lists stay a
+ * few entries long.
+ */
+struct trie_node {
+    char c;
+    int first_child;            /* node index, -1 if none */
+    int next_sibling;
+    int route;                  /* route ending here, -1 if none */
+};
+
+struct router {
+    const struct route *routes;
+    unsigned methods;
+    int nnodes;
+    struct trie_node nodes[];   /* nodes[0] is the root */
+};
+
+static int trie_find(const struct router *rt, int node, char c) {
+    int n;
+
+    for (n = rt->nodes[node].first_child; n >= 0; n = rt->nodes[n].next_sibling) {
+        if (rt->nodes[n].c == c) {
+            break;
+        }
+    }
+    return n;
+}
+
+static int trie_add(struct router *rt, int node, char c) {
+    int n = trie_find(rt, node, c);
+
+    if (n >= 0) {
+        return n;
+    }
+    n = rt->nnodes++;
+    rt->nodes[n].c = c;
+    rt->nodes[n].first_child = -1;
+    rt->nodes[n].route = -1;
+    rt->nodes[n].next_sibling = rt->nodes[node].first_child;
+    rt->nodes[node].first_child = n;
+    return n;
+}
+
+struct router *router_new(const struct route *routes, size_t n) {
+    size_t bytes = 0, i;
+    struct router *rt;
+
+    for (i = 0; i < n; i++) {
+        bytes += strlen(routes[i].path);
+    }
+    if ((rt = malloc(sizeof(*rt) + (bytes + 1) * sizeof(struct trie_node))) == NULL) {
+        unix_error("router_new malloc error");
+    }
+    rt->routes = routes;
+    rt->methods = 0;
+    rt->nnodes = 1;
+    rt->nodes[0].c = '\0';
+    rt->nodes[0].first_child = -1;
+    rt->nodes[0].next_sibling = -1;
+    rt->nodes[0].route = -1;
+
+    for (i = 0; i < n; i++) {
+        const char *p;
+        int node = 0;
+
+        for (p = routes[i].path; *p; p++) {
+            node = trie_add(rt, node, *p);
+        }
+        rt->nodes[node].route = i;
+        rt->methods |= routes[i].methods;
+    }
+    return rt;
+}
+
+const struct route *router_lookup(const struct router *rt, const char *path) {
+    const struct route *best = NULL;
+    const char *p = path;
+    int node = 0;
+
+    while (node >= 0) {
+        const struct trie_node *t = &rt->nodes[node];
+
+        if (t->route >= 0) {
+            const struct route *r = &rt->routes[t->route];
+            if (*p == '\0' || (r->flags & ROUTE_PREFIX) || ((r->flags & ROUTE_SUBTREE) && *p == '/')) {
+                best = r;
+            }
+        }
+        if (*p == '\0') {
+            break;
+        }
+        node = trie_find(rt, node, *p++);
+    }
+    return best;
+}
+
+unsigned router_methods(const struct router *rt) {
+    return rt->methods;
+}
+
+unsigned route_method(const char *method) {
+    if (strcasecmp(method, "GET") == 0) {
+        return ROUTE_GET;
+    } else if (strcasecmp(method, "HEAD") == 0) {
+        return ROUTE_HEAD;
+    } else if (strcasecmp(method, "POST") == 0) {
+        return ROUTE_POST;
+    }
+    return 0;
+}
+
+void query_parse(struct query *q, const char *s) {
+    q->n = 0;
+    while (*s && q->n < QUERY_MAX) {
+        size_t len = strcspn(s, "&");
+        const char *eq = memchr(s, '=', len);
+
+        if (len > 0) {
+            struct query_param *p = &q->params[q->n++];
+            p->name = s;
+            p->name_len = eq ? eq - s : len;
+            p->value = eq ? eq + 1 : "";
+            p->value_len = eq ? len - (eq + 1 - s) : 0;
+        }
+        s += len;
+        if (*s == '&') {
+            s++;
+        }
+    }
+}
+
+const char *query_get(const struct query *q, const char *name, size_t *len) {
+    size_t n = strlen(name);
+    unsigned i;
+
+    for (i = 0; i < q->n; i++) {
+        if (q->params[i].name_len == n && memcmp(q->params[i].name, name, n) == 0) {
+            *len = q->params[i].value_len;
+            return q->params[i].value;
+        }
+    }
+    return NULL;
+}
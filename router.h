@@ -0,0 +1,83 @@
+#ifndef __ROUTER_H__
+#define __ROUTER_H__
+
+#include <stddef.h>
+
+#include "reactor.h"
+
+/*
+ * router.h
+ *
+ * Request paths are matched against a table of routes, each a path, the
+ * methods it answers, how it matches and its handler.  The table is built
+ * into a byte trie at startup, so a lookup walks the path once whatever
+ * the number of routes, and the longest matching route wins.
+ *
+ * The query string is split into name/value views once per request; the
+ * views point into the request and nothing is copied or decoded.
+ */
+
+/* Methods a route answers */
+#define ROUTE_GET 0x1
+#define ROUTE_HEAD 0x2
+#define ROUTE_POST 0x4
+
+/* How a route matches; by default only the path itself */
+#define ROUTE_SUBTREE 0x1       /* and anything below it: path/... */
+#define ROUTE_PREFIX 0x2        /* and any path that starts with it */
+
+#define QUERY_MAX 16            /* parameters kept per request */
+
+struct query_param {
+    const char *name;
+    size_t name_len;
+    const char *value;          /* "" for a name without '=' */
+    size_t value_len;
+};
+
+struct query {
+    unsigned n;
+    struct query_param params[QUERY_MAX];
+};
+
+struct request_headers;
+
+/* What a handler gets besides the connection */
+struct route_args {
+    char *path;                 /* the request path, query cut off */
+    const char *query;          /* the raw query string, "" if there is none */
+    struct query params;        /* and split up */
+    char *version;
+    struct request_headers *hdrs;
+};
+
+typedef void (*route_handler_t)(struct connection *c, struct route_args *a);
+
+struct route {
+    const char *path;
+    unsigned methods;           /* ROUTE_GET ... */
+    unsigned flags;             /* ROUTE_SUBTREE or ROUTE_PREFIX */
+    route_handler_t handler;
+};
+
+struct router;
+
+/* Build a router for n routes; the table must outlive it */
+struct router *router_new(const struct route *routes, size_t n);
+
+/* The route for path, NULL if none matches */
+const struct route *router_lookup(const struct router *rt, const char *path);
+
+/* Every method some route answers */
+unsigned router_methods(const struct router *rt);
+
+/* ROUTE_GET ... for a request method, 0 for one no route can answer */
+unsigned route_method(const char *method);
+
+/* Split the query string s into q; parameters beyond QUERY_MAX are ignored */
+void query_parse(struct query *q, const char *s);
+
+/* The value of the first parameter called name, and its length; NULL if absent */
+const char *query_get(const struct query *q, const char *name, size_t *len);
+
+#endif /* __ROUTER_H__ */
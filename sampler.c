@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "list.h"
+#include "rio.h"
+#include "timewheel.h"
+#include "reply.h"
+#include "sampler.h"
+
+/*
+ * The current snapshot is read with a two-phase reader count, as in
+ * userspace RCU: a reader announces itself in readers[epoch & 1], loads
+ * the pointer and takes a reference, then leaves.  A publisher swaps the
+ * pointer, then flips the epoch and waits for the side it left to empty,
+ * twice.  One flip is not enough: a reader that loaded the epoch before
+ * an earlier publisher's flip counts on the side that flip left, which
+ * the next flip does not wait for.  After both waits every reader that
+ * saw the old pointer has its reference, so the cell's own can be
+ * dropped.  New readers count on the side not being waited for, so a
+ * steady stream of them never holds the publisher up.
+ */
+struct metric {
+    struct list_elem elem;
+    render_fn render;
+    const char *content_type;
+    listen_fn listen;           /* told of every periodic sample, if set */
+    void *listen_arg;
+
+    struct snapshot *current;
+    struct snapshot *next;      /* taken this round, not yet published */
+    unsigned long epoch;
+    unsigned long readers[2];
+    pthread_mutex_t publish_lock; /* one publisher at a time */
+};
+
+struct sampler {
+    uint64_t interval_ns;
+    unsigned long round;        /* sampling rounds so far */
+    struct list metrics;
+    round_fn on_round;          /* called after every round, if set */
+    void *on_round_arg;
+};
+
+/* How often metrics_get looks again for snapshots from one round */
+#define CONSISTENT_TRIES 100
+
+void snapshot_put(void *snapshot) {
+    struct snapshot *snap = snapshot;
+
+    if (__atomic_sub_fetch(&snap->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(snap);
+    }
+}
+
+// Sample m into a new snapshot holding refs references
+static struct snapshot *snapshot_take(struct metric *m, unsigned long refs, unsigned long round) {
+    char *json = malloc(SNAPSHOT_MAX);
+    struct snapshot *snap = NULL;
+    struct reply rp;
+    size_t len;
+
+    if (json == NULL) {
+        return NULL;
+    }
+    if ((len = m->render(json, SNAPSHOT_MAX)) > 0 && len < SNAPSHOT_MAX) {
+        reply_start(&rp, "HTTP/1.1", "200 OK", false);
+        reply_header(&rp, "Content-Type: %s", m->content_type);
+        reply_header(&rp, "Content-Length: %zu", len);
+        reply_finish(&rp);
+
+        if ((snap = malloc(sizeof(*snap) + rp.len + len)) != NULL) {
+            snap->refs = refs;
+            snap->round = round;
+            snap->taken_ns = now_ns();
+            snap->head_len = rp.len;
+            snap->len = rp.len + len;
+            memcpy(snap->data, rp.head, rp.len);
+            memcpy(snap->data + rp.len, json, len);
+        }
+    }
+    free(json);
+    return snap;
+}
+
+static void metric_publish(struct metric *m, struct snapshot *snap) {
+    struct snapshot *old;
+    int flip;
+
+    pthread_mutex_lock(&m->publish_lock);
+    old = __atomic_exchange_n(&m->current, snap, __ATOMIC_SEQ_CST);
+    for (flip = 0; flip < 2; flip++) {
+        unsigned long side = __atomic_fetch_add(&m->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+
+        while (__atomic_load_n(&m->readers[side], __ATOMIC_SEQ_CST) != 0) {
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&m->publish_lock);
+
+    if (old != NULL) {
+        snapshot_put(old);
+    }
+}
+
+static struct snapshot *metric_acquire(struct metric *m) {
+    unsigned long side = __atomic_load_n(&m->epoch, __ATOMIC_SEQ_CST) & 1;
+    struct snapshot *snap;
+
+    __atomic_fetch_add(&m->readers[side], 1, __ATOMIC_SEQ_CST);
+    if ((snap = __atomic_load_n(&m->current, __ATOMIC_SEQ_CST)) != NULL) {
+        __atomic_fetch_add(&snap->refs, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&m->readers[side], 1, __ATOMIC_RELEASE);
+    return snap;
+}
+
+struct snapshot *metric_get(struct metric *m, uint64_t max_age_ns) {
+    struct snapshot *snap = metric_acquire(m);
+
+    if (snap != NULL && now_ns() - snap->taken_ns <= max_age_ns) {
+        return snap;
+    }
+    if (snap != NULL) {
+        snapshot_put(snap);
+    }
+    // Too old for this client: sample now, and let everyone else have it too
+    if ((snap = snapshot_take(m, 2, 0)) != NULL) {
+        metric_publish(m, snap);
+    }
+    return snap;
+}
+
+bool metrics_get(struct metric **ms, int n, struct snapshot **snaps) {
+    int tries, i;
+
+    // Like a seqlock read: retry until every snapshot is from the same
+    // round.  A mix is only seen while a round is being published.
+    for (tries = 0; tries < CONSISTENT_TRIES; tries++) {
+        bool missing = false, mixed = false;
+
+        for (i = 0; i < n; i++) {
+            snaps[i] = metric_acquire(ms[i]);
+            if (snaps[i] == NULL || snaps[i]->round == 0) {
+                missing = true;
+            } else if (snaps[0] != NULL && snaps[i]->round != snaps[0]->round) {
+                mixed = true;
+            }
+        }
+        if (!missing && !mixed) {
+            return true;
+        }
+        for (i = 0; i < n; i++) {
+            if (snaps[i] != NULL) {
+                snapshot_put(snaps[i]);
+            }
+        }
+        // One was sampled on demand since the last round; retrying won't help
+        if (missing) {
+            break;
+        }
+        sched_yield();
+    }
+
+    // Sample them all together now instead, without publishing
+    for (i = 0; i < n; i++) {
+        if ((snaps[i] = snapshot_take(ms[i], 1, 0)) == NULL) {
+            while (i-- > 0) {
+                snapshot_put(snaps[i]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+struct sampler *sampler_new(unsigned interval_ms) {
+    struct sampler *s = malloc(sizeof(*s));
+
+    if (s == NULL) {
+        unix_error("sampler_new malloc error");
+    }
+    s->interval_ns = (uint64_t)interval_ms * 1000000ULL;
+    s->round = 0;
+    s->on_round = NULL;
+    list_init(&s->metrics);
+    return s;
+}
+
+struct metric *sampler_add(struct sampler *s, render_fn render, const char *content_type) {
+    struct metric *m = calloc(1, sizeof(*m));
+
+    if (m == NULL) {
+        unix_error("sampler_add calloc error");
+    }
+    m->render = render;
+    m->content_type = content_type;
+    pthread_mutex_init(&m->publish_lock, NULL);
+    list_push_back(&s->metrics, &m->elem);
+    return m;
+}
+
+void sampler_on_round(struct sampler *s, round_fn fn, void *arg) {
+    s->on_round = fn;
+    s->on_round_arg = arg;
+}
+
+void metric_listen(struct metric *m, listen_fn fn, void *arg) {
+    m->listen = fn;
+    m->listen_arg = arg;
+}
+
+// Take a round of samples, then publish them together, so that the window
+// in which a reader sees some metrics from this round and some from the
+// last is as short as the pointer swaps
+static void sample_all(struct sampler *s) {
+    struct list_elem *e;
+
+    s->round++;
+    for (e = list_begin(&s->metrics); e != list_end(&s->metrics); e = list_next(e)) {
+        struct metric *m = list_entry(e, struct metric, elem);
+        // The listener's reference keeps it alive if a request publishes a
+        // newer one meanwhile
+        m->next = snapshot_take(m, m->listen ? 2 : 1, s->round);
+    }
+    for (e = list_begin(&s->metrics); e != list_end(&s->metrics); e = list_next(e)) {
+        struct metric *m = list_entry(e, struct metric, elem);
+
+        // A metric that cannot be read now keeps its last snapshot
+        if (m->next != NULL) {
+            metric_publish(m, m->next);
+        }
+    }
+    for (e = list_begin(&s->metrics); e != list_end(&s->metrics); e = list_next(e)) {
+        struct metric *m = list_entry(e, struct metric, elem);
+
+        if (m->next != NULL && m->listen) {
+            m->listen(m->next, m->listen_arg);
+            snapshot_put(m->next);
+        }
+        m->next = NULL;
+    }
+    if (s->on_round) {
+        s->on_round(s->on_round_arg);
+    }
+}
+
+static void *sampler_thread(void *data) {
+    struct sampler *s = data;
+    struct timespec pause = { s->interval_ns / 1000000000ULL, s->interval_ns % 1000000000ULL };
+
+    while (1) {
+        nanosleep(&pause, NULL);
+        sample_all(s);
+    }
+    return NULL;
+}
+
+void sampler_start(struct sampler *s) {
+    pthread_t tid;
+
+    if (s->interval_ns == 0) {
+        return;
+    }
+    sample_all(s);
+    if (pthread_create(&tid, NULL, sampler_thread, s) != 0) {
+        unix_error("pthread_create error");
+    }
+}
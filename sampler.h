@@ -0,0 +1,81 @@
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * sampler.h
+ *
+ * System metrics sampled by a background thread instead of per request.
+ * Every interval each metric's render function writes its JSON, which is
+ * kept together with a ready-made response head in an immutable snapshot.
+ * The snapshot is published by swapping one pointer; requests take a
+ * reference to the current one without locking and send it as it is, and
+ * an old snapshot is freed once the last response using it has gone out.
+ */
+
+/* Largest JSON a render function may write */
+#define SNAPSHOT_MAX (64 * 1024)
+
+struct snapshot {
+    unsigned long refs;
+    unsigned long round;        /* the sampling round it is from, 0 if taken on demand */
+    uint64_t taken_ns;          /* now_ns() when it was sampled */
+    size_t head_len;            /* HTTP/1.1 200 head, without Date */
+    size_t len;                 /* head and body */
+    char data[];                /* the head, then the JSON body */
+};
+
+/* Write the metric as JSON into buf; its length, or 0 if it cannot be read */
+typedef size_t (*render_fn)(char *buf, size_t len);
+
+/* Told of a sample on the sampling thread; snap is only valid during the call */
+typedef void (*listen_fn)(struct snapshot *snap, void *arg);
+
+/* Called on the sampling thread after each round of samples */
+typedef void (*round_fn)(void *arg);
+
+struct sampler;
+struct metric;
+
+/* interval_ms 0 samples on demand only, on every request */
+struct sampler *sampler_new(unsigned interval_ms);
+
+/* Register a metric; call before sampler_start */
+struct metric *sampler_add(struct sampler *s, render_fn render, const char *content_type);
+
+/* Call fn(arg) after every round the sampling thread takes */
+void sampler_on_round(struct sampler *s, round_fn fn, void *arg);
+
+/* Call fn(snap, arg) with every sample the sampling thread takes of m */
+void metric_listen(struct metric *m, listen_fn fn, void *arg);
+
+/* Take the first samples and start the sampling thread */
+void sampler_start(struct sampler *s);
+
+/*
+ * The current snapshot of m, with a reference the caller has to drop
+ * with snapshot_put.  One older than max_age_ns is replaced by a sample
+ * taken now.  NULL if m cannot be read.
+ */
+struct snapshot *metric_get(struct metric *m, uint64_t max_age_ns);
+
+/*
+ * The current snapshots of the n metrics in ms, all from one sampling
+ * round, or if there is none to be had, sampled together now; each with a
+ * reference the caller drops with snapshot_put.  False if one cannot be read.
+ */
+bool metrics_get(struct metric **ms, int n, struct snapshot **snaps);
+
+/* Drop a reference; takes a void * to serve as a conn_write_ref release */
+void snapshot_put(void *snapshot);
+
+/* The JSON body of snap */
+static inline const char *snapshot_body(const struct snapshot *snap, size_t *len) {
+    *len = snap->len - snap->head_len;
+    return snap->data + snap->head_len;
+}
+
+#endif /* __SAMPLER_H__ */
@@ -0,0 +1,121 @@
+/*
+ * sampler_stress.c
+ *
+ * Hammer one metric's snapshot cell: reader threads take and check the
+ * current snapshot over and over while publisher threads replace it as
+ * fast as they can, sampling on demand the way an old snapshot gets
+ * replaced by a request.  Every body is one character repeated, changed
+ * with each sample, so a reader that got hold of a freed snapshot sees
+ * it torn or its fields gone wrong once the memory is reused.  Best run
+ * built with -fsanitize=address too.
+ *
+ * make sampler_stress && ./sampler_stress [seconds, default 5]
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "sampler.h"
+
+#define READERS 8
+#define PUBLISHERS 4
+#define BODY_LEN 4096
+
+static struct metric *metric;
+static volatile bool stop;
+static unsigned long samples, reads, bad;
+
+// reply.o sends through the reactor, which these snapshots never reach
+void conn_write(struct connection *c, const void *buf, size_t n) {
+    abort();
+}
+
+void conn_write_ref(struct connection *c, const void *buf, size_t n, void (*release)(void *), void *arg) {
+    abort();
+}
+
+void conn_set_status(struct connection *c, int status) {
+    abort();
+}
+
+static size_t render(char *buf, size_t len) {
+    unsigned long n = __atomic_fetch_add(&samples, 1, __ATOMIC_RELAXED);
+
+    memset(buf, 'a' + n % 26, BODY_LEN);
+    return BODY_LEN;
+}
+
+static bool check(struct snapshot *snap) {
+    const char *body;
+    size_t len, i;
+
+    if (snap->round != 0 || snap->refs == 0 || snap->refs > READERS + PUBLISHERS + 1 ||
+        snap->len - snap->head_len != BODY_LEN) {
+        return false;
+    }
+    body = snapshot_body(snap, &len);
+    for (i = 1; i < len; i++) {
+        if (body[i] != body[0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *reader(void *arg) {
+    while (!stop) {
+        struct snapshot *snap = metric_get(metric, UINT64_MAX);
+
+        if (snap == NULL || !check(snap)) {
+            __atomic_fetch_add(&bad, 1, __ATOMIC_RELAXED);
+        }
+        if (snap != NULL) {
+            snapshot_put(snap);
+        }
+        __atomic_fetch_add(&reads, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void *publisher(void *arg) {
+    while (!stop) {
+        struct snapshot *snap = metric_get(metric, 0);
+
+        if (snap != NULL) {
+            snapshot_put(snap);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    pthread_t threads[READERS + PUBLISHERS];
+    struct sampler *s;
+    int i;
+
+    if (seconds < 1) {
+        fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+        return 1;
+    }
+    s = sampler_new(0);
+    metric = sampler_add(s, render, "text/plain");
+    sampler_start(s);
+
+    for (i = 0; i < READERS + PUBLISHERS; i++) {
+        pthread_create(&threads[i], NULL, i < READERS ? reader : publisher, NULL);
+    }
+    sleep(seconds);
+    stop = true;
+    for (i = 0; i < READERS + PUBLISHERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    printf("%lu samples published, %lu reads, %lu bad\n", samples, reads, bad);
+    return bad != 0;
+}
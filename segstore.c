@@ -0,0 +1,292 @@
+#define _GNU_SOURCE 1
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rio.h"
+#include "history.h"
+#include "segstore.h"
+
+#define SEG_MAGIC "SSDSEG1"
+#define NRES 3
+
+static const struct resolution {
+    const char *tag;            /* in the file names */
+    unsigned seconds;           /* a slot */
+    unsigned slots;             /* a segment */
+    unsigned keep;              /* segments kept, the current one included */
+} resolutions[NRES] = {
+    { "1s", 1, 3600, 48 },      /* an hour a segment, two days kept */
+    { "1m", 60, 1440, 32 },     /* a day a segment, a month */
+    { "1h", 3600, 720, 25 },    /* 30 days a segment, two years */
+};
+
+/* The start of a segment file; the columns follow */
+struct seg_header {
+    char magic[8];
+    uint32_t seconds;
+    uint32_t slots;
+    uint32_t nseries;
+    uint32_t unused;
+    uint64_t start;             /* seconds since the epoch at slot 0 */
+};
+
+struct segment {
+    uint64_t start;             /* 0 while none is mapped */
+    struct seg_header *hdr;
+    size_t size;
+};
+
+struct segstore {
+    char *dir;
+    char *name;
+    const char *const *series;
+    int nseries;
+    struct segment current[NRES]; /* appended to, per resolution */
+};
+
+static uint64_t span(const struct resolution *r) {
+    return (uint64_t)r->seconds * r->slots;
+}
+
+static size_t seg_size(const struct resolution *r, int nseries) {
+    return sizeof(struct seg_header) + r->slots * sizeof(uint32_t) + (size_t)r->slots * nseries * 3 * sizeof(int64_t);
+}
+
+static uint32_t *seg_counts(struct seg_header *h) {
+    return (uint32_t *)(h + 1);
+}
+
+// Column c of series s: 0 the minimum, 1 the maximum, 2 the sum
+static int64_t *seg_column(struct seg_header *h, int s, int c) {
+    return (int64_t *)(seg_counts(h) + h->slots) + ((size_t)s * 3 + c) * h->slots;
+}
+
+static void seg_path(struct segstore *st, const struct resolution *r, uint64_t start, char *buf, size_t len) {
+    snprintf(buf, len, "%s/%s-%s-%llu.seg", st->dir, st->name, r->tag, (unsigned long long)start);
+}
+
+// Map the segment of r that starts at start.  To append, it is created, or
+// cleared if it is not what it should be; to read, it has to be there.
+static bool seg_map(struct segstore *st, const struct resolution *r, uint64_t start, bool append, struct segment *seg) {
+    size_t size = seg_size(r, st->nseries);
+    struct seg_header *h;
+    struct stat sb;
+    char path[4096];
+    int fd;
+
+    seg_path(st, r, start, path, sizeof(path));
+    if ((fd = open(path, append ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644)) < 0) {
+        return false;
+    }
+    if (fstat(fd, &sb) < 0 || (sb.st_size != size && (!append || ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0))) {
+        close(fd);
+        return false;
+    }
+    h = mmap(NULL, size, append ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED) {
+        return false;
+    }
+    if (memcmp(h->magic, SEG_MAGIC, sizeof(h->magic)) != 0 || h->seconds != r->seconds || h->slots != r->slots ||
+        h->nseries != st->nseries || h->start != start) {
+        if (!append) {
+            munmap(h, size);
+            return false;
+        }
+        memset(h, 0, size);
+        memcpy(h->magic, SEG_MAGIC, sizeof(h->magic));
+        h->seconds = r->seconds;
+        h->slots = r->slots;
+        h->nseries = st->nseries;
+        h->start = start;
+    }
+    seg->start = start;
+    seg->hdr = h;
+    seg->size = size;
+    return true;
+}
+
+// Remove the segments of r that start at or before cutoff
+static void seg_prune(struct segstore *st, const struct resolution *r, uint64_t cutoff) {
+    char prefix[256];
+    size_t plen = snprintf(prefix, sizeof(prefix), "%s-%s-", st->name, r->tag);
+    struct dirent *de;
+    DIR *d;
+
+    if ((d = opendir(st->dir)) == NULL) {
+        return;
+    }
+    while ((de = readdir(d)) != NULL) {
+        char *end;
+        unsigned long long start;
+
+        if (strncmp(de->d_name, prefix, plen) != 0) {
+            continue;
+        }
+        start = strtoull(de->d_name + plen, &end, 10);
+        if (strcmp(end, ".seg") == 0 && start <= cutoff) {
+            unlinkat(dirfd(d), de->d_name, 0);
+        }
+    }
+    closedir(d);
+}
+
+struct segstore *segstore_open(const char *dir, const char *name, const char *const *series, int nseries) {
+    struct segstore *st;
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        return NULL;
+    }
+    if (access(dir, W_OK | X_OK) < 0) {
+        return NULL;
+    }
+    if ((st = calloc(1, sizeof(*st))) == NULL || (st->dir = strdup(dir)) == NULL || (st->name = strdup(name)) == NULL) {
+        unix_error("segstore_open malloc error");
+    }
+    st->series = series;
+    st->nseries = nseries;
+    return st;
+}
+
+void segstore_append(struct segstore *st, uint64_t time_ms, const int64_t *values) {
+    uint64_t t = time_ms / 1000;
+    int i, s;
+
+    for (i = 0; i < NRES; i++) {
+        const struct resolution *r = &resolutions[i];
+        struct segment *seg = &st->current[i];
+        uint64_t start = t - t % span(r);
+        size_t slot = (t - start) / r->seconds;
+        uint32_t count;
+
+        // A new span starts a new segment and ends the oldest one kept
+        if (seg->start != start) {
+            if (seg->hdr != NULL) {
+                munmap(seg->hdr, seg->size);
+                seg->hdr = NULL;
+                seg->start = 0;
+            }
+            if (!seg_map(st, r, start, true, seg)) {
+                continue;       /* the sample is lost at this resolution */
+            }
+            if (start >= r->keep * span(r)) {
+                seg_prune(st, r, start - r->keep * span(r));
+            }
+        }
+
+        count = seg_counts(seg->hdr)[slot];
+        for (s = 0; s < st->nseries; s++) {
+            int64_t *min = seg_column(seg->hdr, s, 0), *max = seg_column(seg->hdr, s, 1);
+
+            if (count == 0 || values[s] < min[slot]) {
+                min[slot] = values[s];
+            }
+            if (count == 0 || values[s] > max[slot]) {
+                max[slot] = values[s];
+            }
+            seg_column(seg->hdr, s, 2)[slot] += values[s];
+        }
+        __atomic_store_n(&seg_counts(seg->hdr)[slot], count + 1, __ATOMIC_RELEASE);
+    }
+}
+
+char *segstore_query(struct segstore *st, uint64_t from_ms, uint64_t to_ms, unsigned max_points, size_t *len) {
+    uint64_t now = time(NULL), from = from_ms / 1000, to = to_ms / 1000;
+    uint64_t oldest = 0, start, bound;
+    const struct resolution *r;
+    size_t n = 0, size, off;
+    int64_t *cols;
+    char *json;
+    int i, s;
+
+    if (to > now) {
+        to = now;
+    }
+    if (from > to) {
+        from = to;
+    }
+    // The finest resolution that still has the start of the range and
+    // does not need too many slots for it
+    for (i = 0; i < NRES; i++) {
+        r = &resolutions[i];
+        oldest = now - now % span(r);
+        oldest = oldest > (r->keep - 1) * span(r) ? oldest - (r->keep - 1) * span(r) : 0;
+        if (from >= oldest && (to - from) / r->seconds < max_points) {
+            break;
+        }
+    }
+    if (from < oldest) {
+        from = oldest;
+    }
+    // Not even the coarsest one fits: keep its newest max_points slots
+    if (i == NRES && (to - from) / r->seconds >= max_points) {
+        from = to - (uint64_t)(max_points - 1) * r->seconds;
+    }
+
+    // Gather the slots that have samples: times, then min, max and avg of each series
+    bound = (to - from) / r->seconds + 1;
+    if ((cols = malloc(bound * (1 + 3 * st->nseries) * sizeof(*cols))) == NULL) {
+        return NULL;
+    }
+    for (start = from - from % span(r); start <= to; start += span(r)) {
+        struct segment seg;
+        size_t slot, first, last;
+
+        if (!seg_map(st, r, start, false, &seg)) {
+            continue;
+        }
+        first = start < from ? (from - start) / r->seconds : 0;
+        last = (to - start) / r->seconds;
+        if (last >= r->slots) {
+            last = r->slots - 1;
+        }
+        for (slot = first; slot <= last && n < bound; slot++) {
+            uint32_t count = __atomic_load_n(&seg_counts(seg.hdr)[slot], __ATOMIC_ACQUIRE);
+
+            if (count == 0) {
+                continue;
+            }
+            cols[n] = (start + slot * r->seconds) * 1000;
+            for (s = 0; s < st->nseries; s++) {
+                cols[(1 + 3 * s) * bound + n] = seg_column(seg.hdr, s, 0)[slot];
+                cols[(2 + 3 * s) * bound + n] = seg_column(seg.hdr, s, 1)[slot];
+                cols[(3 + 3 * s) * bound + n] = seg_column(seg.hdr, s, 2)[slot] / (int64_t)count;
+            }
+            n++;
+        }
+        munmap(seg.hdr, seg.size);
+    }
+
+    size = 64 + (1 + 3 * st->nseries) * (n * 23 + 16);
+    for (s = 0; s < st->nseries; s++) {
+        size += strlen(st->series[s]) + 16;
+    }
+    if ((json = malloc(size)) == NULL) {
+        free(cols);
+        return NULL;
+    }
+    off = sprintf(json, "{\"resolution\": %u, ", r->seconds);
+    off += history_column(json + off, "time", cols, n);
+    for (s = 0; s < st->nseries; s++) {
+        off += sprintf(json + off, ", \"%s\": {", st->series[s]);
+        off += history_column(json + off, "min", cols + (1 + 3 * s) * bound, n);
+        off += sprintf(json + off, ", ");
+        off += history_column(json + off, "max", cols + (2 + 3 * s) * bound, n);
+        off += sprintf(json + off, ", ");
+        off += history_column(json + off, "avg", cols + (3 + 3 * s) * bound, n);
+        json[off++] = '}';
+    }
+    json[off++] = '}';
+    free(cols);
+    *len = off;
+    return json;
+}
@@ -0,0 +1,44 @@
+#ifndef __SEGSTORE_H__
+#define __SEGSTORE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * segstore.h
+ *
+ * Days of history for a few series, kept on disk in memory-mapped segment
+ * files at three resolutions: 1 second, 1 minute and 1 hour.  Each segment
+ * covers a fixed span of time and has a slot per resolution step, laid out
+ * in fixed-width columns: a sample count, then the min, max and sum of
+ * every series.  An append folds the sample into the slot it falls in at
+ * every resolution, so the rollups are always up to date and nothing is
+ * ever recomputed.  A segment is created when its span starts and removed
+ * once it is older than its resolution keeps.
+ *
+ * Opening a store maps nothing and reads nothing: the current segments
+ * are mapped on the first append, and a query maps the segments of the
+ * range it reads, so a restart continues where the files left off.
+ *
+ * One thread appends.  A query may run on any thread at the same time;
+ * the slot being appended to may be seen half updated.
+ */
+
+struct segstore;
+
+/* Open or create the store for the series called names under dir/name-*.seg; NULL and errno if dir is unusable */
+struct segstore *segstore_open(const char *dir, const char *name, const char *const *series, int nseries);
+
+/* Fold a sample of every series taken at time_ms into its slots */
+void segstore_append(struct segstore *st, uint64_t time_ms, const int64_t *values);
+
+/*
+ * The slots between from_ms and to_ms as JSON, at the finest resolution
+ * that has them and needs at most max_points slots for the range, else the
+ * coarsest; in a buffer the caller frees, NULL if out of memory.  Arrays
+ * are delta-encoded as for /history:
+ * {"resolution": 60, "time": [...], "load1": {"min": [...], "max": [...], "avg": [...]}}
+ */
+char *segstore_query(struct segstore *st, uint64_t from_ms, uint64_t to_ms, unsigned max_points, size_t *len);
+
+#endif /* __SEGSTORE_H__ */
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE 1
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -13,96 +14,369 @@
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <stdarg.h>
 
 #include "list.h"
 #include "rio.h"
 #include "threadpool.h"
+#include "threadpool_lib.h"
+#include "reactor.h"
+#include "admission.h"
+#include "filecache.h"
+#include "respcache.h"
+#include "encoding.h"
+#include "range.h"
+#include "reply.h"
+#include "accesslog.h"
+#include "router.h"
+#include "sampler.h"
+#include "procfs.h"
+#include "projection.h"
+#include "history.h"
+#include "segstore.h"
+#include "timewheel.h"
+#include "counters.h"
+#include "hdrhist.h"
 
 #define THREADS 50
 #define MAXLINE 8192
 #define MAXBUF 8192
 #define LISTENQ 1024
-
-#define STATIC 0
-#define DYNAMIC 1
-#define LOADAVG 2
-#define MEMINFO 3
-#define RUNLOOP 4
-#define ALLOCANON 5
-#define FREEANON 6
+#define COMPRESS_PENDING 16
+#define CACHE_POLICIES 16
+#define MAX_MEMINFO 128
+#define MAX_CPUS 256
+#define MAX_NETDEVS 64
+#define MAX_DISKS 256
 
 extern char **environ;
 static struct thread_pool *pool;
 static char *path;
 struct list memory_list;
 
+// One event loop per SO_REUSEPORT listener, see -j
+static struct reactor **shards;
+static int nshards = 1;
+static int reactor_flags = 0;
+
+// Overload control, NULL unless -Q or -S is given
+static struct admission *admission;
+
+// System metrics, sampled in the background every -I ms
+static struct sampler *sampler;
+static struct metric *loadavg_metric;
+static struct metric *meminfo_metric;
+static struct metric *cpustat_metric;
+static struct metric *netdev_metric;
+static struct metric *diskstats_metric;
+static unsigned sample_interval_ms = 1000;
+
+// The metrics by name, for /stream and /metrics.json; every sample of one
+// goes out as an event on its channel
+struct named_metric {
+    const char *name;
+    struct metric **metric;
+    struct channel *channel;
+};
+static struct named_metric named_metrics[] = {
+    { "loadavg", &loadavg_metric },
+    { "meminfo", &meminfo_metric },
+    { "cpustat", &cpustat_metric },
+    { "netdev", &netdev_metric },
+    { "diskstats", &diskstats_metric },
+};
+#define NMETRICS (sizeof(named_metrics) / sizeof(named_metrics[0]))
+
+// The last HISTORY_LEN samples of the series the widgets plot, for /history
+static const char *const loadavg_series[] = { "load1", "load5", "load15", "running_threads", "total_threads" };
+static const char *const meminfo_series[] = { "MemTotal", "MemFree", "MemAvailable", "Buffers", "Cached" };
+#define NLOADAVG_SERIES (sizeof(loadavg_series) / sizeof(loadavg_series[0]))
+#define NMEMINFO_SERIES (sizeof(meminfo_series) / sizeof(meminfo_series[0]))
+static struct history *loadavg_history;
+static struct history *meminfo_history;
+
+// And days of them on disk, NULL unless -D is given
+static char *store_dir;
+static struct segstore *loadavg_store;
+static struct segstore *meminfo_store;
+#define HISTORY_POINTS 1000     /* most slots a /history range query gets by default */
+#define HISTORY_POINTS_MAX HISTORY_LEN /* and with &points=, however many are asked for */
+
+// Where requests are logged, NULL unless -L is given
+static struct access_log *access_log;
+
+// Open files under the root, see -F
+static struct filecache *files;
+static unsigned long filecache_capacity = 1024;
+
+// Ready-made responses for small files, see -M
+static struct respcache *responses;
+static size_t respcache_budget = 16 * 1024 * 1024;
+
+// Cache-Control for static files by path prefix below the root, see -C
+struct cache_policy {
+    char *prefix;
+    char *value;
+};
+static struct cache_policy cache_policies[CACHE_POLICIES];
+static int ncache_policies;
+
+// Files being gzipped in the background, so each is compressed only once
+struct compress_job {
+    struct list_elem elem;
+    char key[];
+};
+static pthread_mutex_t compress_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list compress_pending;
+static unsigned long compressed;
+
+// How long an event loop waits on a connection, see -t -H -k -w
+static struct reactor_timeouts timeouts = {
+    .first_byte_ms = 10000,
+    .header_ms = 20000,
+    .idle_ms = 30000,
+    .write_ms = 60000,
+};
+
 struct memory {
     void *block;
     struct list_elem elem;
 };
 
+// What doit needs from the request headers
+struct request_headers {
+    unsigned accept_encoding;   /* ENCODING_* bits the client takes */
+    char range[1024];           /* "" if absent or too long to honour */
+    char if_range[128];
+    char if_none_match[1024];
+    char if_modified_since[64];
+};
+
 // When client request a file or a excutable which doesn't exist. use this for error
 // This will send a html back to client and explain the error
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg, char *version);
+void clienterror(struct connection *c, char *cause, char *errnum, char *shortmsg, char *longmsg, char *version);
+
+// Responde to the http request buffered on c, and count and time it for
+// /server-metrics and /latency
+void doit(struct connection *c);
+
+// Route the request and serve it; returns the route it went to, NULL if none
+static const struct route *serve_request(struct connection *c);
+
+// Pick the request headers doit needs out of the parsed request
+void read_requesthdrs(const struct http_request *req, char *base, struct request_headers *hdrs);
+
+// Route handlers, see routes[]
+static void serve_file(struct connection *c, struct route_args *a);
+static void serve_cgi(struct connection *c, struct route_args *a);
+static void serve_loadavg(struct connection *c, struct route_args *a);
+static void serve_meminfo(struct connection *c, struct route_args *a);
+static void serve_cpustat(struct connection *c, struct route_args *a);
+static void serve_netdev(struct connection *c, struct route_args *a);
+static void serve_diskstats(struct connection *c, struct route_args *a);
+static void serve_stream(struct connection *c, struct route_args *a);
+static void serve_metrics_json(struct connection *c, struct route_args *a);
+static void serve_history(struct connection *c, struct route_args *a);
+static void serve_runloop(struct connection *c, struct route_args *a);
+static void serve_allocanon(struct connection *c, struct route_args *a);
+static void serve_freeanon(struct connection *c, struct route_args *a);
+
+// What the sampler takes every -I ms for the system metric routes
+static size_t render_loadavg(char *json, size_t size);
+static size_t render_meminfo(char *json, size_t size);
+static size_t render_cpustat(char *json, size_t size);
+static size_t render_netdev(char *json, size_t size);
+static size_t render_diskstats(char *json, size_t size);
+
+// Encode each sample once as an event for every /stream subscriber
+static void publish_sample(struct snapshot *snap, void *arg);
+
+// Add a sample of the series kept for /history after every round
+static void record_history(void *arg);
+
+// Milliseconds since the epoch, the time /history and /latency speak
+static uint64_t wall_ms(void);
+
+// Add ns to the /latency histogram of phase for a group of routes
+static void record_latency(unsigned group, unsigned phase, uint64_t ns);
+
+// Release callbacks for conn_write_file and conn_write_ref, and the file
+// cache's change hook that keeps the response cache in step
+static void release_file(void *data);
+static void release_response(void *data);
+static void invalidate_response(void *arg, const char *key);
+
+// Response cache key of an encoded variant of key; a '?' never makes it
+// into a normalized key, so no request for a file can hit one
+static inline void variant_key(char *buf, size_t len, const char *key, unsigned encoding) {
+    snprintf(buf, len, "%s?%s", key, encoding_name(encoding));
+}
 
-// Responde a http request
-void doit(struct thread_pool *pool, void *data);
+// Seve static request; takes over the reference to fe.
+// generation is the response cache's from before fe was looked up.
+void serve_static(struct connection *c, struct file_entry *fe, uint64_t generation,
+                  struct request_headers *hdrs, char *version);
 
-// Read and ignore request headers
-void read_requesthdrs(rio_t *rp);
+// Answer a conditional GET for fe with 304 if the client's copy is current;
+// false otherwise, in which case fe is still the caller's
+static bool serve_not_modified(struct connection *c, struct file_entry *fe, struct request_headers *hdrs);
 
-// Parse uri into file name and cgiargs. For both static and dynamic
-// If it is static, filename will be the path of that file in server, cgiargs will be ""
-// If it is dynamic, filename will be the path of that cgi file in the server, cgiargs will be arguments of the excutable
-// If it is /loadavg or /meminfo, filename will be "", cgiargs will be the callback function
-// If it is /runloop, /alloanno or /freeannon, filename will be "", cigargs will be ""
-int parse_uri(char *uri, char *filename, char *cgiargs);
+// Answer a Range request for fe with 206 or 416; false if the header is
+// to be ignored, in which case fe is still the caller's
+static bool serve_ranges(struct connection *c, struct file_entry *fe, const char *range);
 
-// Seve static request
-void serve_static(int fd, char *filename, int filesize);
+// Look up a cached compressed response for key, best encoding first
+static struct response *cached_variant(const char *key, unsigned accept);
 
-// Serve dynamic request
-void serve_dynamic(int fd, char *filename, char *cgiargs);
+// Send the precompressed sidecar of fe instead of fe, if it can be opened
+static bool serve_sidecar(struct connection *c, struct file_entry *fe, unsigned encoding, uint64_t generation);
 
-// Get the filetype from filename for Content-Type in the response header
-void get_filetype(char *filename, char *filetype);
+// gzip a file on the thread pool and cache the result as its variant
+static void compress_later(const char *key);
+static void *compress_file(struct thread_pool *pool, void *data);
+
+// Serve dynamic request
+void serve_dynamic(struct connection *c, char *filename, char *cgiargs);
 
 // Send a reponse to client with msg, content_type, version
-void send_response(int fd, char *msg, char *content_type, char *version);
+void send_response(struct connection *c, char *msg, char *content_type, char *version);
 
 // The function of /runloop
-static void run_loop(void);
+static void *run_loop(struct thread_pool *pool, void *data);
+
+// The function of /shards: per event loop counters as json
+static void shard_stats(struct connection *c, struct route_args *a);
+
+// The function of /admission: queue depth and shed counts as json
+static void admission_stats(struct connection *c, struct route_args *a);
+
+// The function of /filecache: open file and response cache counters as json
+static void filecache_stats(struct connection *c, struct route_args *a);
+
+// The function of /accesslog: records logged and dropped as json
+static void access_log_stats(struct connection *c, struct route_args *a);
+
+// The function of /server-metrics: what the server itself is doing, for Prometheus
+static void server_metrics(struct connection *c, struct route_args *a);
+
+// The function of /latency: percentiles of how long requests took, by route, as json
+static void serve_latency(struct connection *c, struct route_args *a);
+
+// Every path the server answers; /runloop and friends have always taken
+// anything after their name, so they keep matching as prefixes
+static const struct route routes[] = {
+    { "/files", ROUTE_GET, ROUTE_SUBTREE, serve_file },
+    { "/cgi-bin", ROUTE_GET, ROUTE_SUBTREE, serve_cgi },
+    { "/loadavg", ROUTE_GET, 0, serve_loadavg },
+    { "/meminfo", ROUTE_GET, 0, serve_meminfo },
+    { "/cpustat", ROUTE_GET, 0, serve_cpustat },
+    { "/netdev", ROUTE_GET, 0, serve_netdev },
+    { "/diskstats", ROUTE_GET, 0, serve_diskstats },
+    { "/stream", ROUTE_GET, 0, serve_stream },
+    { "/metrics.json", ROUTE_GET, 0, serve_metrics_json },
+    { "/history", ROUTE_GET, 0, serve_history },
+    { "/runloop", ROUTE_GET, ROUTE_PREFIX, serve_runloop },
+    { "/allocanon", ROUTE_GET, ROUTE_PREFIX, serve_allocanon },
+    { "/freeanon", ROUTE_GET, ROUTE_PREFIX, serve_freeanon },
+    { "/shards", ROUTE_GET, 0, shard_stats },
+    { "/admission", ROUTE_GET, 0, admission_stats },
+    { "/filecache", ROUTE_GET, 0, filecache_stats },
+    { "/accesslog", ROUTE_GET, 0, access_log_stats },
+    { "/server-metrics", ROUTE_GET, 0, server_metrics },
+    { "/latency", ROUTE_GET, 0, serve_latency },
+};
+#define NROUTES (sizeof(routes) / sizeof(routes[0]))
+static struct router *router;
+
+// What doit counts for /server-metrics, in per-thread shards: request and
+// response bytes, then requests by route, a row per route and one for no
+// route, and by status, a column per code below and one for any other
+static const int status_codes[] = { 200, 206, 304, 400, 403, 404, 405, 416, 500, 501, 503 };
+#define NSTATUS (sizeof(status_codes) / sizeof(status_codes[0]) + 1)
+#define COUNTER_BYTES_IN 0
+#define COUNTER_BYTES_OUT 1
+#define COUNTER_REQUESTS 2
+#define NCOUNTERS (COUNTER_REQUESTS + (NROUTES + 1) * NSTATUS)
+static struct counters *request_counters;
+
+// And how long requests took, in HDR histograms of microseconds (hdrhist.h)
+// kept the same way: one per route below and one for every other route,
+// for each phase of a request
+static const char *const latency_routes[] = { "/loadavg", "/meminfo", "/files", "/cgi-bin" };
+#define NLATENCY_ROUTES (sizeof(latency_routes) / sizeof(latency_routes[0]) + 1)
+static const char *const latency_phases[] = {
+    "accept_to_dispatch",       /* arrived to handed to the pool */
+    "dispatch_to_first_byte",   /* waiting for a thread, then to the status line */
+    "total",                    /* arrived to the whole response queued */
+};
+#define NLATENCY_PHASES (sizeof(latency_phases) / sizeof(latency_phases[0]))
+#define NLATENCY (NLATENCY_ROUTES * NLATENCY_PHASES * HDR_BUCKETS)
+static unsigned latency_group[NROUTES + 1]; /* the histograms of each route */
+static struct counters *latency_counters;
+
+// /latency?reset=1 reports the window since the last reset and starts a
+// new one; the counts at its start are kept to subtract
+static pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t *latency_base;
+static uint64_t latency_base_ms, latency_start_ms;
 
 // Helper function for listen file descriptor
-static int open_listenfd(char *port);
-int Open_listenfd(char *port);
+// With reuseport set, several sockets can listen on the same port and the
+// kernel spreads new connections between them
+static int open_listenfd(char *port, int reuseport);
+int Open_listenfd(char *port, int reuseport);
 
 static void usage(char *programme) {
     printf("Usage: %s -h\n"
            " -h Show help\n"
            " -p port to accept HTTP requests from clients\n"
-           " -R specify root directory for server under '/files' prefix\n",
-           programme);
+           " -R specify root directory for server under '/files' prefix\n"
+           " -F number of files under the root to keep open, 0 to open them on every request (default 1024)\n"
+           " -C prefix=value send Cache-Control: value for files whose path below the root starts with prefix;\n"
+           "    repeatable, the longest prefix wins (e.g. -C js/=max-age=86400 -C =no-cache)\n"
+           " -M bytes of complete responses for small files to keep in memory, 0 for none (default 16M)\n"
+           " -t ms to wait for the first byte of a request after accepting, 0 for no limit (default 10000)\n"
+           " -H ms to wait for a complete request head after its first byte (default 20000)\n"
+           " -k ms an idle keep-alive connection stays open (default 30000)\n"
+           " -w ms to wait for a client that stops reading its response (default 60000)\n"
+           " -j number of SO_REUSEPORT listeners, each with an event loop pinned to a core\n"
+           " -u use io_uring for accept, recv and send, falling back to epoll if unsupported\n"
+           " -Q shed requests once this many are waiting for a thread\n"
+           " -S shed requests while they wait in the queue longer than this many ms\n"
+           " -O what shed requests get: 503 (default, with Retry-After) or reset\n"
+           " -I ms between samples of /loadavg, /meminfo, /cpustat, /netdev and /diskstats, 0 to read them on every request (default 1000);\n"
+           "    ?max_age=ms asks for a sample at most that old; /stream?metrics=loadavg,meminfo&interval=ms pushes them\n"
+           "    /history?metric=loadavg|meminfo&since=ms keeps the last %d samples of what the widgets plot\n"
+           " -D directory to keep days of that history in, at 1s, 1m and 1h resolution; ask with &from=ms&to=ms\n"
+           " -L file to append an access log line for every request to\n"
+           " -l format of the access log: line (default) or binary, read with logdump\n",
+           programme, HISTORY_LEN);
     exit(0);
 }
 
 int main(int argc, char **argv) {
     signal(SIGPIPE, SIG_IGN);
 
-    int listenfd, connfd;
+    int listenfd;
     // char hostname[MAXLINE];
     char port[MAXLINE];
-    socklen_t clientlen;
-    struct sockaddr_storage clientaddr;
     // char *port;
 
     if (argc == 1) {
         usage(argv[0]);
     }
 
+    unsigned long max_queue = 0;
+    long sojourn_target = 0;
+    bool shed_reset = false;
+    char *log_path = NULL;
+    int log_format = ACCESSLOG_LINE;
+
     // To read the option and get the port and default path
     char c;
-    while ((c = getopt(argc, argv, "p:R:")) != -1) {
+    while ((c = getopt(argc, argv, "p:R:F:M:C:t:H:k:w:j:uQ:S:O:L:l:I:D:")) != -1) {
         switch (c) {
             case 'h': {
                 usage(argv[0]);
@@ -126,498 +400,1650 @@ int main(int argc, char **argv) {
                 path = strdup(optarg);
                 break;
             }
+            case 'F': {
+                filecache_capacity = strtoul(optarg, NULL, 10);
+                break;
+            }
+            case 'M': {
+                char *end;
+                respcache_budget = strtoul(optarg, &end, 10);
+                if (*end == 'k' || *end == 'K') {
+                    respcache_budget <<= 10;
+                } else if (*end == 'm' || *end == 'M') {
+                    respcache_budget <<= 20;
+                }
+                break;
+            }
+            case 'C': {
+                char *eq = strchr(optarg, '=');
+                if (eq == NULL || ncache_policies == CACHE_POLICIES) {
+                    usage(argv[0]);
+                }
+                cache_policies[ncache_policies].prefix = strndup(optarg, eq - optarg);
+                cache_policies[ncache_policies].value = strdup(eq + 1);
+                ncache_policies++;
+                break;
+            }
+            case 't': {
+                timeouts.first_byte_ms = strtoul(optarg, NULL, 10);
+                break;
+            }
+            case 'H': {
+                timeouts.header_ms = strtoul(optarg, NULL, 10);
+                break;
+            }
+            case 'k': {
+                timeouts.idle_ms = strtoul(optarg, NULL, 10);
+                break;
+            }
+            case 'w': {
+                timeouts.write_ms = strtoul(optarg, NULL, 10);
+                break;
+            }
+            case 'j': {
+                nshards = atoi(optarg);
+                if (nshards < 1) {
+                    printf("The number of listeners must be positive");
+                    return -1;
+                }
+                break;
+            }
+            case 'u': {
+                reactor_flags |= REACTOR_URING;
+                break;
+            }
+            case 'Q': {
+                max_queue = strtoul(optarg, NULL, 10);
+                break;
+            }
+            case 'S': {
+                sojourn_target = atol(optarg);
+                break;
+            }
+            case 'O': {
+                if (strcmp(optarg, "reset") == 0) {
+                    shed_reset = true;
+                } else if (strcmp(optarg, "503") != 0) {
+                    usage(argv[0]);
+                }
+                break;
+            }
+            case 'I': {
+                sample_interval_ms = strtoul(optarg, NULL, 10);
+                break;
+            }
+            case 'D': {
+                store_dir = strdup(optarg);
+                break;
+            }
+            case 'L': {
+                log_path = strdup(optarg);
+                break;
+            }
+            case 'l': {
+                if (strcmp(optarg, "binary") == 0) {
+                    log_format = ACCESSLOG_BINARY;
+                } else if (strcmp(optarg, "line") != 0) {
+                    usage(argv[0]);
+                }
+                break;
+            }
             default: { usage(argv[0]); }
         }
     }
 
+    router = router_new(routes, NROUTES);
+    request_counters = counters_new(NCOUNTERS);
+    for (size_t i = 0; i <= NROUTES; i++) {
+        latency_group[i] = NLATENCY_ROUTES - 1;
+        for (size_t g = 0; i < NROUTES && g < NLATENCY_ROUTES - 1; g++) {
+            if (strcmp(routes[i].path, latency_routes[g]) == 0) {
+                latency_group[i] = g;
+            }
+        }
+    }
+    latency_counters = counters_new(NLATENCY);
+    if ((latency_base = calloc(NLATENCY, sizeof(*latency_base))) == NULL) {
+        unix_error("latency calloc error");
+    }
+    latency_start_ms = latency_base_ms = wall_ms();
+
+    sampler = sampler_new(sample_interval_ms);
+    loadavg_metric = sampler_add(sampler, render_loadavg, "application/json");
+    meminfo_metric = sampler_add(sampler, render_meminfo, "application/json");
+    cpustat_metric = sampler_add(sampler, render_cpustat, "application/json");
+    netdev_metric = sampler_add(sampler, render_netdev, "application/json");
+    diskstats_metric = sampler_add(sampler, render_diskstats, "application/json");
+    for (size_t m = 0; m < NMETRICS; m++) {
+        named_metrics[m].channel = channel_new();
+        metric_listen(*named_metrics[m].metric, publish_sample, &named_metrics[m]);
+    }
+    loadavg_history = history_new(loadavg_series, NLOADAVG_SERIES, HISTORY_LEN);
+    meminfo_history = history_new(meminfo_series, NMEMINFO_SERIES, HISTORY_LEN);
+    if (store_dir != NULL &&
+        ((loadavg_store = segstore_open(store_dir, "loadavg", loadavg_series, NLOADAVG_SERIES)) == NULL ||
+         (meminfo_store = segstore_open(store_dir, "meminfo", meminfo_series, NMEMINFO_SERIES)) == NULL)) {
+        fprintf(stderr, "cannot keep history in %s: %s\n", store_dir, strerror(errno));
+        return -1;
+    }
+    sampler_on_round(sampler, record_history, NULL);
+    sampler_start(sampler);
+
     // Create thread pool for request
     pool = thread_pool_new(THREADS);
 
     // Init the memory list for allocate and free
     list_init(&memory_list);
+    list_init(&compress_pending);
 
     if (path == NULL) {
         path = "./files";
     }
+    files = filecache_new(path, filecache_capacity);
+    responses = respcache_new(respcache_budget, filecache_watching(files) ? 0 : FILECACHE_TTL_NS);
+    filecache_on_invalidate(files, invalidate_response, responses);
+
+    // The event loops own every socket and hand complete requests to the pool.
+    // With -j each loop gets its own listener on the same port and its own core,
+    // so accepting scales with the number of cores.
+    if (max_queue != 0 || sojourn_target != 0) {
+        admission = admission_new(max_queue, sojourn_target, shed_reset);
+    }
+    if (log_path != NULL && (access_log = access_log_open(log_path, log_format)) == NULL) {
+        fprintf(stderr, "cannot open access log %s: %s\n", log_path, strerror(errno));
+        return -1;
+    }
 
-    // Start to listen to one port
-    listenfd = Open_listenfd(port);
-
-    while (1) {
-        // Accept the connection and get file descriptor
-        clientlen = sizeof(clientaddr);
-
-        if ((connfd = accept(listenfd, (struct sockaddr *)&clientaddr, &clientlen)) < 0) {
-            fprintf(stderr, "Error accepting connection.\n");
-            exit(1);
+    shards = malloc(nshards * sizeof(*shards));
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+    for (i = 0; i < nshards; i++) {
+        listenfd = Open_listenfd(port, nshards > 1);
+        shards[i] = reactor_new(listenfd, pool, doit, reactor_flags);
+        reactor_set_timeouts(shards[i], &timeouts);
+        if (admission != NULL) {
+            reactor_set_admission(shards[i], admission);
+        }
+        if (access_log != NULL) {
+            reactor_set_access_log(shards[i], access_log);
         }
-        int *connfd_ptr = &connfd;
-        thread_pool_submit(pool, (fork_join_task_t)doit, connfd_ptr);
     }
+    if (nshards == 1) {
+        reactor_run(shards[0]);
+    }
+    for (i = 0; i < nshards; i++) {
+        reactor_start(shards[i], i % ncpus);
+    }
+    while (1) {
+        pause();
+    }
+
     thread_pool_shutdown_and_destroy(pool);
     return 0;
 }
 
+static void record_latency(unsigned group, unsigned phase, uint64_t ns) {
+    counters_add(latency_counters, (group * NLATENCY_PHASES + phase) * HDR_BUCKETS + hdr_index(ns / 1000), 1);
+}
+
+// Count and time what serve_request did
+void doit(struct connection *c) {
+    char *base;
+    const struct http_request *req = conn_request(c, &base);
+    const struct route *route = serve_request(c);
+    size_t row = route ? route - routes : NROUTES;
+    size_t col = 0;
+    struct conn_times t;
+    uint64_t end = now_ns();
+
+    while (col < NSTATUS - 1 && status_codes[col] != conn_status(c)) {
+        col++;
+    }
+    counters_add(request_counters, COUNTER_BYTES_IN, req->head_len);
+    counters_add(request_counters, COUNTER_BYTES_OUT, conn_bytes_queued(c));
+    counters_add(request_counters, COUNTER_REQUESTS + row * NSTATUS + col, 1);
+
+    conn_get_times(c, &t);
+    if (t.first_byte == 0) {
+        t.first_byte = end;
+    }
+    record_latency(latency_group[row], 0, t.dispatched - t.arrived);
+    record_latency(latency_group[row], 1, t.first_byte - t.dispatched);
+    record_latency(latency_group[row], 2, end - t.arrived);
+}
+
 // Process one http request
-void doit(struct thread_pool *pool, void *data) {
-    int uri_type;
+static const struct route *serve_request(struct connection *c) {
+    const struct route *route;
+    struct request_headers hdrs;
+    struct route_args args;
+    char home[] = "/files/", none[] = "";
+    unsigned method_bit;
+    char *base, *query;
+
+    // The reactor only dispatches once the whole request head is parsed;
+    // its tokens are NUL-terminated in the connection buffer
+    const struct http_request *req = conn_request(c, &base);
+    char *method = http_str(base, req->method);
+    char *uri = req->target.len ? base + req->target.off : none;
+
+    args.version = req->version.len ? base + req->version.off : "HTTP/1.0";
+
+    // If the uri is /, cat files/
+    if (strcmp(uri, "/") == 0) {
+        uri = home;
+    }
+
+    method_bit = route_method(method);
+    if (!(method_bit & router_methods(router))) {
+        clienterror(c, method, "501", "Not implemented", "Sysstatd Web server doesn't implement this method", args.version);
+        conn_set_close(c);
+        return NULL;
+    }
+
+    // The path is matched without the query, which is split up once for the handler
+    if ((query = strchr(uri, '?')) != NULL) {
+        *query++ = '\0';
+    }
+    args.path = uri;
+    args.query = query ? query : "";
+    query_parse(&args.params, args.query);
+
+    read_requesthdrs(req, base, &hdrs);
+    args.hdrs = &hdrs;
+
+    if ((route = router_lookup(router, uri)) == NULL) {
+        clienterror(c, uri, "404", "Not found", "Sysstatd Web server couldn't find this file", args.version);
+        conn_set_close(c);
+        return NULL;
+    }
+    if (!(route->methods & method_bit)) {
+        clienterror(c, method, "405", "Method Not Allowed", "Sysstatd Web server doesn't allow this method here", args.version);
+        conn_set_close(c);
+        return route;
+    }
+    route->handler(c, &args);
+
+    if (strncmp(args.version, "HTTP/1.0", 8) == 0) {
+        conn_set_close(c);
+    }
+    return route;
+}
+
+// /files/...: a file below the root
+static void serve_file(struct connection *c, struct route_args *a) {
+    struct request_headers *hdrs = a->hdrs;
+    char filename[MAXLINE];
+    struct file_entry *fe;
+    struct response *r;
+    uint64_t generation;
+
+    // filename is the normalized path below the root, "" if it tried to leave it
+    if (filecache_normalize(a->path + 6, filename, sizeof(filename)) < 0 || filename[0] == '\0') {
+        clienterror(c, a->path, "403", "Forbidden", "Sysstatd Web Server couldn't read the file", a->version);
+        conn_set_close(c);
+        return;
+    }
+    // A small file served before is one ready-made buffer, unless the
+    // client takes an encoding the file also comes in or wants a part.
+    // Conditional requests need the validators, so they go the long way.
+    bool plain = hdrs->range[0] == '\0' && hdrs->if_none_match[0] == '\0' && hdrs->if_modified_since[0] == '\0';
+    if (plain && (r = respcache_get(responses, filename)) != NULL) {
+        if (!(r->encodings & hdrs->accept_encoding)) {
+            reply_send_stored(c, r->data, r->len, release_response, r);
+            return;
+        }
+        respcache_put(r);
+    }
+    if (plain && hdrs->accept_encoding != 0 && encoding_compressible(filecache_mime(filename)) &&
+        (r = cached_variant(filename, hdrs->accept_encoding)) != NULL) {
+        reply_send_stored(c, r->data, r->len, release_response, r);
+        return;
+    }
+    generation = respcache_generation(responses);
+    if ((fe = filecache_get(files, filename)) == NULL) {
+        clienterror(c, filename, "404", "Not found", "Sysstatd Web server couldn't find this file", a->version);
+        conn_set_close(c);
+        return;
+    }
+    if (!(S_ISREG(fe->mode)) || !(S_IRUSR & fe->mode)) {
+        filecache_put(fe);
+        clienterror(c, filename, "403", "Forbidden", "Sysstatd Web server couldn’t read the file", a->version);
+        conn_set_close(c);
+        return;
+    }
+    serve_static(c, fe, generation, hdrs, a->version);
+}
+
+// /cgi-bin/...: run the program with the query string as QUERY_STRING
+static void serve_cgi(struct connection *c, struct route_args *a) {
+    char filename[MAXLINE];
     struct stat sbuf;
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-    char filename[MAXLINE], cgiargs[MAXLINE];
-    rio_t rio;
 
-    int fd = *(int *)data;
+    snprintf(filename, sizeof(filename), ".%s", a->path);
+    if (stat(filename, &sbuf) < 0) {
+        clienterror(c, filename, "404", "Not found", "Sysstatd Web server couldn't find this file", a->version);
+        conn_set_close(c);
+        return;
+    }
 
-    // Start to read the http request
-    Rio_readinitb(&rio, fd);
+    if (strstr(filename, "..") != NULL) {
+        clienterror(c, filename, "403", "Forbidden", "Sysstatd Web Server couldn't read the file", a->version);
+        conn_set_close(c);
+        return;
+    }
 
-    // while (1) {
-    //     ssize_t read =
+    if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
+        clienterror(c, filename, "403", "Forbidden", "Sysstatd Web server couldn’t run the CGI program", a->version);
+        conn_set_close(c);
+        return;
+    }
+    serve_dynamic(c, filename, (char *)a->query);
+}
 
-    while (1) {
+// The JSONP callback asked for, "" if none or if it is not a plain name
+static void jsonp_callback(struct route_args *a, char *buf, size_t size) {
+    size_t len, i;
+    const char *cb = query_get(&a->params, "callback", &len);
+
+    buf[0] = '\0';
+    if (cb == NULL || len == 0 || len >= size) {
+        return;
+    }
+    for (i = 0; i < len; i++) {
+        char ch = cb[i];
+        if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_' || ch == '.' || ch == '$')) {
+            return;
+        }
+    }
+    memcpy(buf, cb, len);
+    buf[len] = '\0';
+}
 
-        ssize_t read = Rio_readlineb(&rio, buf, MAXLINE);
+// Append one member to the JSON object being written into json, only if
+// it fits whole with room left for the closing brace; false if it did not.
+// A machine with more cpus or disks than a snapshot holds gets the first
+// ones that fit instead of no snapshot at all.
+static bool json_member(char *json, size_t size, size_t *len, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static bool json_member(char *json, size_t size, size_t *len, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(json + *len, size - *len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || *len + n + 1 >= size) {
+        json[*len] = '\0';
+        return false;
+    }
+    *len += n;
+    return true;
+}
+
+// /proc/loadavg as json, for the sampler
+static size_t render_loadavg(char *json, size_t size) {
+    struct proc_loadavg la;
 
-        if (read <= 0) {
+    if (proc_loadavg(&la) < 0) {
+        return 0;
+    }
+    return snprintf(json, size,
+                    "{\"total_threads\": \"%u\", \"loadavg\": [\"%u.%02u\", \"%u.%02u\", \"%u.%02u\"], \"running_threads\": \"%u\"}",
+                    la.total, la.load[0] / 100, la.load[0] % 100, la.load[1] / 100, la.load[1] % 100,
+                    la.load[2] / 100, la.load[2] % 100, la.running);
+}
+
+// /proc/meminfo as json, for the sampler
+static size_t render_meminfo(char *json, size_t size) {
+    struct proc_meminfo entries[MAX_MEMINFO];
+    int n, i;
+    size_t len;
+
+    if ((n = proc_meminfo(entries, MAX_MEMINFO)) < 0) {
+        return 0;
+    }
+    len = snprintf(json, size, "{");
+    for (i = 0; i < n; i++) {
+        if (!json_member(json, size, &len, "%s\"%s\": \"%lu\"", i ? "," : "", entries[i].name,
+                         (unsigned long)entries[i].value)) {
             break;
         }
+    }
+    len += snprintf(json + len, size - len, "}");
+    return len;
+}
 
-        sscanf(buf, "%s %s %s", method, uri, version);
+// /proc/stat cpu lines as json, ticks per state for all cpus and each one
+static size_t render_cpustat(char *json, size_t size) {
+    struct proc_cpu cpus[MAX_CPUS];
+    int n, i;
+    size_t len;
 
-        // If the uri is /, cat files/
-        if (strcmp(uri, "/") == 0) {
-            strcat(uri, "files/");
+    if ((n = proc_cpustat(cpus, MAX_CPUS)) < 0) {
+        return 0;
+    }
+    len = snprintf(json, size, "{");
+    for (i = 0; i < n; i++) {
+        struct proc_cpu *c = &cpus[i];
+        char name[16] = "cpu";
+
+        if (c->cpu >= 0) {
+            snprintf(name, sizeof(name), "cpu%d", c->cpu);
+        }
+        if (!json_member(json, size, &len,
+                         "%s\"%s\": {\"user\": %lu, \"nice\": %lu, \"system\": %lu, \"idle\": %lu, \"iowait\": %lu, "
+                         "\"irq\": %lu, \"softirq\": %lu, \"steal\": %lu, \"guest\": %lu, \"guest_nice\": %lu}",
+                         i ? ", " : "", name, (unsigned long)c->user, (unsigned long)c->nice, (unsigned long)c->system,
+                         (unsigned long)c->idle, (unsigned long)c->iowait, (unsigned long)c->irq, (unsigned long)c->softirq,
+                         (unsigned long)c->steal, (unsigned long)c->guest, (unsigned long)c->guest_nice)) {
+            break;
         }
+    }
+    len += snprintf(json + len, size - len, "}");
+    return len;
+}
 
-        if (strcasecmp(method, "GET")) {
-            clienterror(fd, method, "501", "Not implemented", "Sysstatd Web server doesn't implement this method", version);
-            close(fd);
-            return;
+// /proc/net/dev as json, counters per interface
+static size_t render_netdev(char *json, size_t size) {
+    struct proc_netdev devs[MAX_NETDEVS];
+    int n, i;
+    size_t len;
+
+    if ((n = proc_netdev(devs, MAX_NETDEVS)) < 0) {
+        return 0;
+    }
+    len = snprintf(json, size, "{");
+    for (i = 0; i < n; i++) {
+        struct proc_netdev *d = &devs[i];
+        if (!json_member(json, size, &len,
+                         "%s\"%s\": {\"rx_bytes\": %lu, \"rx_packets\": %lu, \"rx_errs\": %lu, \"rx_drop\": %lu, "
+                         "\"tx_bytes\": %lu, \"tx_packets\": %lu, \"tx_errs\": %lu, \"tx_drop\": %lu}",
+                         i ? ", " : "", d->name, (unsigned long)d->rx_bytes, (unsigned long)d->rx_packets,
+                         (unsigned long)d->rx_errs, (unsigned long)d->rx_drop, (unsigned long)d->tx_bytes,
+                         (unsigned long)d->tx_packets, (unsigned long)d->tx_errs, (unsigned long)d->tx_drop)) {
+            break;
         }
+    }
+    len += snprintf(json + len, size - len, "}");
+    return len;
+}
 
-        read_requesthdrs(&rio);
+// /proc/diskstats as json, counters per block device
+static size_t render_diskstats(char *json, size_t size) {
+    struct proc_disk disks[MAX_DISKS];
+    int n, i;
+    size_t len;
 
-        if ((uri_type = parse_uri(uri, filename, cgiargs)) < 0) {
-            clienterror(fd, filename, "404", "Not found", "Sysstatd Web server couldn't find this file", version);
-            close(fd);
+    if ((n = proc_diskstats(disks, MAX_DISKS)) < 0) {
+        return 0;
+    }
+    len = snprintf(json, size, "{");
+    for (i = 0; i < n; i++) {
+        struct proc_disk *d = &disks[i];
+        if (!json_member(json, size, &len,
+                         "%s\"%s\": {\"major\": %u, \"minor\": %u, \"reads\": %lu, \"reads_merged\": %lu, "
+                         "\"sectors_read\": %lu, \"read_ms\": %lu, \"writes\": %lu, \"writes_merged\": %lu, "
+                         "\"sectors_written\": %lu, \"write_ms\": %lu, \"in_flight\": %lu, \"io_ms\": %lu, "
+                         "\"weighted_io_ms\": %lu}",
+                         i ? ", " : "", d->name, d->major, d->minor, (unsigned long)d->reads,
+                         (unsigned long)d->reads_merged, (unsigned long)d->sectors_read, (unsigned long)d->read_ms,
+                         (unsigned long)d->writes, (unsigned long)d->writes_merged, (unsigned long)d->sectors_written,
+                         (unsigned long)d->write_ms, (unsigned long)d->in_flight, (unsigned long)d->io_ms,
+                         (unsigned long)d->weighted_io_ms)) {
+            break;
+        }
+    }
+    len += snprintf(json + len, size - len, "}");
+    return len;
+}
+
+// Send the current snapshot of m, wrapped in the callback if one was asked
+// for.  ?max_age=ms asks for a sample no older than that, taken now if need be.
+static void serve_metric(struct connection *c, struct route_args *a, struct metric *m) {
+    uint64_t max_age = sample_interval_ms ? UINT64_MAX : 0;
+    const char *v;
+    char callback[256];
+    struct snapshot *snap;
+    const char *body;
+    size_t len, n;
+    struct reply rp;
+
+    if ((v = query_get(&a->params, "max_age", &n)) != NULL) {
+        max_age = strtoull(v, NULL, 10) * 1000000ULL;
+    }
+    if ((snap = metric_get(m, max_age)) == NULL) {
+        clienterror(c, a->path, "403", "Forbidden", "Sysstatd Web Server couldn't read the file", a->version);
+        return;
+    }
+    jsonp_callback(a, callback, sizeof(callback));
+
+    // The common case is the snapshot as it is, head and all
+    if (callback[0] == '\0' && strncmp(a->version, "HTTP/1.1", 8) == 0) {
+        reply_send_stored(c, snap->data, snap->len, snapshot_put, snap);
+        return;
+    }
+    body = snapshot_body(snap, &len);
+    reply_start(&rp, a->version, "200 OK", true);
+    reply_header(&rp, "Content-Type: %s", callback[0] ? "application/javascript" : "application/json");
+    reply_header(&rp, "Content-Length: %zu", len + (callback[0] ? strlen(callback) + 2 : 0));
+    if (strncmp(a->version, "HTTP/1.0", strlen("HTTP/1.0")) == 0) {
+        reply_header(&rp, "Connection: close");
+    }
+    reply_finish(&rp);
+    reply_write_head(&rp, c);
+    if (callback[0]) {
+        conn_write(c, callback, strlen(callback));
+        conn_write(c, "(", 1);
+    }
+    conn_write_ref(c, body, len, snapshot_put, snap);
+    if (callback[0]) {
+        conn_write(c, ")", 1);
+    }
+}
+
+static void serve_loadavg(struct connection *c, struct route_args *a) {
+    serve_metric(c, a, loadavg_metric);
+}
+
+static void serve_meminfo(struct connection *c, struct route_args *a) {
+    serve_metric(c, a, meminfo_metric);
+}
+
+static void serve_cpustat(struct connection *c, struct route_args *a) {
+    serve_metric(c, a, cpustat_metric);
+}
+
+static void serve_netdev(struct connection *c, struct route_args *a) {
+    serve_metric(c, a, netdev_metric);
+}
+
+static void serve_diskstats(struct connection *c, struct route_args *a) {
+    serve_metric(c, a, diskstats_metric);
+}
+
+// Where the metric called name is in named_metrics, -1 if there is none
+static int metric_index(const char *name, size_t len) {
+    size_t i;
+
+    for (i = 0; i < NMETRICS; i++) {
+        if (strlen(named_metrics[i].name) == len && memcmp(named_metrics[i].name, name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// An event named name with data, which goes on one data: line per line
+static char *sse_event(const char *name, const char *data, size_t len, size_t *event_len) {
+    size_t lines = 1, i, n;
+    char *ev;
+
+    for (i = 0; i < len; i++) {
+        lines += data[i] == '\n';
+    }
+    if ((ev = malloc(strlen(name) + len + 7 * lines + 16)) == NULL) {
+        return NULL;
+    }
+    n = sprintf(ev, "event: %s\ndata: ", name);
+    for (i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            memcpy(ev + n, "\ndata: ", 7);
+            n += 7;
+        } else {
+            ev[n++] = data[i];
+        }
+    }
+    ev[n++] = '\n';
+    ev[n++] = '\n';
+    *event_len = n;
+    return ev;
+}
+
+static void publish_sample(struct snapshot *snap, void *arg) {
+    struct named_metric *sm = arg;
+    const char *body;
+    size_t len, n;
+    char *ev;
+
+    if (!channel_has_subscribers(sm->channel)) {
+        return;
+    }
+    body = snapshot_body(snap, &len);
+    if ((ev = sse_event(sm->name, body, len, &n)) != NULL) {
+        channel_publish(sm->channel, ev, n, free, ev);
+    }
+}
+
+// /stream?metrics=loadavg,meminfo&interval=ms: server-sent events with the
+// current sample of each metric, then a new one every interval, on the one
+// connection.  Without metrics= every metric is sent.
+static void serve_stream(struct connection *c, struct route_args *a) {
+    bool want[NMETRICS];
+    unsigned interval = sample_interval_ms, every;
+    const char *v, *name, *end;
+    size_t len, i, n;
+    struct reply rp;
+    int m;
+
+    if (sample_interval_ms == 0) {
+        clienterror(c, a->path, "503", "Service Unavailable", "Streams need the metrics sampled in the background, see -I", a->version);
+        return;
+    }
+    memset(want, (v = query_get(&a->params, "metrics", &len)) == NULL, sizeof(want));
+    for (name = v; v != NULL && name < v + len; name = end + 1) {
+        if ((end = memchr(name, ',', v + len - name)) == NULL) {
+            end = v + len;
+        }
+        if ((m = metric_index(name, end - name)) < 0) {
+            clienterror(c, a->path, "404", "Not found", "Sysstatd Web server has no such metric", a->version);
             return;
         }
+        want[m] = true;
+    }
+    // Events go out as samples are taken, so the interval is rounded to a
+    // multiple of -I
+    if ((v = query_get(&a->params, "interval", &len)) != NULL) {
+        interval = strtoul(v, NULL, 10);
+    }
+    every = (interval + sample_interval_ms / 2) / sample_interval_ms;
 
-        if (uri_type == STATIC || uri_type == DYNAMIC) {
-            if (stat(filename, &sbuf) < 0) {
-                clienterror(fd, filename, "404", "Not found", "Sysstatd Web server couldn't find this file", version);
-                close(fd);
+    reply_start(&rp, a->version, "200 OK", true);
+    reply_header(&rp, "Content-Type: text/event-stream");
+    reply_header(&rp, "Cache-Control: no-cache");
+    reply_header(&rp, "Access-Control-Allow-Origin: *");
+    reply_finish(&rp);
+    reply_write_head(&rp, c);
 
-                return;
+    for (i = 0; i < NMETRICS; i++) {
+        struct snapshot *snap;
+        const char *body;
+        char *ev;
+
+        if (!want[i]) {
+            continue;
+        }
+        if ((snap = metric_get(*named_metrics[i].metric, UINT64_MAX)) != NULL) {
+            body = snapshot_body(snap, &len);
+            if ((ev = sse_event(named_metrics[i].name, body, len, &n)) != NULL) {
+                conn_write_ref(c, ev, n, free, ev);
             }
+            snapshot_put(snap);
+        }
+        conn_subscribe(c, named_metrics[i].channel, every);
+    }
+}
 
-            if (strstr(filename, "..") != NULL) {
-                clienterror(fd, filename, "403", "Forbidden", "Sysstatd Web Server couldn't read the file", version);
-                close(fd);
+// /metrics.json?fields=loadavg,meminfo.MemFree: the fields asked for of
+// several metrics in one object, all from one sampling round, e.g.
+// {"loadavg": {...}, "meminfo": {"MemFree": "..."}}.  Every metric whole
+// without fields=.
+static void serve_metrics_json(struct connection *c, struct route_args *a) {
+    struct projection proj;
+    struct metric *ms[NMETRICS];
+    struct snapshot *snaps[NMETRICS];
+    int fields[NMETRICS];
+    char callback[256];
+    const char *v, *body;
+    size_t len, size, n = 0;
+    struct reply rp;
+    char *json;
+    int nms = 0, i;
+
+    if ((v = query_get(&a->params, "fields", &len)) == NULL) {
+        v = "loadavg,meminfo,cpustat,netdev,diskstats";
+        len = strlen(v);
+    }
+    if (!projection_parse(&proj, v, len)) {
+        clienterror(c, a->path, "400", "Bad Request",
+                    "Sysstatd Web server takes fewer fields, named with letters, digits, _, - and ()", a->version);
+        return;
+    }
+    for (i = 0; i < proj.n; i++) {
+        int m;
 
-                return;
-            }
+        if (proj.fields[i].parent != -1) {
+            continue;
+        }
+        if ((m = metric_index(proj.fields[i].name, proj.fields[i].len)) < 0) {
+            clienterror(c, a->path, "404", "Not found", "Sysstatd Web server has no such metric", a->version);
+            return;
+        }
+        fields[nms] = i;
+        ms[nms++] = *named_metrics[m].metric;
+    }
+    if (!metrics_get(ms, nms, snaps)) {
+        clienterror(c, a->path, "403", "Forbidden", "Sysstatd Web Server couldn't read the file", a->version);
+        return;
+    }
+    jsonp_callback(a, callback, sizeof(callback));
+
+    // The projection is never longer than the bodies plus the names and
+    // nulls the fields add
+    size = strlen(callback) + 2 * len + 16 * PROJECTION_MAX + 16;
+    for (i = 0; i < nms; i++) {
+        snapshot_body(snaps[i], &len);
+        size += len;
+    }
+    if ((json = malloc(size)) != NULL) {
+        n = snprintf(json, size, "%s%s{", callback, callback[0] ? "(" : "");
+        for (i = 0; i < nms; i++) {
+            const struct projection_field *f = &proj.fields[fields[i]];
+
+            body = snapshot_body(snaps[i], &len);
+            n += snprintf(json + n, size - n, "%s\"%.*s\": ", i ? ", " : "", (int)f->len, f->name);
+            n += projection_write(&proj, fields[i], body, len, json + n, size - n);
+        }
+        n += snprintf(json + n, size - n, "}%s", callback[0] ? ")" : "");
+    }
+    for (i = 0; i < nms; i++) {
+        snapshot_put(snaps[i]);
+    }
+    if (json == NULL) {
+        clienterror(c, a->path, "500", "Internal Server Error", "Sysstatd Web server is out of memory", a->version);
+        return;
+    }
 
-            if (uri_type == STATIC) {
-                if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {
-                    clienterror(fd, filename, "403", "Forbidden", "Sysstatd Web server couldn’t read the file", version);
-                    close(fd);
+    reply_start(&rp, a->version, "200 OK", true);
+    reply_header(&rp, "Content-Type: %s", callback[0] ? "application/javascript" : "application/json");
+    reply_header(&rp, "Content-Length: %zu", n);
+    if (strncmp(a->version, "HTTP/1.0", strlen("HTTP/1.0")) == 0) {
+        reply_header(&rp, "Connection: close");
+    }
+    reply_send_ref(&rp, c, json, n, free, json);
+}
 
-                    return;
-                }
-                serve_static(fd, filename, sbuf.st_size);
-            } else if (uri_type == DYNAMIC) {
-                if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
-                    clienterror(fd, filename, "403", "Forbidden", "Sysstatd Web server couldn’t run the CGI program", version);
-                    close(fd);
+static uint64_t wall_ms(void) {
+    struct timespec ts;
 
-                    return;
-                }
-                serve_dynamic(fd, filename, cgiargs);
-            }
-        } else if (uri_type == LOADAVG) {
-            // cigargs is the callback function
-            FILE *fp = fopen("/proc/loadavg", "r");
-            if (fp) {
-                char buf[256];
-                fgets(buf, sizeof(buf), fp);
-
-                float utilization0, utilization1, utilization2;
-                int running;
-                char separate;
-                int total;
-
-                sscanf(buf, "%f %f %f %d %c %d", &utilization0, &utilization1, &utilization2, &running, &separate, &total);
-
-                char return_json[256];
-                sprintf(return_json,
-                        "{\"total_threads\": \"%d\", \"loadavg\": [\"%.2f\", \"%.2f\", \"%.2f\"], \"running_threads\": \"%d\"}",
-                        total, utilization0, utilization1, utilization2, running);
-
-                if (strlen(cgiargs) != 0) { // has callback
-                    char callback_buf[256];
-                    sprintf(callback_buf, "%s(%s)", cgiargs, return_json);
-                    send_response(fd, callback_buf, "application/javascript", version);
-                } else {
-                    send_response(fd, return_json, "application/json", version);
-                }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-            } else {
-                clienterror(fd, filename, "403", "Forbidden", "Sysstatd Web Server couldn't read the file", version);
-            }
-            fclose(fp);
-
-        } else if (uri_type == MEMINFO) {
-            // cgiargs is the callback function
-
-            FILE *fp = fopen("/proc/meminfo", "r");
-            if (fp) {
-                char line[128];
-                char mem_info[1024];
-                strcpy(mem_info, "{");
-                int begin = 1;
-
-                while (fgets(line, sizeof(line), fp)) {
-                    if (!begin) {
-                        strcat(mem_info, ",");
-                    }
-
-                    char key[64];
-                    long value;
-                    char kb[8];
-                    char json_line[128];
-
-                    sscanf(line, "%s %lu %s", key, &value, kb);
-                    key[strlen(key) - 1] = '\0';
-                    sprintf(json_line, "\"%s\": \"%lu\"", key, value);
-                    strcat(mem_info, json_line);
-                    begin = 0;
-                }
-                strcat(mem_info, "}");
-
-                if (strlen(cgiargs) != 0) { // has callback
-                    char callback_buf[256];
-                    sprintf(callback_buf, "%s(%s)", cgiargs, mem_info);
-                    send_response(fd, callback_buf, "application/javascript", version);
-                } else {
-                    send_response(fd, mem_info, "application/json", version);
+static void record_history(void *arg) {
+    struct proc_loadavg la;
+    struct proc_meminfo entries[MAX_MEMINFO];
+    int64_t values[NMEMINFO_SERIES];
+    uint64_t now_ms = wall_ms();
+    int n, i;
+    size_t s;
+
+    // A series that cannot be read now gets no sample rather than a gap
+    if (proc_loadavg(&la) >= 0) {
+        int64_t load[NLOADAVG_SERIES] = { la.load[0], la.load[1], la.load[2], la.running, la.total };
+        history_append(loadavg_history, now_ms, load);
+        if (loadavg_store != NULL) {
+            segstore_append(loadavg_store, now_ms, load);
+        }
+    }
+    if ((n = proc_meminfo(entries, MAX_MEMINFO)) >= 0) {
+        for (s = 0; s < NMEMINFO_SERIES; s++) {
+            values[s] = 0;
+            for (i = 0; i < n; i++) {
+                if (strcmp(entries[i].name, meminfo_series[s]) == 0) {
+                    values[s] = entries[i].value;
+                    break;
                 }
-            } else {
-                clienterror(fd, filename, "403", "Forbidden", "Sysstatd Web Server couldn't read the file", version);
-            }
-            fclose(fp);
-
-        } else if (uri_type == RUNLOOP) {
-            send_response(fd, "<html>\n<body>\n<p>Started 15 second's loop.</p>\n</body>\n</html>", "text/html", version);
-            thread_pool_submit(pool, (fork_join_task_t)run_loop, (int *)0);
-        } else if (uri_type == ALLOCANON) {
-            void *mem_block = mmap(NULL, 268435456, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-            if (mem_block == MAP_FAILED) {
-                fprintf(stderr, "mmap() failed %s\n", strerror(errno));
-            } else {
-                struct memory *memory_struct = (struct memory *)malloc(sizeof(struct memory));
-                memory_struct->block = mem_block;
-                list_push_back(&memory_list, &memory_struct->elem);
-                send_response(fd, "<html>\n<body>\n<p>Allocated 256Mb memory.</p>\n</body>\n</html>", "text/html", version);
             }
-        } else if (uri_type == FREEANON) {
-            if (list_size(&memory_list) > 0) {
-                struct list_elem *e = list_pop_back(&memory_list);
-                struct memory *mem = list_entry(e, struct memory, elem);
-
-                if (munmap(mem->block, 268435456) == 0) {
-                    send_response(fd, "<html>\n<body>\n<p>Freed 256Mb memory.</p>\n</body>\n</html>", "text/html", version);
-                } else {
-                    fprintf(stderr, "munmap() failed %s\n", strerror(errno));
-                }
+        }
+        history_append(meminfo_history, now_ms, values);
+        if (meminfo_store != NULL) {
+            segstore_append(meminfo_store, now_ms, values);
+        }
+    }
+}
 
-            } else {
-                send_response(fd, "<html>\n<body>\n<p>No memory to free.</p>\n</body>\n</html>", "text/html", version);
-            }
+// /history?metric=loadavg&since=ms: the samples kept of the metric's series
+// taken after since (ms since the epoch), delta-encoded, see history.h.
+// With -D, &from=ms&to=ms&points=n asks the store for min, max and avg over
+// a longer range instead, see segstore.h.  Load averages are in hundredths,
+// memory in kB.
+static void serve_history(struct connection *c, struct route_args *a) {
+    struct history *h = NULL;
+    struct segstore *st = NULL;
+    uint64_t since = 0;
+    char callback[256];
+    const char *v;
+    size_t len;
+    struct reply rp;
+    char *json;
+
+    if ((v = query_get(&a->params, "metric", &len)) != NULL) {
+        if (len == strlen("loadavg") && memcmp(v, "loadavg", len) == 0) {
+            h = loadavg_history;
+            st = loadavg_store;
+        } else if (len == strlen("meminfo") && memcmp(v, "meminfo", len) == 0) {
+            h = meminfo_history;
+            st = meminfo_store;
         }
-        if (strncmp(version, "HTTP/1.0", 8) == 0) {
-            break;
+    }
+    if (h == NULL) {
+        clienterror(c, a->path, "404", "Not found", "Sysstatd Web server keeps history of metric=loadavg and metric=meminfo", a->version);
+        return;
+    }
+    if ((v = query_get(&a->params, "from", &len)) != NULL) {
+        uint64_t from = strtoull(v, NULL, 10), to = UINT64_MAX;
+        unsigned points = HISTORY_POINTS;
+
+        if (st == NULL) {
+            clienterror(c, a->path, "404", "Not found", "Sysstatd Web server keeps no history on disk, see -D", a->version);
+            return;
+        }
+        if ((v = query_get(&a->params, "to", &len)) != NULL) {
+            to = strtoull(v, NULL, 10);
+        }
+        if ((v = query_get(&a->params, "points", &len)) != NULL) {
+            unsigned long n = strtoul(v, NULL, 10);
+            points = n == 0 ? 1 : n > HISTORY_POINTS_MAX ? HISTORY_POINTS_MAX : n;
         }
+        json = segstore_query(st, from, to, points, &len);
+    } else {
+        if ((v = query_get(&a->params, "since", &len)) != NULL) {
+            since = strtoull(v, NULL, 10);
+        }
+        json = history_json(h, since, &len);
+    }
+    if (json == NULL) {
+        clienterror(c, a->path, "500", "Internal Server Error", "Sysstatd Web server is out of memory", a->version);
+        return;
+    }
+    jsonp_callback(a, callback, sizeof(callback));
+
+    reply_start(&rp, a->version, "200 OK", true);
+    reply_header(&rp, "Content-Type: %s", callback[0] ? "application/javascript" : "application/json");
+    reply_header(&rp, "Content-Length: %zu", len + (callback[0] ? strlen(callback) + 2 : 0));
+    if (strncmp(a->version, "HTTP/1.0", strlen("HTTP/1.0")) == 0) {
+        reply_header(&rp, "Connection: close");
+    }
+    reply_finish(&rp);
+    reply_write_head(&rp, c);
+    if (callback[0]) {
+        conn_write(c, callback, strlen(callback));
+        conn_write(c, "(", 1);
+    }
+    conn_write_ref(c, json, len, free, json);
+    if (callback[0]) {
+        conn_write(c, ")", 1);
     }
-    close(fd);
 }
 
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg, char *version) {
-    char buf[MAXLINE], body[MAXBUF];
+static void serve_runloop(struct connection *c, struct route_args *a) {
+    send_response(c, "<html>\n<body>\n<p>Started 15 second's loop.</p>\n</body>\n</html>", "text/html", a->version);
+    thread_pool_execute(pool, run_loop, NULL);
+}
 
-    /* Print the HTTP response */
-    sprintf(buf, "%s %s %s\r\n", version, errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
+static void serve_allocanon(struct connection *c, struct route_args *a) {
+    void *mem_block = mmap(NULL, 268435456, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem_block == MAP_FAILED) {
+        fprintf(stderr, "mmap() failed %s\n", strerror(errno));
+    } else {
+        struct memory *memory_struct = (struct memory *)malloc(sizeof(struct memory));
+        memory_struct->block = mem_block;
+        list_push_back(&memory_list, &memory_struct->elem);
+        send_response(c, "<html>\n<body>\n<p>Allocated 256Mb memory.</p>\n</body>\n</html>", "text/html", a->version);
+    }
+}
+
+static void serve_freeanon(struct connection *c, struct route_args *a) {
+    if (list_size(&memory_list) > 0) {
+        struct list_elem *e = list_pop_back(&memory_list);
+        struct memory *mem = list_entry(e, struct memory, elem);
+
+        if (munmap(mem->block, 268435456) == 0) {
+            send_response(c, "<html>\n<body>\n<p>Freed 256Mb memory.</p>\n</body>\n</html>", "text/html", a->version);
+        } else {
+            fprintf(stderr, "munmap() failed %s\n", strerror(errno));
+        }
 
-    sprintf(buf, "Content-type: text/html\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    } else {
+        send_response(c, "<html>\n<body>\n<p>No memory to free.</p>\n</body>\n</html>", "text/html", a->version);
+    }
+}
 
-    sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-    Rio_writen(fd, buf, strlen(buf));
+void clienterror(struct connection *c, char *cause, char *errnum, char *shortmsg, char *longmsg, char *version) {
+    char status[MAXLINE], body[MAXBUF];
+    struct reply rp;
 
     /* Build the HTTP response body */
-    sprintf(body, "<html><title>Tiny Error</title>");
-    sprintf(body, "%s<body bgcolor="
-                  "ffffff"
-                  ">\r\n",
-            body);
-    sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-    sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-    sprintf(body, "%s<hr><em>The Sysstatd Web server</em>\r\n", body);
-    Rio_writen(fd, body, strlen(body));
-}
-
-void read_requesthdrs(rio_t *rp) {
-    char buf[MAXLINE];
-
-    Rio_readlineb(rp, buf, MAXLINE);
-    while (strcmp(buf, "\r\n")) {
-        printf("%s", buf);
-        ssize_t size = Rio_readlineb(rp, buf, MAXLINE);
-        if (size < 0) {
-            break;
+    snprintf(body, sizeof(body),
+             "<html><title>Tiny Error</title>"
+             "<body bgcolor=ffffff>\r\n"
+             "%s: %s\r\n"
+             "<p>%s: %.4096s\r\n"
+             "<hr><em>The Sysstatd Web server</em>\r\n",
+             errnum, shortmsg, longmsg, cause);
+
+    /* Print the HTTP response */
+    snprintf(status, sizeof(status), "%s %s", errnum, shortmsg);
+    reply_start(&rp, version, status, true);
+    reply_header(&rp, "Content-type: text/html");
+    reply_header(&rp, "Content-length: %d", (int)strlen(body));
+    reply_send(&rp, c, body, strlen(body));
+}
+
+// Copy a header value without the surrounding blanks and line end; a value
+// that does not fit is dropped rather than cut short
+static void header_value(const char *value, char *out, size_t len) {
+    size_t n;
+
+    value += strspn(value, " \t");
+    n = strcspn(value, "\r\n");
+    while (n > 0 && (value[n - 1] == ' ' || value[n - 1] == '\t')) {
+        n--;
+    }
+    if (n >= len) {
+        n = 0;
+    }
+    memcpy(out, value, n);
+    out[n] = '\0';
+}
+
+void read_requesthdrs(const struct http_request *req, char *base, struct request_headers *hdrs) {
+    hdrs->accept_encoding = 0;
+    hdrs->range[0] = '\0';
+    hdrs->if_range[0] = '\0';
+    hdrs->if_none_match[0] = '\0';
+    hdrs->if_modified_since[0] = '\0';
+
+    for (unsigned i = 0; i < req->nheaders; i++) {
+        char *name = http_str(base, req->headers[i].name);
+        char *value = http_str(base, req->headers[i].value);
+
+        if (strcasecmp(name, "Accept-Encoding") == 0) {
+            hdrs->accept_encoding = encoding_accepted(value);
+        } else if (strcasecmp(name, "Range") == 0) {
+            header_value(value, hdrs->range, sizeof(hdrs->range));
+        } else if (strcasecmp(name, "If-Range") == 0) {
+            header_value(value, hdrs->if_range, sizeof(hdrs->if_range));
+        } else if (strcasecmp(name, "If-None-Match") == 0) {
+            header_value(value, hdrs->if_none_match, sizeof(hdrs->if_none_match));
+        } else if (strcasecmp(name, "If-Modified-Since") == 0) {
+            header_value(value, hdrs->if_modified_since, sizeof(hdrs->if_modified_since));
         }
     }
     return;
 }
 
-// Parse uri into file name and cgiargs. For both static and dynamic
-// If it is static, filename will be the path of that file in server, cgiargs will be ""
-// If it is dynamic, filename will be the path of that cgi file in the server, cgiargs will be arguments of the excutable
-// If it is /loadavg or /meminfo, filename will be "", cgiargs will be the callback function
-// If it is /runloop, /alloanno or /freeannon, filename will be "", cigargs will be ""
-int parse_uri(char *uri, char *filename, char *cgiargs) {
-    // If it contains /loadavg
-    if (strncmp(uri, "/loadavg", strlen("/loadavg")) == 0) {
-        strcpy(filename, "");
+// The reactor is done sending a cached file
+static void release_file(void *data) {
+    filecache_put(data);
+}
 
-        // /loadavgjunk  /loadavg/junk
-        if (*(uri + 8) != '?' && *(uri + 8) != '\0') {
-            return -1;
-        }
+// The reactor is done sending a cached response
+static void release_response(void *data) {
+    respcache_put(data);
+}
 
-        char *ptr = index(uri, '?');
-        fflush(stdout);
-        if (ptr) {        // if has arguments(?callback=)
-            while (ptr) { // find the posistion of callback=
-                ptr++;
-                if (strncmp(ptr, "callback=", strlen("callback=")) == 0) {
-                    ptr = index(ptr, '=');
-                    ptr++;
-
-                    int legal_callback = 0;
-                    int i = 0;
-                    while (*ptr && *ptr != '&') {
-                        char c = *ptr;
-                        if ((c >= 'a' && c <= 'z') || (c >= 'A' || c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.') {
-                            cgiargs[i] = *ptr;
-                            ptr++;
-                            i++;
-                        } else {
-                            legal_callback = 1;
-                        }
-                    }
-                    if (legal_callback == 0) {
-                        cgiargs[i] = '\0';
-                        return LOADAVG;
-                    } else {
-                        strcpy(cgiargs, "");
-                        return LOADAVG;
-                    }
-                } else {
-                    ptr = index(ptr, '&');
-                    if (ptr == NULL) {
-                        strcpy(cgiargs, "");
-                        return LOADAVG;
-                    }
-                }
+// The file cache saw a file change; its compressed variants go with it
+static void invalidate_response(void *arg, const char *key) {
+    char vkey[MAXLINE];
+
+    respcache_invalidate(arg, key);
+    if (key != NULL) {
+        variant_key(vkey, sizeof(vkey), key, ENCODING_GZIP);
+        respcache_invalidate(arg, vkey);
+        variant_key(vkey, sizeof(vkey), key, ENCODING_BR);
+        respcache_invalidate(arg, vkey);
+    }
+}
+
+static struct response *cached_variant(const char *key, unsigned accept) {
+    static const unsigned preference[] = { ENCODING_BR, ENCODING_GZIP };
+    char vkey[MAXLINE];
+    struct response *r;
+    int i;
+
+    for (i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+        if (accept & preference[i]) {
+            variant_key(vkey, sizeof(vkey), key, preference[i]);
+            if ((r = respcache_get(responses, vkey)) != NULL) {
+                return r;
             }
-        } else {
-            strcpy(cgiargs, "");
-            return LOADAVG;
         }
-        return LOADAVG;
-    } else if (strncmp(uri, "/meminfo", strlen("/meminfo")) == 0) {
-        strcpy(filename, "");
+    }
+    return NULL;
+}
 
-        if (*(uri + 8) != '?' && *(uri + 8) != '\0') {
-            return -1;
+// The encodings fe can be sent in besides identity
+static unsigned file_encodings(struct file_entry *fe) {
+    unsigned encodings = fe->sidecars;
+
+    // Without a gzip sidecar, gzip it ourselves if the result can be kept,
+    // unless that was tried on this version of the file and did not pay
+    if (encoding_compressible(fe->mime) && fe->size >= ENCODING_MIN_SIZE &&
+        !__atomic_load_n(&fe->gzip_failed, __ATOMIC_RELAXED) && respcache_fits(responses, fe->size)) {
+        encodings |= ENCODING_GZIP;
+    }
+    return encodings;
+}
+
+// Strong validator of one representation of fe: inode, size and mtime,
+// plus the content coding, since each coding has different bytes
+static void file_etag(struct file_entry *fe, unsigned encoding, char *buf, size_t len) {
+    snprintf(buf, len, "\"%llx-%llx-%llx%s%s\"",
+             (unsigned long long)fe->ino, (unsigned long long)fe->size,
+             (unsigned long long)fe->mtime.tv_sec * 1000000000ULL + fe->mtime.tv_nsec,
+             encoding ? "-" : "", encoding ? encoding_name(encoding) : "");
+}
+
+// The -C value for key, longest matching prefix first; NULL if none
+static const char *cache_control(const char *key) {
+    const char *value = NULL;
+    size_t best = 0;
+    int i;
+
+    for (i = 0; i < ncache_policies; i++) {
+        size_t n = strlen(cache_policies[i].prefix);
+        if (strncmp(key, cache_policies[i].prefix, n) == 0 && (value == NULL || n > best)) {
+            value = cache_policies[i].value;
+            best = n;
         }
+    }
+    return value;
+}
 
-        char *ptr = index(uri, '?');
-        fflush(stdout);
-
-        if (ptr) {        // if has arguments(?callback=)
-            while (ptr) { // find the posistion of callback=
-                ptr++;
-                if (strncmp(ptr, "callback=", strlen("callback=")) == 0) {
-                    ptr = index(ptr, '=');
-                    ptr++;
-
-                    int legal_callback = 0;
-                    int i = 0;
-                    while (*ptr && *ptr != '&') {
-                        char c = *ptr;
-                        if ((c >= 'a' && c <= 'z') || (c >= 'A' || c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.') {
-                            cgiargs[i] = *ptr;
-                            ptr++;
-                            i++;
-                        } else {
-                            legal_callback = 1;
-                        }
-                    }
-                    if (legal_callback == 0) {
-                        cgiargs[i] = '\0';
-                        return MEMINFO;
-                    } else {
-                        strcpy(cgiargs, "");
-                        return MEMINFO;
-                    }
-                } else {
-                    ptr = index(ptr, '&');
-                    if (ptr == NULL) {
-                        strcpy(cgiargs, "");
-                        return MEMINFO;
-                    }
-                }
-            }
-        } else {
-            strcpy(cgiargs, "");
-            return MEMINFO;
-        }
-        return MEMINFO;
-    } else if (strncmp(uri, "/runloop", strlen("/runloop")) == 0) {
-        strcpy(filename, "");
-        strcpy(cgiargs, "");
-        return RUNLOOP;
-    } else if (strncmp(uri, "/allocanon", strlen("/allocanon")) == 0) {
-        strcpy(filename, "");
-        strcpy(cgiargs, "");
-        return ALLOCANON;
-    } else if (strncmp(uri, "/freeanon", strlen("/freeanon")) == 0) {
-        strcpy(filename, "");
-        strcpy(cgiargs, "");
-        return FREEANON;
-    } else if (!strstr(uri, "cgi-bin")) {
-        char path_buf[256];
-        char path_buf1[256];
-        strcpy(path_buf, uri + 6);
-        strcpy(path_buf1, path);
-        strcat(path_buf1, path_buf);
-        strcpy(filename, path_buf1);
-
-        if (uri[strlen(uri) - 1] == '/') {
-            strcat(filename, "home.html");
-        }
-
-        strcpy(cgiargs, "");
-
-        return STATIC;
+// Headers every answer about fe carries, 200, 206 and 304 alike
+static void validator_headers(struct reply *rp, struct file_entry *fe, unsigned encoding, bool vary) {
+    const char *policy = cache_control(fe->key);
+    char date[64], etag[96];
+
+    http_date(fe->mtime.tv_sec, date, sizeof(date));
+    file_etag(fe, encoding, etag, sizeof(etag));
+    reply_header(rp, "Last-Modified: %s", date);
+    reply_header(rp, "ETag: %s", etag);
+    if (policy != NULL) {
+        reply_header(rp, "Cache-Control: %s", policy);
+    }
+    if (vary) {
+        reply_header(rp, "Vary: Accept-Encoding");
+    }
+}
+
+// Head of a 200 for size bytes of fe in the given coding.  It may be kept
+// in the response cache, so it has no Date; send it with reply_send_stored.
+static void static_head(struct reply *rp, struct file_entry *fe, off_t size, unsigned encoding, bool vary) {
+    reply_start(rp, "HTTP/1.0", "200 OK", false);
+    reply_header(rp, "Content-length: %lld", (long long)size);
+    reply_header(rp, "Content-type: %s", fe->mime);
+    reply_header(rp, "Accept-Ranges: bytes");
+    if (encoding) {
+        reply_header(rp, "Content-Encoding: %s", encoding_name(encoding));
+    }
+    validator_headers(rp, fe, encoding, vary);
+    reply_finish(rp);
+}
+
+// serve_static : send static file back to client
+void serve_static(struct connection *c, struct file_entry *fe, uint64_t generation,
+                  struct request_headers *hdrs, char *version) {
+    char date[64], etag[96];
+    struct response *r;
+    struct reply rp;
+    unsigned encodings = file_encodings(fe);
+    unsigned want = encodings & hdrs->accept_encoding;
+
+    if (serve_not_modified(c, fe, hdrs)) {
+        return;
+    }
+
+    // Parts are always cut from the file as it is.  If-Range makes it
+    // all-or-nothing: a client holding an older copy gets the new one whole.
+    if (hdrs->range[0] != '\0') {
+        http_date(fe->mtime.tv_sec, date, sizeof(date));
+        file_etag(fe, 0, etag, sizeof(etag));
+        if ((hdrs->if_range[0] == '\0' || strcmp(hdrs->if_range, date) == 0 ||
+             strcmp(hdrs->if_range, etag) == 0) &&
+            serve_ranges(c, fe, hdrs->range)) {
+            return;
+        }
+        want = 0;
+    }
+
+    // A precompressed copy beats compressing; br beats gzip
+    if ((want & fe->sidecars & ENCODING_BR) && serve_sidecar(c, fe, ENCODING_BR, generation)) {
+        return;
+    }
+    if ((want & fe->sidecars & ENCODING_GZIP) && serve_sidecar(c, fe, ENCODING_GZIP, generation)) {
+        return;
+    }
+    // The compressed copy is not ready yet; this client gets the file as it is
+    if (want & ENCODING_GZIP) {
+        compress_later(fe->key);
+    }
+
+    static_head(&rp, fe, fe->size, 0, encodings != 0);
+
+    // Small files are read once into a complete response that later hits reuse
+    if (respcache_wants(responses, fe->size) &&
+        (r = respcache_fill(responses, fe->key, generation, rp.head, rp.len, fe->fd, fe->size, encodings)) != NULL) {
+        filecache_put(fe);
+        reply_send_stored(c, r->data, r->len, release_response, r);
+        return;
+    }
+
+    reply_send_stored(c, rp.head, rp.len, NULL, NULL);
+
+    // The reactor sends the body straight from the page cache, then drops fe
+    if (fe->size > 0) {
+        conn_write_file(c, fe->fd, 0, fe->size, release_file, fe);
     } else {
-        strcpy(filename, ".");
-        strcat(filename, uri);
-
-        char *ptr;
-        ptr = index(uri, '?');
-        if (ptr) {
-            strcpy(cgiargs, ptr + 1);
-            *ptr = '\0';
-        } else {
-            strcpy(cgiargs, "");
+        filecache_put(fe);
+    }
+}
+
+// Does an If-None-Match list name one of fe's representations?  Weak
+// comparison, as RFC 9110 asks for here, so a W/ prefix is ignored.
+static bool etag_listed(struct file_entry *fe, const char *list) {
+    static const unsigned encodings[] = { 0, ENCODING_GZIP, ENCODING_BR };
+    char etag[96];
+    int i;
+
+    while (*list) {
+        const char *tag;
+        size_t n;
+
+        list += strspn(list, " \t,");
+        if (*list == '*') {
+            return true;
+        }
+        if (strncmp(list, "W/", 2) == 0) {
+            list += 2;
+        }
+        tag = list;
+        n = strcspn(list, " \t,");
+        list += n;
+        for (i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++) {
+            file_etag(fe, encodings[i], etag, sizeof(etag));
+            if (n == strlen(etag) && strncmp(tag, etag, n) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool serve_not_modified(struct connection *c, struct file_entry *fe, struct request_headers *hdrs) {
+    struct reply rp;
+    unsigned encodings = file_encodings(fe);
+    unsigned encoding = 0;
+
+    // If-None-Match wins; If-Modified-Since only counts without it
+    if (hdrs->if_none_match[0] != '\0') {
+        if (!etag_listed(fe, hdrs->if_none_match)) {
+            return false;
         }
+    } else if (hdrs->if_modified_since[0] != '\0') {
+        struct tm tm;
 
-        return DYNAMIC;
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(hdrs->if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL ||
+            fe->mtime.tv_sec > timegm(&tm)) {
+            return false;
+        }
+    } else {
+        return false;
     }
-    return -1;
+
+    // Validators of the representation a full answer would have had
+    if (encodings & hdrs->accept_encoding & ENCODING_BR & fe->sidecars) {
+        encoding = ENCODING_BR;
+    } else if (encodings & hdrs->accept_encoding & ENCODING_GZIP) {
+        encoding = ENCODING_GZIP;
+    }
+    reply_start(&rp, "HTTP/1.0", "304 Not Modified", true);
+    validator_headers(&rp, fe, encoding, encodings != 0);
+    reply_send(&rp, c, NULL, 0);
+    filecache_put(fe);
+    return true;
 }
 
-// serve_static : copy static file back to client
-void serve_static(int fd, char *filename, int filesize) {
-    int srcfd;
-    char *srcp, filetype[MAXLINE], buf[MAXLINE];
-
-    get_filetype(filename, filetype);
-    sprintf(buf, "HTTP/1.0 200 OK\r\n");
-    sprintf(buf, "%sServer: Sysstatd Web Server\r\n", buf);
-    sprintf(buf, "%sContent-length: %d\r\n", buf, filesize);
-    sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype);
-    Rio_writen(fd, buf, strlen(buf));
-
-    srcfd = open(filename, O_RDONLY, 0);
-    srcp = mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
-    close(srcfd);
-    Rio_writen(fd, srcp, filesize);
-    munmap(srcp, filesize);
-}
-
-// get_filetype : get filetype from file name. Used in Contente-type
-void get_filetype(char *filename, char *filetype) {
-    if (strstr(filename, ".html")) {
-        strcpy(filetype, "text/html");
-    } else if (strstr(filename, ".gif")) {
-        strcpy(filetype, "image/gif");
-    } else if (strstr(filename, ".jpg")) {
-        strcpy(filetype, "image/jpeg");
+static bool serve_ranges(struct connection *c, struct file_entry *fe, const char *range) {
+    struct byte_range ranges[RANGE_MAX];
+    char buf[64], parts[RANGE_MAX][256], boundary[32];
+    int plen[RANGE_MAX];
+    long long size = fe->size, body;
+    struct reply rp;
+    int n, i, len;
+
+    if ((n = range_parse(range, fe->size, ranges, RANGE_MAX)) < 0) {
+        return false;
+    }
+    if (n == 0) {
+        reply_start(&rp, "HTTP/1.0", "416 Range Not Satisfiable", true);
+        reply_header(&rp, "Content-Range: bytes */%lld", size);
+        reply_header(&rp, "Content-length: 0");
+        reply_send(&rp, c, NULL, 0);
+        filecache_put(fe);
+        return true;
+    }
+
+    reply_start(&rp, "HTTP/1.0", "206 Partial Content", true);
+    if (n == 1) {
+        reply_header(&rp, "Content-length: %lld", (long long)(ranges[0].last - ranges[0].first + 1));
+        reply_header(&rp, "Content-type: %s", fe->mime);
+        reply_header(&rp, "Content-Range: bytes %lld-%lld/%lld",
+                     (long long)ranges[0].first, (long long)ranges[0].last, size);
+        validator_headers(&rp, fe, 0, false);
+        reply_send(&rp, c, NULL, 0);
+        conn_write_file(c, fe->fd, ranges[0].first, ranges[0].last - ranges[0].first + 1, release_file, fe);
+        return true;
+    }
+
+    // multipart/byteranges: every part has its own small header, and the
+    // body of each is queued straight from the file like a whole one
+    snprintf(boundary, sizeof(boundary), "%08x%08lx", fe->hash, (unsigned long)fe->mtime.tv_nsec);
+    body = strlen("\r\n--") + strlen(boundary) + strlen("--\r\n");
+    for (i = 0; i < n; i++) {
+        plen[i] = snprintf(parts[i], sizeof(parts[i]),
+                           "\r\n--%s\r\n"
+                           "Content-type: %s\r\n"
+                           "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                           boundary, fe->mime, (long long)ranges[i].first, (long long)ranges[i].last, size);
+        body += plen[i] + ranges[i].last - ranges[i].first + 1;
+    }
+    reply_header(&rp, "Content-length: %lld", body);
+    reply_header(&rp, "Content-type: multipart/byteranges; boundary=%s", boundary);
+    validator_headers(&rp, fe, 0, false);
+    reply_send(&rp, c, NULL, 0);
+    for (i = 0; i < n; i++) {
+        conn_write(c, parts[i], plen[i]);
+        filecache_hold(fe);
+        conn_write_file(c, fe->fd, ranges[i].first, ranges[i].last - ranges[i].first + 1, release_file, fe);
+    }
+    len = snprintf(buf, sizeof(buf), "\r\n--%s--\r\n", boundary);
+    conn_write(c, buf, len);
+    filecache_put(fe);
+    return true;
+}
+
+static bool serve_sidecar(struct connection *c, struct file_entry *fe, unsigned encoding, uint64_t generation) {
+    char key[MAXLINE];
+    struct file_entry *side;
+    struct response *r;
+    struct reply rp;
+
+    snprintf(key, sizeof(key), "%s%s", fe->key, encoding_suffix(encoding));
+    if ((side = filecache_get(files, key)) == NULL) {
+        return false;
+    }
+    if (!S_ISREG(side->mode)) {
+        filecache_put(side);
+        return false;
+    }
+    static_head(&rp, fe, side->size, encoding, true);
+    variant_key(key, sizeof(key), fe->key, encoding);
+    filecache_put(fe);
+
+    if (respcache_wants(responses, side->size) &&
+        (r = respcache_fill(responses, key, generation, rp.head, rp.len, side->fd, side->size, 0)) != NULL) {
+        filecache_put(side);
+        reply_send_stored(c, r->data, r->len, release_response, r);
+        return true;
+    }
+
+    reply_send_stored(c, rp.head, rp.len, NULL, NULL);
+    if (side->size > 0) {
+        conn_write_file(c, side->fd, 0, side->size, release_file, side);
     } else {
-        strcpy(filetype, "text/plain");
+        filecache_put(side);
     }
+    return true;
+}
+
+static void compress_later(const char *key) {
+    struct compress_job *job;
+    struct list_elem *e;
+
+    pthread_mutex_lock(&compress_lock);
+    for (e = list_begin(&compress_pending); e != list_end(&compress_pending); e = list_next(e)) {
+        if (strcmp(list_entry(e, struct compress_job, elem)->key, key) == 0) {
+            pthread_mutex_unlock(&compress_lock);
+            return;
+        }
+    }
+    // Bounded, so a scan over many files cannot tie up the pool; later requests retry
+    if (list_size(&compress_pending) >= COMPRESS_PENDING ||
+        (job = malloc(sizeof(*job) + strlen(key) + 1)) == NULL) {
+        pthread_mutex_unlock(&compress_lock);
+        return;
+    }
+    strcpy(job->key, key);
+    list_push_back(&compress_pending, &job->elem);
+    pthread_mutex_unlock(&compress_lock);
+
+    thread_pool_execute(pool, compress_file, job);
+}
+
+static void *compress_file(struct thread_pool *pool, void *data) {
+    struct compress_job *job = data;
+    uint64_t generation = respcache_generation(responses);
+    struct file_entry *fe;
+
+    if ((fe = filecache_get(files, job->key)) != NULL) {
+        char vkey[MAXLINE];
+        struct reply rp;
+        struct response *r;
+        size_t len;
+        char *body;
+
+        if (S_ISREG(fe->mode) && (body = encoding_gzip(fe->fd, fe->size, &len)) != NULL) {
+            variant_key(vkey, sizeof(vkey), job->key, ENCODING_GZIP);
+            static_head(&rp, fe, len, ENCODING_GZIP, true);
+            r = respcache_store(responses, vkey, generation, rp.head, rp.len, body, len);
+            if (r != NULL) {
+                respcache_put(r);
+            }
+            free(body);
+            __atomic_fetch_add(&compressed, 1, __ATOMIC_RELAXED);
+        } else if (S_ISREG(fe->mode)) {
+            // Remembered until the file changes and gets a new entry, so
+            // requests stop queueing the same futile deflate
+            __atomic_store_n(&fe->gzip_failed, true, __ATOMIC_RELAXED);
+        }
+        filecache_put(fe);
+    }
+
+    pthread_mutex_lock(&compress_lock);
+    list_remove(&job->elem);
+    pthread_mutex_unlock(&compress_lock);
+    free(job);
+    return NULL;
 }
 
-// serve_dynamic : run a CGI program and write back the output to fd which is the client
-void serve_dynamic(int fd, char *filename, char *cgiargs) {
+// serve_dynamic : run a CGI program and write back its output to the client
+// The socket is non-blocking and owned by the reactor, so the child writes
+// into a pipe and we queue whatever it produced.
+void serve_dynamic(struct connection *c, char *filename, char *cgiargs) {
     char buf[MAXLINE], *emptylist[] = { NULL };
+    struct reply rp;
+    int pipefd[2];
+    pid_t pid;
+    ssize_t n;
 
-    sprintf(buf, "HTTP/1.0 200 OK\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Server: Sysstatd Web Server\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    // The program writes the rest of the head itself
+    reply_start(&rp, "HTTP/1.0", "200 OK", true);
+    reply_write_head(&rp, c);
 
-    if (fork() == 0) { /* child */
+    // The CGI output carries no length, so the response ends with the connection
+    conn_set_close(c);
+
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        fprintf(stderr, "pipe() failed %s\n", strerror(errno));
+        return;
+    }
+
+    if ((pid = fork()) == 0) { /* child */
         /* Real server would set all CGI vars here */
         setenv("QUERY_STRING", cgiargs, 1);
-        dup2(fd, STDOUT_FILENO);              /* Redirect stdout to client */
+        dup2(pipefd[1], STDOUT_FILENO);       /* Redirect stdout to the pipe */
         execve(filename, emptylist, environ); /* Run CGI program */
+        _exit(1);
     }
+    close(pipefd[1]);
 
-    if (wait(NULL) < 0) { /* Parent waits for and reaps child */
+    while ((n = read(pipefd[0], buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        conn_write(c, buf, n);
+    }
+    close(pipefd[0]);
+
+    if (pid < 0 || waitpid(pid, NULL, 0) < 0) { /* Parent waits for and reaps child */
         fprintf(stderr, "Wait Error.\n");
-        exit(1);
     }
 }
 
-void send_response(int fd, char *msg, char *content_type, char *version) {
-    char msg_buf[MAXLINE];
-    char header_buf[MAXBUF];
+void send_response(struct connection *c, char *msg, char *content_type, char *version) {
+    size_t len = strlen(msg);
+    struct reply rp;
 
-    sprintf(msg_buf, "%s", msg);
+    reply_start(&rp, version, "200 OK", true);
+    reply_header(&rp, "Content-Type: %s", content_type);
+    reply_header(&rp, "Content-Length: %zu", len);
+    if (strncmp(version, "HTTP/1.0", strlen("HTTP/1.0")) == 0) {
+        reply_header(&rp, "Connection: close");
+    }
+    reply_send(&rp, c, msg, len);
+}
 
-    sprintf(header_buf, "%s 200 OK\r\n", version);
-    Rio_writen(fd, header_buf, strlen(header_buf));
+static void shard_stats(struct connection *c, struct route_args *a) {
+    char json[MAXBUF];
+    int len = 0;
+    int i;
+
+    len += snprintf(json + len, sizeof(json) - len, "[");
+    for (i = 0; i < nshards && len < sizeof(json); i++) {
+        struct reactor_stats st;
+        reactor_get_stats(shards[i], &st);
+        len += snprintf(json + len, sizeof(json) - len,
+                        "%s{\"shard\": %d, \"cpu\": %d, \"backend\": \"%s\", \"accepted\": %lu, \"open\": %lu, "
+                        "\"requests\": %lu, \"syscalls\": %lu, \"timeouts\": %lu, \"streams\": %lu}",
+                        i ? ", " : "", i, st.cpu, st.uring ? "io_uring" : "epoll",
+                        st.accepted, st.accepted - st.closed, st.requests, st.syscalls, st.timeouts, st.streams);
+    }
+    if (len < sizeof(json)) {
+        snprintf(json + len, sizeof(json) - len, "]");
+    }
+    send_response(c, json, "application/json", a->version);
+}
+
+static void admission_stats(struct connection *c, struct route_args *a) {
+    struct admission_stats st;
+    char json[MAXLINE];
 
-    sprintf(header_buf, "Content-Type: %s\r\n", content_type);
-    Rio_writen(fd, header_buf, strlen(header_buf));
+    if (admission == NULL) {
+        send_response(c, "{\"enabled\": false}", "application/json", a->version);
+        return;
+    }
+    admission_get_stats(admission, &st);
+    snprintf(json, sizeof(json),
+             "{\"enabled\": true, \"max_queue\": %lu, \"target_ms\": %ld, \"action\": \"%s\", "
+             "\"overloaded\": %s, \"queued\": %lu, \"admitted\": %lu, "
+             "\"shed_queue_full\": %lu, \"shed_sojourn\": %lu}",
+             st.max_depth, st.target_ms, st.reset ? "reset" : "503",
+             st.overloaded ? "true" : "false", st.queued, st.admitted,
+             st.shed_depth, st.shed_sojourn);
+    send_response(c, json, "application/json", a->version);
+}
 
-    sprintf(header_buf, "Content-Length: %d\r\n", (int)strlen(msg_buf));
-    Rio_writen(fd, header_buf, strlen(header_buf));
+static void filecache_stats(struct connection *c, struct route_args *a) {
+    struct filecache_stats st;
+    struct respcache_stats rst;
+    char json[MAXLINE];
+
+    filecache_get_stats(files, &st);
+    respcache_get_stats(responses, &rst);
+    snprintf(json, sizeof(json),
+             "{\"capacity\": %lu, \"entries\": %lu, \"invalidation\": \"%s\", \"hits\": %lu, "
+             "\"misses\": %lu, \"evictions\": %lu, \"invalidations\": %lu, "
+             "\"responses\": {\"budget\": %zu, \"bytes\": %zu, \"entries\": %lu, \"hits\": %lu, "
+             "\"misses\": %lu, \"evictions\": %lu, \"invalidations\": %lu}, \"gzipped\": %lu}",
+             st.capacity, st.entries, st.inotify ? "inotify" : "ttl", st.hits,
+             st.misses, st.evictions, st.invalidations,
+             rst.budget, rst.bytes, rst.entries, rst.hits,
+             rst.misses, rst.evictions, rst.invalidations,
+             __atomic_load_n(&compressed, __ATOMIC_RELAXED));
+    send_response(c, json, "application/json", a->version);
+}
 
-    if (strncmp(version, "HTTP/1.0", strlen("HTTP/1.0")) == 0) {
-        sprintf(header_buf, "Connection: close\r\n");
-        Rio_writen(fd, header_buf, strlen(header_buf));
+static void access_log_stats(struct connection *c, struct route_args *a) {
+    struct access_log_stats st;
+    char json[MAXLINE];
+
+    if (access_log == NULL) {
+        send_response(c, "{\"enabled\": false}", "application/json", a->version);
+        return;
+    }
+    access_log_get_stats(access_log, &st);
+    snprintf(json, sizeof(json),
+             "{\"enabled\": true, \"format\": \"%s\", \"logged\": %lu, \"dropped\": %lu, \"rings\": %lu}",
+             st.format == ACCESSLOG_BINARY ? "binary" : "line", st.logged, st.dropped, st.rings);
+    send_response(c, json, "application/json", a->version);
+}
+
+// A counter or gauge with a sample per shard
+static void print_shard_metric(FILE *out, const char *name, const char *type, const char *help,
+                               unsigned long *values) {
+    int i;
+
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    for (i = 0; i < nshards; i++) {
+        fprintf(out, "%s{shard=\"%d\"} %lu\n", name, i, values[i]);
+    }
+}
+
+static void server_metrics(struct connection *c, struct route_args *a) {
+    uint64_t totals[NCOUNTERS];
+    unsigned long accepted[nshards], open[nshards], accept_errors[nshards];
+    struct rusage usage;
+    struct reply rp;
+    size_t len, row, col;
+    char *text;
+    FILE *out;
+    int i;
+
+    if ((out = open_memstream(&text, &len)) == NULL) {
+        clienterror(c, a->path, "500", "Internal Server Error", "Sysstatd Web server is out of memory", a->version);
+        return;
     }
 
-    sprintf(header_buf, "%s\r\n", "");
-    Rio_writen(fd, header_buf, strlen(header_buf));
+    counters_sum(request_counters, totals);
+    fprintf(out, "# HELP sysstatd_requests_total Requests served, by route and status.\n"
+                 "# TYPE sysstatd_requests_total counter\n");
+    for (row = 0; row <= NROUTES; row++) {
+        for (col = 0; col < NSTATUS; col++) {
+            uint64_t n = totals[COUNTER_REQUESTS + row * NSTATUS + col];
+            char code[16] = "other";
 
-    Rio_writen(fd, msg_buf, strlen(msg_buf));
+            if (n == 0) {
+                continue;
+            }
+            if (col < NSTATUS - 1) {
+                snprintf(code, sizeof(code), "%d", status_codes[col]);
+            }
+            fprintf(out, "sysstatd_requests_total{route=\"%s\",code=\"%s\"} %llu\n",
+                    row < NROUTES ? routes[row].path : "none", code, (unsigned long long)n);
+        }
+    }
+    fprintf(out, "# HELP sysstatd_received_bytes_total Bytes of request heads served.\n"
+                 "# TYPE sysstatd_received_bytes_total counter\n"
+                 "sysstatd_received_bytes_total %llu\n"
+                 "# HELP sysstatd_sent_bytes_total Bytes of responses queued, heads and bodies.\n"
+                 "# TYPE sysstatd_sent_bytes_total counter\n"
+                 "sysstatd_sent_bytes_total %llu\n",
+            (unsigned long long)totals[COUNTER_BYTES_IN], (unsigned long long)totals[COUNTER_BYTES_OUT]);
+
+    for (i = 0; i < nshards; i++) {
+        struct reactor_stats st;
+        reactor_get_stats(shards[i], &st);
+        accepted[i] = st.accepted;
+        open[i] = st.accepted - st.closed;
+        accept_errors[i] = st.accept_errors;
+    }
+    print_shard_metric(out, "sysstatd_connections_accepted_total", "counter", "Connections accepted.", accepted);
+    print_shard_metric(out, "sysstatd_connections_open", "gauge", "Connections open.", open);
+    print_shard_metric(out, "sysstatd_accept_errors_total", "counter",
+                       "Connections that failed to be accepted or set up.", accept_errors);
+    fprintf(out, "# HELP sysstatd_pool_queue_depth Requests waiting for a pool thread.\n"
+                 "# TYPE sysstatd_pool_queue_depth gauge\n"
+                 "sysstatd_pool_queue_depth %lu\n",
+            thread_pool_queued(pool));
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        print_rusage_as_prometheus(out, &usage);
+    }
+    if (fclose(out) != 0) {
+        free(text);
+        clienterror(c, a->path, "500", "Internal Server Error", "Sysstatd Web server is out of memory", a->version);
+        return;
+    }
+
+    reply_start(&rp, a->version, "200 OK", true);
+    reply_header(&rp, "Content-Type: text/plain; version=0.0.4; charset=utf-8");
+    reply_header(&rp, "Content-Length: %zu", len);
+    if (strncmp(a->version, "HTTP/1.0", strlen("HTTP/1.0")) == 0) {
+        reply_header(&rp, "Connection: close");
+    }
+    reply_send_ref(&rp, c, text, len, free, text);
 }
 
-static void run_loop(void) {
+// /latency: count, min, p50, p90, p99, p99.9 and max of each phase of the
+// requests to each route group, in microseconds, since the server started.
+// ?reset=1 covers the window since the last reset instead and starts the
+// next one; &buckets=1 adds the raw buckets, to merge with other hosts'.
+static void serve_latency(struct connection *c, struct route_args *a) {
+    uint64_t *counts, since;
+    size_t len, g, p, i;
+    bool reset = query_get(&a->params, "reset", &len) != NULL;
+    bool buckets = query_get(&a->params, "buckets", &len) != NULL;
+    struct reply rp;
+    char *json;
+    FILE *out;
+
+    if ((counts = malloc(NLATENCY * sizeof(*counts))) == NULL) {
+        clienterror(c, a->path, "500", "Internal Server Error", "Sysstatd Web server is out of memory", a->version);
+        return;
+    }
+    // Summed under the lock, so that two resets cannot each move the base
+    // to a sum the other has already passed
+    pthread_mutex_lock(&latency_lock);
+    counters_sum(latency_counters, counts);
+    since = latency_start_ms;
+    if (reset) {
+        for (i = 0; i < NLATENCY; i++) {
+            uint64_t now = counts[i];
+            counts[i] -= latency_base[i];
+            latency_base[i] = now;
+        }
+        since = latency_base_ms;
+        latency_base_ms = wall_ms();
+    }
+    pthread_mutex_unlock(&latency_lock);
+
+    if ((out = open_memstream(&json, &len)) == NULL) {
+        free(counts);
+        clienterror(c, a->path, "500", "Internal Server Error", "Sysstatd Web server is out of memory", a->version);
+        return;
+    }
+    fprintf(out, "{\"unit\": \"us\", \"sub_bucket_bits\": %d, \"since\": %llu, \"routes\": {",
+            HDR_SUB_BITS, (unsigned long long)since);
+    for (g = 0; g < NLATENCY_ROUTES; g++) {
+        fprintf(out, "%s\"%s\": {", g ? ", " : "", g < NLATENCY_ROUTES - 1 ? latency_routes[g] : "other");
+        for (p = 0; p < NLATENCY_PHASES; p++) {
+            fprintf(out, "%s\"%s\": ", p ? ", " : "", latency_phases[p]);
+            hdr_print_json(out, counts + (g * NLATENCY_PHASES + p) * HDR_BUCKETS, buckets);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "}}");
+    free(counts);
+    if (fclose(out) != 0) {
+        free(json);
+        clienterror(c, a->path, "500", "Internal Server Error", "Sysstatd Web server is out of memory", a->version);
+        return;
+    }
+
+    reply_start(&rp, a->version, "200 OK", true);
+    reply_header(&rp, "Content-Type: application/json");
+    reply_header(&rp, "Content-Length: %zu", len);
+    if (strncmp(a->version, "HTTP/1.0", strlen("HTTP/1.0")) == 0) {
+        reply_header(&rp, "Connection: close");
+    }
+    reply_send_ref(&rp, c, json, len, free, json);
+}
+
+static void *run_loop(struct thread_pool *pool, void *data) {
     time_t begin = time(NULL);
 
     while ((time(NULL) - begin) < 15) {
         continue;
     }
-    return;
+    return NULL;
 }
 
 /********************************
@@ -632,7 +2058,7 @@ static void run_loop(void) {
  *       -1 with errno set for other errors.
  */
 /* $begin open_listenfd */
-int open_listenfd(char *port) {
+int open_listenfd(char *port, int reuseport) {
     struct addrinfo hints, *listp, *p;
     int listenfd, rc, optval = 1;
 
@@ -659,6 +2085,10 @@ int open_listenfd(char *port) {
         /* Eliminates "Address already in use" error from bind */
         setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, // line:netp:csapp:setsockopt
                    (const void *)&optval, sizeof(int));
+        if (reuseport) {
+            setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                       (const void *)&optval, sizeof(int));
+        }
 
         /* Bind the descriptor to the address */
         if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
@@ -686,9 +2116,9 @@ int open_listenfd(char *port) {
 /****************************************************
  * Wrappers for reentrant protocol-independent helpers
  ****************************************************/
-int Open_listenfd(char *port) {
+int Open_listenfd(char *port, int reuseport) {
     int rc;
-    if ((rc = open_listenfd(port)) < 0)
+    if ((rc = open_listenfd(port, reuseport)) < 0)
         unix_error("Open_listenfd error");
     return rc;
 }
@@ -1,5 +1,6 @@
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -7,44 +8,64 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <unistd.h>
-#include <sys/time.h>
-#include <sys/resource.h>
 #include <time.h>
 
 #include "threadpool.h"
 #include "list.h"
-#include "threadpool_lib.h"
 
-struct thread_pool {
-        int thread_count; // How many threads
+/*
+ * Every worker owns a Chase-Lev deque ("Dynamic circular work-stealing
+ * deque", SPAA 2005, with the C11 orderings of Le et al., PPoPP 2013).
+ * The owner pushes and pops at the bottom without locks, LIFO, so a task
+ * forked from a task runs next on the same core while its data is warm;
+ * thieves take from the top, FIFO, with a CAS on top, so they get the
+ * oldest and usually largest piece of work.  Tasks submitted from outside
+ * the pool go through a global queue under a mutex.
+ *
+ * A future is in at most one queue.  Whoever moves it from QUEUED to
+ * RUNNING runs it: the worker that takes it from a queue, or a worker that
+ * joins it first.  The queue keeps a reference until the future is taken
+ * out, so a future the caller frees early cannot be taken out freed.
+ */
 
-        pthread_t main_tid;
+#define DEQUE_INITIAL 64        // Slots in a new deque, a power of two
+#define IDLE_SPINS 64           // Rounds of looking for work before sleeping
 
-        struct worker * worker_array; // thread_count of workers
+struct deque_array {
+        int64_t size;           // A power of two
+        struct deque_array *prev; // Outgrown, kept until the pool goes, as a thief may still read it
+        struct future *slots[];
+};
 
-        struct list future_list; // Global task queue
+struct deque {
+        int64_t top __attribute__((aligned(64))); // Thieves take here
+        int64_t bottom __attribute__((aligned(64))); // The owner pushes and pops here
+        struct deque_array *array;
+};
 
-        bool creation_finished; // If the creation of the thread_pool has been finished
-        pthread_cond_t creation_cond; // Notify when user submits a new task
-        pthread_mutex_t creation_mutex;
+struct worker {
+        pthread_t worker_tid; // The tid of the worker
 
-        pthread_cond_t new_condition; // New submission or destroy the pool
-        pthread_mutex_t new_condition_mutex;
+        struct deque deque; // The task queue of the worker
 
-        bool need_shutdown; // If the pool needs to be shutdown
-
-        pthread_mutex_t pool_mutex; // Lock it when change data in thread_pool
+        struct thread_pool *pool; // The thread pool the worker is in
 
+        unsigned seed; // For picking victims
 };
 
-struct worker {
-        pthread_t worker_tid; // The tid of the worker
+struct thread_pool {
+        int thread_count; // How many threads
 
-        struct list future_list; // The task queue of the worker
+        struct worker *worker_array; // thread_count of workers
 
-        struct thread_pool *pool; // The thread pool the worker is in
+        pthread_mutex_t pool_mutex; // Guards future_list and the sleeping workers
+        struct list future_list; // Tasks submitted from outside the pool
+        unsigned long global_queued; // Tasks in future_list; changed under pool_mutex, read without it
 
-        pthread_mutex_t worker_mutex; // Lock it when change data in the worker
+        pthread_cond_t new_condition; // New work or shutdown, for sleeping workers
+        int sleepers; // Workers waiting on new_condition or about to
+
+        bool need_shutdown; // If the pool needs to be shutdown
 };
 
 enum future_state {
@@ -54,11 +75,11 @@ enum future_state {
 };
 
 struct future {
-        sem_t future_sem; // If the future has been finished
+        int state; // enum future_state, changed atomically
 
-        enum future_state state;
+        int refs; // The caller's, unless detached, and the queue's until taken out
 
-        //struct worker* running_worker;
+        sem_t future_sem; // Posted once it is finished, for waiters outside the pool
 
         // Thread_pool function arguments
         fork_join_task_t task;
@@ -66,149 +87,301 @@ struct future {
         void * data;
         void * results;
 
-        pthread_mutex_t future_mutex; // Lock it when change data in the future
-
         struct list_elem elem; // Make the future can be linked by list
 };
 
+// The worker the calling thread is, NULL outside every pool
+static __thread struct worker *current_worker;
 
-static void * worker_thread(void *worker_void){
-        struct worker *current_worker=worker_void;
+/*********************
+ * Deque
+ *********************/
+
+static struct deque_array *deque_array_new(int64_t size, struct deque_array *prev){
+        struct deque_array *a=malloc(sizeof(*a) + size * sizeof(a->slots[0]));
+
+        if(a==NULL) {
+                printf("malloc error when growing a deque.");
+                exit(1);
+        }
+        a->size=size;
+        a->prev=prev;
+        return a;
+}
 
-        struct thread_pool *pool=current_worker->pool;
+static void deque_init(struct deque *d){
+        d->top=0;
+        d->bottom=0;
+        d->array=deque_array_new(DEQUE_INITIAL, NULL);
+}
 
-        pthread_mutex_lock(&pool->creation_mutex);
-        while(pool->creation_finished==false) {
-                pthread_cond_wait(&pool->creation_cond,&pool->creation_mutex);
+static void deque_destroy(struct deque *d){
+        struct deque_array *a=d->array;
+
+        while(a!=NULL) {
+                struct deque_array *prev=a->prev;
+                free(a);
+                a=prev;
         }
-        pthread_mutex_unlock(&pool->creation_mutex);
+}
 
-        while(true) {
-                struct future *working_future;
+// Owner only
+static void deque_push(struct deque *d, struct future *f){
+        int64_t b=__atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+        int64_t t=__atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+        struct deque_array *a=__atomic_load_n(&d->array, __ATOMIC_RELAXED);
 
-                if(pool->need_shutdown) {
-                        pthread_exit(0);
+        if(b-t > a->size-1) {
+                struct deque_array *bigger=deque_array_new(a->size*2, a);
+                int64_t i;
+
+                for(i=t; i<b; i++) {
+                        bigger->slots[i & (bigger->size-1)]=__atomic_load_n(&a->slots[i & (a->size-1)], __ATOMIC_RELAXED);
                 }
+                __atomic_store_n(&d->array, bigger, __ATOMIC_RELEASE);
+                a=bigger;
+        }
+        __atomic_store_n(&a->slots[b & (a->size-1)], f, __ATOMIC_RELAXED);
+        __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELEASE);
+}
 
-                pthread_mutex_lock(&current_worker->worker_mutex);
-                pthread_mutex_lock(&pool->pool_mutex);
-                if(list_empty(&current_worker->future_list)) {
-                        if(!list_empty(&pool->future_list)) {
-                                // printf("%d:internal empty but global not empty\n",pthread_self());
-                                struct list_elem *e=list_pop_front(&pool->future_list);
-                                working_future = list_entry (e, struct future, elem);
-                                // pthread_mutex_unlock(&current_worker->worker_mutex);
-                        }else{
-                                // printf("%d:internal empty but global empty\n",pthread_self());
-                                int i=0;
-                                while(true) {
-                                        struct worker *victim_worker=&pool->worker_array[i];
-                                        if(list_empty(&victim_worker->future_list)) {
-                                                i++;
-                                                continue;
-                                        }else{
-                                                break;
-                                        }
-                                }
-                                if(i<pool->thread_count) {
-                                        // printf("%d:internal empty but global not empty and others have\n",pthread_self());
-                                        struct worker *victim_worker=&pool->worker_array[i];
-                                        // pthread_mutex_lock(&pool->pool_mutex);
-                                        struct list_elem *e=list_pop_front(&victim_worker->future_list);
-                                        working_future = list_entry (e, struct future, elem);
-                                        // pthread_mutex_unlock(&pool->pool_mutex);
-                                }else{
-                                        // printf("worker_thread waiting %d:\n",pthread_self());
-                                        pthread_mutex_unlock(&pool->pool_mutex);
-                                        pthread_mutex_unlock(&current_worker->worker_mutex);
-
-                                        if(pool->need_shutdown) {
-                                                // printf("%d:will exit\n",pthread_self());
-                                                pthread_exit(0);
-                                        }
-
-                                        pthread_mutex_lock(&pool->new_condition_mutex);
-                                        pthread_cond_wait(&pool->new_condition,&pool->new_condition_mutex);
-                                        pthread_mutex_unlock(&pool->new_condition_mutex);
-
-                                        if(pool->need_shutdown) {
-                                                // printf("%d:will exit\n",pthread_self());
-                                                pthread_exit(0);
-                                        }else{
-                                                // printf("%d:will continue\n",pthread_self());
-                                                continue;
-                                        }
-                                }
+// Owner only; NULL if empty
+static struct future *deque_pop(struct deque *d){
+        int64_t b=__atomic_load_n(&d->bottom, __ATOMIC_RELAXED)-1;
+        struct deque_array *a=__atomic_load_n(&d->array, __ATOMIC_RELAXED);
+        struct future *f=NULL;
+        int64_t t;
+
+        __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        t=__atomic_load_n(&d->top, __ATOMIC_RELAXED);
+        if(t<=b) {
+                f=__atomic_load_n(&a->slots[b & (a->size-1)], __ATOMIC_RELAXED);
+                if(t==b) {
+                        // The last one: race the thieves for it
+                        if(!__atomic_compare_exchange_n(&d->top, &t, t+1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                                f=NULL;
                         }
-                }else{
-                        // printf("%d:internal not empty\n",pthread_self());
-                        // pthread_mutex_lock(&current_worker->worker_mutex);
-                        struct list_elem *e=list_pop_back(&current_worker->future_list);
-                        working_future = list_entry (e, struct future, elem);
-                        // pthread_mutex_unlock(&current_worker->worker_mutex);
+                        __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
                 }
+        }else{
+                __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
+        }
+        return f;
+}
 
-                pthread_mutex_unlock(&current_worker->worker_mutex);
-                pthread_mutex_unlock(&pool->pool_mutex);
-                // printf("worker_thread solving %d:\n",pthread_self());
-                working_future->state=RUNNING;
-                working_future->results=working_future->task(pool,working_future->data);
-                working_future->state=FINISHED;
-
-                int i=0;
-                for(; i<pool->thread_count; i++) {
-                        sem_post(&working_future->future_sem);
+// Any thread; NULL if empty or another thread got there first
+static struct future *deque_steal(struct deque *d){
+        int64_t t=__atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+        int64_t b;
+
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        b=__atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+        if(t<b) {
+                struct deque_array *a=__atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+                struct future *f=__atomic_load_n(&a->slots[t & (a->size-1)], __ATOMIC_RELAXED);
+
+                if(__atomic_compare_exchange_n(&d->top, &t, t+1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                        return f;
                 }
         }
         return NULL;
 }
 
-/* Create a new thread pool with no more than n threads. */
-struct thread_pool * thread_pool_new(int nthreads){
-        struct thread_pool * pool=malloc(sizeof(struct thread_pool));
+static int64_t deque_size(struct deque *d){
+        int64_t n=__atomic_load_n(&d->bottom, __ATOMIC_RELAXED)-__atomic_load_n(&d->top, __ATOMIC_RELAXED);
 
-        if(pool==NULL) {
-                printf("malloc error when creating thread_pool.");
-                exit(1);
+        return n>0 ? n : 0;
+}
+
+/*********************
+ * Futures
+ *********************/
+
+static void future_put(struct future *f){
+        if(__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL)==0) {
+                sem_destroy(&f->future_sem);
+                free(f);
         }
+}
 
-        pool->thread_count=nthreads;
+// Run f if nobody has started it yet; false if somebody has
+static bool future_run(struct future *f){
+        int expected=IN_QUEUE;
 
-        pool->worker_array=calloc(pool->thread_count,sizeof(struct worker));
+        if(!__atomic_compare_exchange_n(&f->state, &expected, RUNNING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return false;
+        }
+        f->results=f->task(f->pool, f->data);
+        __atomic_store_n(&f->state, FINISHED, __ATOMIC_RELEASE);
+        sem_post(&f->future_sem);
+        return true;
+}
 
-        list_init(&pool->future_list);
+// Run a future just taken out of a queue, and drop the queue's reference
+static void future_take(struct future *f){
+        future_run(f);
+        future_put(f);
+}
 
-        pool->need_shutdown=false;
+static bool future_finished(struct future *f){
+        return __atomic_load_n(&f->state, __ATOMIC_ACQUIRE)==FINISHED;
+}
+
+// Block until f is finished, leaving the semaphore posted for the next waiter
+static void future_wait(struct future *f){
+        if(!future_finished(f)) {
+                sem_wait(&f->future_sem);
+                sem_post(&f->future_sem);
+        }
+}
+
+/*********************
+ * Workers
+ *********************/
+
+static struct future *global_pop(struct thread_pool *pool){
+        struct future *f=NULL;
+
+        if(__atomic_load_n(&pool->global_queued, __ATOMIC_RELAXED)==0) {
+                return NULL;
+        }
+        pthread_mutex_lock(&pool->pool_mutex);
+        if(!list_empty(&pool->future_list)) {
+                f=list_entry(list_pop_front(&pool->future_list), struct future, elem);
+                __atomic_store_n(&pool->global_queued, pool->global_queued-1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&pool->pool_mutex);
+        return f;
+}
+
+// Some other worker's oldest task, trying them all from a random one
+static struct future *steal(struct worker *w){
+        struct thread_pool *pool=w->pool;
+        int n=pool->thread_count;
+        int start=rand_r(&w->seed) % n;
+        int i;
+
+        for(i=0; i<n; i++) {
+                struct worker *victim=&pool->worker_array[(start+i) % n];
+                struct future *f;
+
+                if(victim!=w && (f=deque_steal(&victim->deque))!=NULL) {
+                        return f;
+                }
+        }
+        return NULL;
+}
 
-        pool->main_tid=pthread_self();
+// The next task for w: its own newest, else one from outside, else a stolen one
+static struct future *find_task(struct worker *w){
+        struct future *f=deque_pop(&w->deque);
 
-        pthread_cond_init(&pool->creation_cond,NULL);
+        if(f==NULL) {
+                f=global_pop(w->pool);
+        }
+        if(f==NULL) {
+                f=steal(w);
+        }
+        return f;
+}
 
-        pthread_mutex_init(&pool->creation_mutex,NULL);
+static bool has_work(struct thread_pool *pool){
+        int i;
 
-        pthread_cond_init(&pool->new_condition,NULL);
+        if(__atomic_load_n(&pool->global_queued, __ATOMIC_RELAXED)!=0) {
+                return true;
+        }
+        for(i=0; i<pool->thread_count; i++) {
+                if(deque_size(&pool->worker_array[i].deque)>0) {
+                        return true;
+                }
+        }
+        return false;
+}
 
-        pthread_mutex_init(&pool->new_condition_mutex,NULL);
+// Wake a sleeping worker, if there is one, after work was queued.  The
+// fence pairs with the one in worker_sleep: either the sleeper sees the
+// work, or we see the sleeper.
+static void wake_worker(struct thread_pool *pool){
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&pool->sleepers, __ATOMIC_RELAXED)>0) {
+                pthread_mutex_lock(&pool->pool_mutex);
+                pthread_cond_signal(&pool->new_condition);
+                pthread_mutex_unlock(&pool->pool_mutex);
+        }
+}
 
-        pthread_mutex_init(&pool->pool_mutex,NULL);
+static void worker_sleep(struct thread_pool *pool){
+        pthread_mutex_lock(&pool->pool_mutex);
+        __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(!pool->need_shutdown && !has_work(pool)) {
+                pthread_cond_wait(&pool->new_condition, &pool->pool_mutex);
+        }
+        __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&pool->pool_mutex);
+}
+
+static void * worker_thread(void *worker_void){
+        struct worker *w=worker_void;
+        struct thread_pool *pool=w->pool;
+        int idle=0;
+
+        current_worker=w;
+        while(!__atomic_load_n(&pool->need_shutdown, __ATOMIC_RELAXED)) {
+                struct future *f=find_task(w);
+
+                if(f!=NULL) {
+                        future_take(f);
+                        idle=0;
+                }else if(++idle<IDLE_SPINS) {
+                        sched_yield();
+                }else{
+                        worker_sleep(pool);
+                        idle=0;
+                }
+        }
+        return NULL;
+}
 
-        pool->creation_finished=false;
+/* Create a new thread pool with no more than n threads. */
+struct thread_pool * thread_pool_new(int nthreads){
+        struct thread_pool * pool=malloc(sizeof(struct thread_pool));
+        int i;
 
-        int i=0;
-        for(; i<nthreads; i++) {
-                struct worker * current_worker=&pool->worker_array[i];
+        if(pool==NULL) {
+                printf("malloc error when creating thread_pool.");
+                exit(1);
+        }
 
-                list_init(&current_worker->future_list);
+        pool->thread_count=nthreads;
+        pool->worker_array=calloc(pool->thread_count, sizeof(struct worker));
+        if(pool->worker_array==NULL) {
+                printf("malloc error when creating thread_pool.");
+                exit(1);
+        }
 
-                current_worker->pool=pool;
+        pthread_mutex_init(&pool->pool_mutex, NULL);
+        list_init(&pool->future_list);
+        pool->global_queued=0;
+        pthread_cond_init(&pool->new_condition, NULL);
+        pool->sleepers=0;
+        pool->need_shutdown=false;
 
-                pthread_mutex_init(&current_worker->worker_mutex,NULL);
+        // Every deque is ready before any worker can go stealing
+        for(i=0; i<nthreads; i++) {
+                struct worker * w=&pool->worker_array[i];
 
-                pthread_create(&current_worker->worker_tid, NULL, worker_thread, current_worker);
+                deque_init(&w->deque);
+                w->pool=pool;
+                w->seed=i+1;
         }
-        pool->creation_finished=true;
+        for(i=0; i<nthreads; i++) {
+                struct worker * w=&pool->worker_array[i];
 
-        pthread_cond_broadcast(&pool->creation_cond);
+                pthread_create(&w->worker_tid, NULL, worker_thread, w);
+        }
 
         return pool;
 }
@@ -222,26 +395,22 @@ struct thread_pool * thread_pool_new(int nthreads){
  */
 
 void thread_pool_shutdown_and_destroy(struct thread_pool *pool){
+        int i;
+
         assert(pool != NULL);
         pthread_mutex_lock(&pool->pool_mutex);
-        pool->need_shutdown=true;
-        pthread_mutex_unlock(&pool->pool_mutex);
-
+        __atomic_store_n(&pool->need_shutdown, true, __ATOMIC_RELAXED);
         pthread_cond_broadcast(&pool->new_condition);
+        pthread_mutex_unlock(&pool->pool_mutex);
 
-        int i=0;
-        for(; i<pool->thread_count; i++) {
-                struct worker * current_worker=&pool->worker_array[i];
-                pthread_join(current_worker->worker_tid,NULL);
+        for(i=0; i<pool->thread_count; i++) {
+                pthread_join(pool->worker_array[i].worker_tid, NULL);
+        }
+        for(i=0; i<pool->thread_count; i++) {
+                deque_destroy(&pool->worker_array[i].deque);
         }
-
-
-        pthread_cond_destroy(&pool->creation_cond);
-        pthread_mutex_destroy(&pool->creation_mutex);
 
         pthread_cond_destroy(&pool->new_condition);
-        pthread_mutex_destroy(&pool->new_condition_mutex);
-
         pthread_mutex_destroy(&pool->pool_mutex);
 
         free(pool->worker_array);
@@ -260,22 +429,44 @@ void thread_pool_shutdown_and_destroy(struct thread_pool *pool){
  */
 
 
-struct future * thread_pool_submit(struct thread_pool *pool, fork_join_task_t task, void * data){
-        struct future * return_future=malloc(sizeof(struct future));
+static struct future * submit_future(struct thread_pool *pool, fork_join_task_t task, void * data, bool detached){
+        struct future * f=malloc(sizeof(struct future));
+        struct worker *w=current_worker;
 
-        sem_init(&return_future->future_sem,0,0);
-        return_future->task=task;
-        return_future->data=data;
-        return_future->pool=pool;
+        if(f==NULL) {
+                printf("malloc error when submitting a task.");
+                exit(1);
+        }
+        sem_init(&f->future_sem, 0, 0);
+        f->state=IN_QUEUE;
+        f->refs=detached ? 1 : 2;
+        f->task=task;
+        f->data=data;
+        f->pool=pool;
+
+        // A task forked from a task goes on its worker's own deque
+        if(w!=NULL && w->pool==pool) {
+                deque_push(&w->deque, f);
+        }else{
+                pthread_mutex_lock(&pool->pool_mutex);
+                list_push_back(&pool->future_list, &f->elem);
+                __atomic_store_n(&pool->global_queued, pool->global_queued+1, __ATOMIC_RELAXED);
+                pthread_mutex_unlock(&pool->pool_mutex);
+        }
+        wake_worker(pool);
+        return detached ? NULL : f;
+}
 
-        pthread_mutex_lock(&pool->pool_mutex);
-        list_push_back (&pool->future_list, &return_future->elem);
-        return_future->state=IN_QUEUE;
-        pthread_mutex_unlock(&pool->pool_mutex);
+struct future * thread_pool_submit(struct thread_pool *pool, fork_join_task_t task, void * data){
+        return submit_future(pool, task, data, false);
+}
 
-        pthread_mutex_init(&return_future->future_mutex,NULL);
-        pthread_cond_broadcast(&pool->new_condition);
-        return return_future;
+/*
+ * Submit a task nobody will wait for. The future is freed by the
+ * worker right after the task has run.
+ */
+void thread_pool_execute(struct thread_pool *pool, fork_join_task_t task, void * data){
+        submit_future(pool, task, data, true);
 }
 
 
@@ -284,49 +475,47 @@ struct future * thread_pool_submit(struct thread_pool *pool, fork_join_task_t ta
  *
  * Returns the value returned by this task.
  */
-void * future_get(struct future *working_future){
-        struct thread_pool * pool=working_future->pool;
+void * future_get(struct future *f){
+        struct worker *w=current_worker;
 
-        if(pool->main_tid==pthread_self()) {
-                if(working_future->state!=FINISHED) {
-                        sem_wait(&working_future->future_sem);
-                }
-                return working_future->results;
-        }else{
-                pthread_mutex_lock(&pool->pool_mutex);
-                if(working_future->state==FINISHED) {
-                        pthread_mutex_unlock(&pool->pool_mutex);
-
-                        return working_future->results;
-                }else if(working_future->state==IN_QUEUE) {
-                        list_remove(&working_future->elem);
-                        pthread_mutex_unlock(&pool->pool_mutex);
-                        working_future->state=RUNNING;
-                        working_future->results=working_future->task(pool,working_future->data);
-                        working_future->state=FINISHED;
-
-                        return working_future->results;
-                }else{
-                        pthread_mutex_unlock(&pool->pool_mutex);
-                        sem_wait(&working_future->future_sem);
-                        return working_future->results;
+        if(w==NULL || w->pool!=f->pool) {
+                // Outside the pool there is nothing to help with
+                future_wait(f);
+                return f->results;
+        }
+
+        // A worker runs the task itself if nobody has started it, and
+        // otherwise keeps busy with other tasks until it is done
+        if(!future_run(f)) {
+                while(!future_finished(f)) {
+                        struct future *other=find_task(w);
+
+                        if(other!=NULL) {
+                                future_take(other);
+                        }else{
+                                sched_yield();
+                        }
                 }
         }
+        return f->results;
 }
 
 
 /* Deallocate this future.  Must be called after future_get() */
 void future_free(struct future *f){
         if(f!=NULL) {
-                if(f->state==FINISHED) {
-                        sem_destroy(&f->future_sem);
-                        pthread_mutex_destroy(&f->future_mutex);
-                        free(f);
-                }else{
-                        sem_wait(&f->future_sem);
-                        sem_destroy(&f->future_sem);
-                        pthread_mutex_destroy(&f->future_mutex);
-                        free(f);
-                }
+                future_wait(f);
+                future_put(f);
+        }
+}
+
+/* How many tasks are waiting for a worker */
+unsigned long thread_pool_queued(struct thread_pool *pool){
+        unsigned long n=__atomic_load_n(&pool->global_queued, __ATOMIC_RELAXED);
+        int i;
+
+        for(i=0; i<pool->thread_count; i++) {
+                n+=deque_size(&pool->worker_array[i].deque);
         }
+        return n;
 }
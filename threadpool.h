@@ -2,6 +2,10 @@
  * threadpool.h
  *
  * A work-stealing, fork-join thread pool.
+ *
+ * Tasks submitted from inside a task go on the calling worker's own
+ * deque; others go on a global queue.  Idle workers steal from random
+ * victims.  future_get() on a worker runs other tasks while it waits.
  */
 
 /* 
@@ -49,6 +53,18 @@ struct future * thread_pool_submit(
         fork_join_task_t task, 
         void * data);
 
+/*
+ * Submit a fire-and-forget task to the thread pool.  No future is
+ * returned; the pool releases its bookkeeping once the task has run.
+ * 'pool' - the pool to which to submit
+ * 'task' - the task to be submitted.
+ * 'data' - data to be passed to the task's function
+ */
+void thread_pool_execute(
+        struct thread_pool *pool,
+        fork_join_task_t task,
+        void * data);
+
 /* Make sure that the thread pool has completed the execution
  * of the fork join task this future represents.
  *
@@ -59,3 +75,7 @@ void * future_get(struct future *);
 /* Deallocate this future.  Must be called after future_get() */
 void future_free(struct future *);
 
+/* The number of submitted tasks no worker has started yet; a snapshot,
+ * safe to call from any thread. */
+unsigned long thread_pool_queued(struct thread_pool *pool);
+
@@ -91,6 +91,35 @@ static void print_rusage_to_human(FILE *output, struct rusage *usage)
     );
 }
 
+/* The same counts as Prometheus samples of the standard process_* metrics */
+void print_rusage_as_prometheus(FILE *output, struct rusage *usage)
+{
+    fprintf(output,
+        "# HELP process_cpu_user_seconds_total User CPU time spent in seconds.\n"
+        "# TYPE process_cpu_user_seconds_total counter\n"
+        "process_cpu_user_seconds_total %ld.%06ld\n"
+        "# HELP process_cpu_system_seconds_total System CPU time spent in seconds.\n"
+        "# TYPE process_cpu_system_seconds_total counter\n"
+        "process_cpu_system_seconds_total %ld.%06ld\n"
+        "# HELP process_max_resident_memory_bytes Maximum resident set size in bytes.\n"
+        "# TYPE process_max_resident_memory_bytes gauge\n"
+        "process_max_resident_memory_bytes %ld\n"
+        "# HELP process_page_faults_total Page faults, minor ones served without I/O.\n"
+        "# TYPE process_page_faults_total counter\n"
+        "process_page_faults_total{kind=\"minor\"} %ld\n"
+        "process_page_faults_total{kind=\"major\"} %ld\n"
+        "# HELP process_context_switches_total Context switches.\n"
+        "# TYPE process_context_switches_total counter\n"
+        "process_context_switches_total{kind=\"voluntary\"} %ld\n"
+        "process_context_switches_total{kind=\"involuntary\"} %ld\n",
+        usage->ru_utime.tv_sec, usage->ru_utime.tv_usec,
+        usage->ru_stime.tv_sec, usage->ru_stime.tv_usec,
+        usage->ru_maxrss * 1024,
+        usage->ru_minflt, usage->ru_majflt,
+        usage->ru_nvcsw, usage->ru_nivcsw
+    );
+}
+
 /* Compute the diff of interesting parameters in two rusage structs */
 static void rusagesub(struct rusage *end, struct rusage *start, struct rusage *diff)
 {
@@ -13,6 +13,10 @@ void stop_benchmark(struct benchmark_data * bdata);
 void report_benchmark_results(struct benchmark_data *bdata);
 void report_benchmark_results_to_human(FILE *file, struct benchmark_data *bdata);
 
+/* Print getrusage() results in the Prometheus text format */
+struct rusage;
+void print_rusage_as_prometheus(FILE *file, struct rusage *usage);
+
 /* Worker threads can install this handler to guess whether a segmentation
  * fault may be the result of stack overflow. */
 void install_stack_overflow_handler(void);
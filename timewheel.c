@@ -0,0 +1,84 @@
+#include <time.h>
+
+#include "timewheel.h"
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void timewheel_init(struct timewheel *w, uint64_t now) {
+    int i;
+
+    for (i = 0; i < WHEEL_SLOTS; i++) {
+        list_init(&w->slots[i]);
+    }
+    w->cursor = 0;
+    w->next_tick = now + WHEEL_TICK_NS;
+    w->count = 0;
+}
+
+void timewheel_add(struct timewheel *w, struct timer *t, uint64_t now, uint64_t timeout_ns) {
+    uint64_t ticks;
+
+    timewheel_del(w, t);
+
+    // Ticks are counted from the one that is due next, which may be in the past
+    if (now + timeout_ns <= w->next_tick) {
+        ticks = 0;
+    } else {
+        ticks = (now + timeout_ns - w->next_tick + WHEEL_TICK_NS - 1) / WHEEL_TICK_NS;
+    }
+    t->rounds = ticks / WHEEL_SLOTS;
+    list_push_back(&w->slots[(w->cursor + ticks) % WHEEL_SLOTS], &t->elem);
+    t->armed = true;
+    w->count++;
+}
+
+void timewheel_del(struct timewheel *w, struct timer *t) {
+    if (t->armed) {
+        list_remove(&t->elem);
+        t->armed = false;
+        w->count--;
+    }
+}
+
+void timewheel_advance(struct timewheel *w, uint64_t now, struct list *expired) {
+    while (w->next_tick <= now) {
+        struct list *slot = &w->slots[w->cursor];
+        struct list_elem *e = list_begin(slot);
+
+        while (e != list_end(slot)) {
+            struct timer *t = list_entry(e, struct timer, elem);
+            e = list_next(e);
+            if (t->rounds > 0) {
+                t->rounds--;
+                continue;
+            }
+            list_remove(&t->elem);
+            t->armed = false;
+            w->count--;
+            list_push_back(expired, &t->elem);
+        }
+
+        w->cursor = (w->cursor + 1) % WHEEL_SLOTS;
+        w->next_tick += WHEEL_TICK_NS;
+
+        // Nothing armed: skip the idle ticks instead of walking them
+        if (w->count == 0 && w->next_tick <= now) {
+            w->next_tick = now + WHEEL_TICK_NS;
+        }
+    }
+}
+
+int timewheel_timeout_ms(struct timewheel *w, uint64_t now) {
+    if (w->count == 0) {
+        return -1;
+    }
+    if (w->next_tick <= now) {
+        return 0;
+    }
+    return (w->next_tick - now + 999999) / 1000000;
+}
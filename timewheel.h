@@ -0,0 +1,52 @@
+#ifndef __TIMEWHEEL_H__
+#define __TIMEWHEEL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "list.h"
+
+/*
+ * timewheel.h
+ *
+ * A hashed timing wheel (Varghese & Lauck, scheme 6).  A timer lands in
+ * slot (now + ticks) % WHEEL_SLOTS together with the number of full
+ * revolutions still to go, so adding and removing a timer is O(1) and a
+ * tick only looks at the timers hashed to one slot.  Owned by a single
+ * thread; nothing here locks.
+ */
+
+#define WHEEL_SLOTS 1024
+#define WHEEL_TICK_NS 100000000ULL      /* 100ms */
+
+struct timer {
+    struct list_elem elem;
+    unsigned rounds;            /* revolutions left before it fires */
+    bool armed;
+};
+
+struct timewheel {
+    struct list slots[WHEEL_SLOTS];
+    unsigned cursor;            /* slot of the tick that is due next */
+    uint64_t next_tick;         /* when that tick is due, in ns */
+    unsigned long count;        /* armed timers */
+};
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t now_ns(void);
+
+void timewheel_init(struct timewheel *w, uint64_t now);
+
+/* Arm t to fire timeout_ns from now, rounded up to a tick; re-arms if armed */
+void timewheel_add(struct timewheel *w, struct timer *t, uint64_t now, uint64_t timeout_ns);
+
+/* Disarm t; harmless if it is not armed */
+void timewheel_del(struct timewheel *w, struct timer *t);
+
+/* Run every tick that is due by now and move the expired timers onto expired */
+void timewheel_advance(struct timewheel *w, uint64_t now, struct list *expired);
+
+/* Milliseconds until the next tick is due, or -1 if no timer is armed */
+int timewheel_timeout_ms(struct timewheel *w, uint64_t now);
+
+#endif /* __TIMEWHEEL_H__ */
@@ -0,0 +1,281 @@
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * The event loop relies on multishot accept and provided buffer rings
+ * (5.19).  SEND_ZC arrived in 6.0, so probing for it is a cheap way of
+ * making sure all of those are present.
+ */
+bool uring_supported(void) {
+    static const int needed[] = {
+        IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_READ, IORING_OP_SEND_ZC,
+        IORING_OP_TIMEOUT, IORING_OP_SPLICE
+    };
+    struct io_uring_params p;
+    struct io_uring_probe *probe;
+    size_t probe_sz = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    bool ok = true;
+    int fd, i;
+
+    memset(&p, 0, sizeof(p));
+    if ((fd = sys_io_uring_setup(4, &p)) < 0) {
+        return false;
+    }
+    probe = calloc(1, probe_sz);
+    if (probe == NULL || sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        ok = false;
+    }
+    for (i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+            ok = false;
+        }
+    }
+    free(probe);
+    close(fd);
+    return ok;
+}
+
+int uring_init(struct uring *u, unsigned entries, unsigned cq_entries) {
+    struct io_uring_params p;
+    char *sq, *cq;
+    int err;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    if ((u->fd = sys_io_uring_setup(entries, &p)) < 0) {
+        return -errno;
+    }
+
+    u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_sz > u->sq_ring_sz) {
+            u->sq_ring_sz = u->cq_ring_sz;
+        }
+        u->cq_ring_sz = u->sq_ring_sz;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+            goto fail;
+        }
+    }
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        goto fail;
+    }
+
+    sq = u->sq_ring;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->sqe_tail = *u->sq_tail;
+
+    cq = u->cq_ring;
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    // close and munmap may change errno, so keep the mmap error
+    err = errno;
+    uring_exit(u);
+    return -err;
+}
+
+// Also takes a ring uring_init gave up on halfway: what is NULL or
+// MAP_FAILED was never mapped
+void uring_exit(struct uring *u) {
+    if (u->sqes != NULL && u->sqes != MAP_FAILED) {
+        munmap(u->sqes, u->sqes_sz);
+    }
+    if (u->cq_ring != NULL && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring) {
+        munmap(u->cq_ring, u->cq_ring_sz);
+    }
+    if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED) {
+        munmap(u->sq_ring, u->sq_ring_sz);
+    }
+    close(u->fd);
+}
+
+// Publish the sqes handed out so far; returns how many are pending
+static unsigned uring_flush_sq(struct uring *u) {
+    unsigned tail = *u->sq_tail;
+
+    while (tail != u->sqe_tail) {
+        u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+        tail++;
+    }
+    __atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+    return tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *u) {
+    struct io_uring_sqe *sqe;
+
+    while (u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+        uring_submit_and_wait(u, 0);
+    }
+    sqe = &u->sqes[u->sqe_tail & *u->sq_mask];
+    u->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(struct uring *u, unsigned wait_nr) {
+    unsigned pending = uring_flush_sq(u);
+    int rc;
+
+    do {
+        rc = sys_io_uring_enter(u->fd, pending, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (rc < 0 && errno == EINTR);
+    return rc < 0 ? -errno : rc;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *u) {
+    unsigned head = *u->cq_head;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &u->cqes[head & *u->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *u) {
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_bufring_init(struct uring *u, struct uring_bufring *b, unsigned short bgid,
+                       unsigned nbufs, unsigned bufsz) {
+    struct io_uring_buf_reg reg;
+    size_t ring_sz = nbufs * sizeof(struct io_uring_buf);
+    unsigned i;
+
+    b->br = mmap(NULL, ring_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b->br == MAP_FAILED) {
+        return -errno;
+    }
+    b->bufs = malloc((size_t)nbufs * bufsz);
+    if (b->bufs == NULL) {
+        munmap(b->br, ring_sz);
+        return -ENOMEM;
+    }
+    b->nbufs = nbufs;
+    b->bufsz = bufsz;
+    b->bgid = bgid;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)b->br;
+    reg.ring_entries = nbufs;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int err = -errno;
+        free(b->bufs);
+        munmap(b->br, ring_sz);
+        return err;
+    }
+
+    b->br->tail = 0;
+    for (i = 0; i < nbufs; i++) {
+        uring_buf_recycle(b, i);
+    }
+    return 0;
+}
+
+char *uring_buf(struct uring_bufring *b, unsigned bid) {
+    return b->bufs + (size_t)bid * b->bufsz;
+}
+
+void uring_buf_recycle(struct uring_bufring *b, unsigned bid) {
+    unsigned short tail = b->br->tail;
+    struct io_uring_buf *buf = &b->br->bufs[tail & (b->nbufs - 1)];
+
+    buf->addr = (uintptr_t)uring_buf(b, bid);
+    buf->len = b->bufsz;
+    buf->bid = bid;
+    __atomic_store_n(&b->br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, int flags) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = flags;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+void uring_prep_recv_select(struct io_uring_sqe *sqe, int fd, unsigned short bgid, unsigned len) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = len;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+}
+
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, int flags) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | flags;
+}
+
+void uring_prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned len) {
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1;
+}
+
+void uring_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts) {
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)ts;
+    sqe->len = 1;
+}
+
+void uring_prep_splice(struct io_uring_sqe *sqe, int fd_in, int64_t off_in, int fd_out, int64_t off_out,
+                       unsigned len) {
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = off_in;
+    sqe->fd = fd_out;
+    sqe->off = off_out;
+    sqe->len = len;
+}
@@ -0,0 +1,89 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+/*
+ * uring.h
+ *
+ * A minimal io_uring wrapper on top of the raw system calls, just enough
+ * for the event loop: one submission and completion ring plus a ring of
+ * provided receive buffers.  Everything here is used by a single thread.
+ */
+
+struct uring {
+    int fd;
+
+    /* submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;          /* next sqe handed out, not yet published */
+
+    /* completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_sz;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+};
+
+/* Kernel-selected receive buffers, consumed by recv with IOSQE_BUFFER_SELECT */
+struct uring_bufring {
+    struct io_uring_buf_ring *br;
+    char *bufs;
+    unsigned nbufs;             /* power of two */
+    unsigned bufsz;
+    unsigned short bgid;
+};
+
+/* Does the kernel support every opcode and feature the event loop needs? */
+bool uring_supported(void);
+
+/* Set up a ring; returns 0 or -errno */
+int uring_init(struct uring *u, unsigned entries, unsigned cq_entries);
+
+/* Unmap the rings and close a ring set up with uring_init */
+void uring_exit(struct uring *u);
+
+/* Next free submission entry, zeroed; flushes the queue first if it is full */
+struct io_uring_sqe *uring_get_sqe(struct uring *u);
+
+/* Submit everything queued and wait for at least wait_nr completions */
+int uring_submit_and_wait(struct uring *u, unsigned wait_nr);
+
+/* Oldest unseen completion or NULL; mark it seen with uring_cqe_seen */
+struct io_uring_cqe *uring_peek_cqe(struct uring *u);
+void uring_cqe_seen(struct uring *u);
+
+/* Register nbufs buffers of bufsz bytes as buffer group bgid; returns 0 or -errno */
+int uring_bufring_init(struct uring *u, struct uring_bufring *b, unsigned short bgid,
+                       unsigned nbufs, unsigned bufsz);
+
+/* Address of buffer bid and giving it back to the kernel */
+char *uring_buf(struct uring_bufring *b, unsigned bid);
+void uring_buf_recycle(struct uring_bufring *b, unsigned bid);
+
+/* Request preparation helpers */
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, int flags);
+void uring_prep_recv_select(struct io_uring_sqe *sqe, int fd, unsigned short bgid, unsigned len);
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, int flags);
+/* An offset of -1 means the descriptor's own position, as for a pipe */
+void uring_prep_splice(struct io_uring_sqe *sqe, int fd_in, int64_t off_in, int fd_out, int64_t off_out,
+                       unsigned len);
+void uring_prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned len);
+/* Completes with -ETIME once ts (relative, which must outlive the request) has passed */
+void uring_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts);
+
+#endif /* __URING_H__ */
@@ -6,6 +6,12 @@
  * <div id="meminfo"> </div>
  * <div id="loadavg"> </div>
  *
+ * Each polls its 'url' every 'update' ms.  Give it a 'stream' attribute
+ * with the URL of the server's /stream instead, and the samples are
+ * pushed over one connection (where the browser has EventSource).
+ * The loadavg plot starts out with the server's recent past if it has a
+ * 'history' attribute with the URL of /history.
+ *
  * This code is written in a manner that should not interfere with
  * the original page in any way.
  *
@@ -71,7 +77,8 @@ function dowithJQuery($) {
         return a.href;
     }
 
-    function updateLoadaveragePlot(plot, divid, value, nvalues, title) {
+    // past, if given, holds earlier values, oldest first
+    function updateLoadaveragePlot(plot, divid, value, nvalues, title, past) {
         if (plot) {
             var data = plot.series[0].data;
             for (var i = 0; i < data.length - 1; i++)
@@ -89,9 +96,12 @@ function dowithJQuery($) {
             return plot;
         }
 
-        var data = [value];
-        for (var i = 2; i < nvalues; i++)
+        past = past || [];
+        var data = [];
+        for (var i = past.length + 2; i < nvalues; i++)
             data.push(0.0);
+        data = data.concat(past.slice(-(nvalues - 2)));
+        data.push(value);
 
         return $.jqplot(divid, [data], {
             seriesDefaults:{neighborThreshold:0, showMarker: false},
@@ -176,69 +186,132 @@ function dowithJQuery($) {
         });
     }
 
+    // call show with the metric at $el's url every 'update' ms, either
+    // polled with JSONP or, if $el has a 'stream' URL, pushed by the server
+    function watch($el, show) {
+        var url = $el.attr('url');
+        var stream = $el.attr('stream');
+        var updateInterval = Number($el.attr('update'));
+
+        if (stream && window.EventSource) {
+            // the event is named after the metric, the last part of url
+            var metric = url.replace(/.*\//, '');
+            var source = new EventSource(stream + "?metrics=" + metric
+                                         + "&interval=" + updateInterval);
+            source.addEventListener(metric, function (e) {
+                show(JSON.parse(e.data));
+            });
+            return;
+        }
+
+        function update () {
+            $.getJSON(url + "?callback=?", show);
+        }
+        update ();
+        setInterval(update, updateInterval);
+    }
+
+    // ms to wait for /history before plotting without it
+    var historyTimeout = 5000;
+
+    // undo the delta encoding of a /history series
+    function undelta(deltas) {
+        var values = [], sum = 0;
+        for (var i = 0; i < deltas.length; i++)
+            values.push(sum += deltas[i]);
+        return values;
+    }
+
     function renderWidgets($) {
         $('#meminfo').each(function () {
             var $div = $(this);
             var url = $div.attr('url');
-            var updateInterval = Number($div.attr('update'));
             var plot = undefined;
 
-            function update () {
-                $.getJSON(url + "?callback=?", function (data) {
-                    var MB = 1024;
-                    plot = showMemory(plot, $div.attr('id'),
-                        [
-                            { value: data.Cached / MB, label: "Cached" }, 
-                            { value: data.Buffers / MB, label: "Buffers" }, 
-                            { value: (data.MemTotal 
-                                      - data.MemFree 
-                                      - data.Cached 
-                                      - data.Buffers) / MB, label: "Anonymous" }, 
-                            { value: data.MemFree / MB, label: "Free" }
-                        ],
-                        data.MemTotal / MB, resolveURL(url)
-                    );
-                });
-            }
-            update ();
-            setInterval(update, updateInterval);
+            watch($div, function (data) {
+                var MB = 1024;
+                plot = showMemory(plot, $div.attr('id'),
+                    [
+                        { value: data.Cached / MB, label: "Cached" }, 
+                        { value: data.Buffers / MB, label: "Buffers" }, 
+                        { value: (data.MemTotal 
+                                  - data.MemFree 
+                                  - data.Cached 
+                                  - data.Buffers) / MB, label: "Anonymous" }, 
+                        { value: data.MemFree / MB, label: "Free" }
+                    ],
+                    data.MemTotal / MB, resolveURL(url)
+                );
+            });
         });
 
         $('.loadavg-text').each(function () {
             var $span = $(this);
-            var url = $span.attr('url');
-            var updateInterval = Number($span.attr('update'));
-
-            function update () {
-                $.getJSON(url + "?callback=?", function (data) {
-                    $span.text(
-                        "Load Average: " + data.loadavg.join(" ")
-                        + " Threads: " + data.running_threads
-                        + "/" + data.total_threads
-                    );
-                });
-            }
-            update ();
-            setInterval(update, updateInterval);
+
+            watch($span, function (data) {
+                $span.text(
+                    "Load Average: " + data.loadavg.join(" ")
+                    + " Threads: " + data.running_threads
+                    + "/" + data.total_threads
+                );
+            });
         });
 
         $('#loadavg').each(function () {
             var $div = $(this);
             var url = $div.attr('url');
-            var updateInterval = Number($div.attr('update'));
+            var history = $div.attr('history');
             var plot = undefined;
-
-            function update () {
-                $.getJSON(url + "?callback=?", function (data) {
+            var past = undefined;
+            var started = false;
+
+            function start () {
+                if (started)
+                    return;
+                started = true;
+                watch($div, function (data) {
                     plot = updateLoadaveragePlot(
                             plot, $div.attr('id'), Number(data.loadavg[0]), 
                             $div.width(),   // # values, 1 per pixel
                             resolveURL(url) + ": " +
-                            data.running_threads + "/" + data.total_threads);
+                            data.running_threads + "/" + data.total_threads,
+                            past);
                 });
             }
-            update ();
-            setInterval(update, updateInterval);
+            if (!history) {
+                start ();
+                return;
+            }
+            // the samples are closer together than our updates; keep
+            // one per update interval, counting back from the latest.
+            // A JSONP error only shows as a timeout; without the history
+            // the plot starts out empty, as it does without the attribute.
+            // jQuery 1.4 loads cross-site JSONP with a script tag and
+            // never times it out, hence the timer of our own.
+            setTimeout(start, historyTimeout);
+            $.ajax({
+                url: history + "?metric=loadavg",
+                dataType: 'jsonp',
+                timeout: historyTimeout,
+                success: function (h) {
+                    if (started)
+                        return;
+                    var time = undelta(h.time), load = undelta(h.load1);
+                    var every = Number($div.attr('update'));
+                    var next = Infinity;
+                    past = [];
+                    for (var i = time.length - 1; i >= 0; i--) {
+                        if (time[i] <= next) {
+                            past.unshift(load[i] / 100);
+                            next = time[i] - every;
+                        }
+                    }
+                    start ();
+                },
+                error: function () {
+                    start ();
+                }
+            });
         });
     };
 